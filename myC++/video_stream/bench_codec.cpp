@@ -0,0 +1,202 @@
+// Compares JPEG with H.264 (h264_encoder.h) on the same clip, frame by
+// frame as a streamer sends them: bytes and bitrate, luma PSNR of what the
+// viewer decodes, encode CPU time, encode latency and decode time.
+//
+//   ./bench_codec [clip.yuyv] [width] [height] [frames] [kbps] [gop]
+//
+// Without a clip, bench_tiles' static scene (sensor noise and a small moving
+// box) is generated. The bitrate column assumes 30 fps. The h264 row needs a
+// `make OPENH264=1` build.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "bench_util.h"
+#include "h264_decoder.h"
+#include "h264_encoder.h"
+#include "jpeg_encoder.h"
+
+static const int QUALITY = 75;
+static const double FPS = 30;
+
+struct CodecRun {
+    std::vector<std::vector<unsigned char>> frames;  // as sent
+    std::vector<double> encode_ms;                   // wall time per frame
+    double encode_cpu_ms = 0;                        // per frame
+    double decode_ms = 0;                            // per frame
+    double sse = 0;                                  // luma, summed over frames
+    int idr = 0;
+};
+
+// Squared error of one decoded luma plane against the clip's (studio range).
+// full_range rescales the decoded plane as the JPEG path encoded it.
+static double luma_sse(const unsigned char* yuyv, const unsigned char* y, int stride, int width, int height,
+                       bool full_range) {
+    double sse = 0;
+    for (int row = 0; row < height; ++row) {
+        const unsigned char* src = yuyv + (size_t)row * width * 2;
+        const unsigned char* dec = y + (size_t)row * stride;
+        for (int x = 0; x < width; ++x) {
+            double value = full_range ? 16 + dec[x] * 219.0 / 255.0 : dec[x];
+            double d = value - src[x * 2];
+            sse += d * d;
+        }
+    }
+    return sse;
+}
+
+static double psnr(const CodecRun& run, int width, int height) {
+    double mse = run.sse / ((double)width * height * run.frames.size());
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static void print_row(const char* name, const CodecRun& run, int width, int height) {
+    size_t bytes = 0;
+    for (const auto& f : run.frames) bytes += f.size();
+    size_t n = run.frames.size();
+    std::vector<double> latency = run.encode_ms;
+    std::sort(latency.begin(), latency.end());
+    printf("%-18s %11lu %8.0f %6.1f dB %10.3f ms %8.3f / %.3f ms %8.3f ms\n", name, (unsigned long)(bytes / n),
+           bytes * 8.0 * FPS / n / 1000, psnr(run, width, height), run.encode_cpu_ms, latency[n / 2],
+           latency[std::min(n - 1, n * 99 / 100)], run.decode_ms);
+}
+
+static void run_jpeg(const std::vector<unsigned char>& clip, int width, int height, int frames, CodecRun& run) {
+    size_t frame_size = (size_t)width * height * 2;
+    size_t clip_frames = clip.size() / frame_size;
+    JpegEncoder enc;
+    jpeg_encoder_init(enc, width, height, QUALITY, JpegInput::Yuv);
+    std::vector<unsigned char> out(jpeg_encoder_bound(enc));
+    double cpu = thread_cpu_seconds();
+    for (int f = 0; f < frames; ++f) {
+        double start = wall_seconds();
+        size_t size = jpeg_encode_yuyv(enc, &clip[(f % clip_frames) * frame_size], out.data(), out.size());
+        run.encode_ms.push_back((wall_seconds() - start) * 1000);
+        run.frames.emplace_back(out.begin(), out.begin() + size);
+    }
+    run.encode_cpu_ms = (thread_cpu_seconds() - cpu) * 1000 / frames;
+    run.idr = frames;
+    jpeg_encoder_destroy(enc);
+
+    // Decoded to YCbCr: the viewers' RGB conversion is left out, as the
+    // H.264 picture goes to a YUV texture unconverted.
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    std::vector<unsigned char> ycc((size_t)width * height * 3);
+    std::vector<unsigned char> luma((size_t)width * height);
+    double decode = 0;
+    for (int f = 0; f < frames; ++f) {
+        double start = thread_cpu_seconds();
+        jpeg_mem_src(&cinfo, run.frames[f].data(), run.frames[f].size());
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = JCS_YCbCr;
+        jpeg_start_decompress(&cinfo);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            unsigned char* row = &ycc[(size_t)cinfo.output_scanline * width * 3];
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        decode += thread_cpu_seconds() - start;
+        for (size_t i = 0; i < luma.size(); ++i) luma[i] = ycc[i * 3];
+        run.sse += luma_sse(&clip[(f % clip_frames) * frame_size], luma.data(), width, width, height, true);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    run.decode_ms = decode * 1000 / frames;
+}
+
+static bool run_h264(const std::vector<unsigned char>& clip, int width, int height, int frames, int kbps, int gop,
+                     CodecRun& run) {
+    size_t frame_size = (size_t)width * height * 2;
+    size_t clip_frames = clip.size() / frame_size;
+    H264Encoder enc;
+    if (!h264_encoder_init(enc, width, height, FPS, kbps, gop)) return false;
+    std::vector<unsigned char> out((size_t)width * height * 3);
+    double cpu = thread_cpu_seconds();
+    for (int f = 0; f < frames; ++f) {
+        bool idr, skipped;
+        double start = wall_seconds();
+        size_t size = h264_encode_yuyv(enc, &clip[(f % clip_frames) * frame_size], false, out.data(), out.size(), idr,
+                                       skipped);
+        run.encode_ms.push_back((wall_seconds() - start) * 1000);
+        if (!size) {
+            std::cerr << "frame " << f << (skipped ? " was skipped" : " did not encode") << "\n";
+            h264_encoder_destroy(enc);
+            return false;
+        }
+        run.frames.emplace_back(out.begin(), out.begin() + size);
+        run.idr += idr;
+    }
+    run.encode_cpu_ms = (thread_cpu_seconds() - cpu) * 1000 / frames;
+    h264_encoder_destroy(enc);
+
+    H264Decoder dec;
+    if (!h264_decoder_init(dec)) return false;
+    double decode = 0;
+    for (int f = 0; f < frames; ++f) {
+        H264Picture picture;
+        bool have_picture;
+        double start = thread_cpu_seconds();
+        bool ok = h264_decode(dec, run.frames[f].data(), run.frames[f].size(), picture, have_picture);
+        decode += thread_cpu_seconds() - start;
+        if (!ok || !have_picture) {
+            std::cerr << "frame " << f << " did not decode\n";
+            h264_decoder_destroy(dec);
+            return false;
+        }
+        run.sse += luma_sse(&clip[(f % clip_frames) * frame_size], picture.planes[0], picture.strides[0], width,
+                            height, false);
+    }
+    h264_decoder_destroy(dec);
+    run.decode_ms = decode * 1000 / frames;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 && argv[1][0] ? argv[1] : nullptr;
+    int width = argc > 2 ? atoi(argv[2]) : 640;
+    int height = argc > 3 ? atoi(argv[3]) : 480;
+    int frames = argc > 4 ? atoi(argv[4]) : 300;
+    int kbps = argc > 5 ? atoi(argv[5]) : 2000;
+    int gop = argc > 6 ? atoi(argv[6]) : 60;
+
+    std::vector<unsigned char> clip = path ? load_clip(path, width, height) : make_static_scene(width, height, frames);
+    if (clip.empty()) {
+        std::cerr << path << " holds less than one " << width << "x" << height << " frame\n";
+        return 1;
+    }
+
+    std::cout << width << "x" << height << ", " << frames << " frames from " << (path ? path : "static scene")
+              << "\n";
+    printf("%-18s %11s %8s %9s %13s %21s %11s\n", "codec", "bytes/frame", "kbit/s", "PSNR Y", "encode CPU",
+           "encode p50 / p99", "decode CPU");
+
+    CodecRun jpeg;
+    run_jpeg(clip, width, height, frames, jpeg);
+    char name[32];
+    snprintf(name, sizeof(name), "jpeg q%d", QUALITY);
+    print_row(name, jpeg, width, height);
+
+    if (!video_codec_available(VideoCodec::H264)) {
+        printf("h264  not built (make OPENH264=1)\n");
+        return 0;
+    }
+    CodecRun h264;
+    if (!run_h264(clip, width, height, frames, kbps, gop, h264)) return 1;
+    snprintf(name, sizeof(name), "h264 %dk gop %d", kbps, gop);
+    print_row(name, h264, width, height);
+    size_t jpeg_bytes = 0, h264_bytes = 0;
+    for (const auto& f : jpeg.frames) jpeg_bytes += f.size();
+    for (const auto& f : h264.frames) h264_bytes += f.size();
+    printf("h264 sends %.1fx fewer bytes (%d IDR frames), %.1f dB PSNR difference, %.1fx the encode CPU\n",
+           (double)jpeg_bytes / h264_bytes, h264.idr, psnr(h264, width, height) - psnr(jpeg, width, height),
+           h264.encode_cpu_ms / jpeg.encode_cpu_ms);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Compares the JpegEncoder inputs on the same frames: YUYV -> RGB24 ->
+// libjpeg (the original path) against raw planar YCbCr. Reports CPU time and
+// output size per frame. Built with TURBOJPEG=1, every input then runs again
+// on the TurboJPEG backend with the same frames and quality.
+//
+//   ./bench_encode [clip.yuyv] [width] [height] [frames]
+//
+// Without a clip, a moving gradient test pattern is generated.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "bench_util.h"
+#include "jpeg_encoder.h"
+
+// CPU ms per frame; bytes gets the average JPEG size.
+static double encode_ms(const std::vector<unsigned char>& clip, int width, int height, int frames, JpegInput input,
+                        JpegBackend backend, unsigned long& bytes) {
+    size_t frame_size = (size_t)width * height * 2;
+    size_t clip_frames = clip.size() / frame_size;
+    JpegEncoder enc;
+    if (!jpeg_encoder_init(enc, width, height, 75, input, nullptr, backend)) exit(1);
+
+    std::vector<unsigned char> jpeg_buf(jpeg_encoder_bound(enc));
+    unsigned long total_bytes = 0;
+    double start = cpu_seconds();
+    for (int f = 0; f < frames; ++f) {
+        total_bytes += jpeg_encode_yuyv(enc, &clip[(f % clip_frames) * frame_size], jpeg_buf.data(), jpeg_buf.size());
+    }
+    double ms = (cpu_seconds() - start) * 1000.0 / frames;
+    jpeg_encoder_destroy(enc);
+    bytes = total_bytes / frames;
+    return ms;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 && argv[1][0] ? argv[1] : nullptr;
+    int width = argc > 2 ? atoi(argv[2]) : 640;
+    int height = argc > 3 ? atoi(argv[3]) : 480;
+    int frames = argc > 4 ? atoi(argv[4]) : 100;
+
+    std::vector<unsigned char> clip = load_clip(path, width, height);
+    if (clip.empty()) {
+        std::cerr << path << " holds less than one " << width << "x" << height << " frame\n";
+        return 1;
+    }
+
+    std::cout << width << "x" << height << ", " << frames << " frames from "
+              << (path ? path : "test pattern") << "\n";
+
+    const char* names[] = { "rgb", "yuv", "yuv422" };
+    double cpu_ms[3] = {};
+    unsigned long bytes[3] = {};
+    for (int m = 0; m < 3; ++m) {
+        JpegInput input;
+        parse_jpeg_input(names[m], input);
+        cpu_ms[m] = encode_ms(clip, width, height, frames, input, JpegBackend::Libjpeg, bytes[m]);
+        printf("%-6s %7.3f ms CPU/frame  %8lu bytes/frame\n", names[m], cpu_ms[m], bytes[m]);
+    }
+    for (int m = 1; m < 3; ++m) {
+        printf("%s saves %.3f ms CPU/frame (%.0f%%) against rgb\n", names[m], cpu_ms[0] - cpu_ms[m],
+               100.0 * (cpu_ms[0] - cpu_ms[m]) / cpu_ms[0]);
+    }
+
+    if (!jpeg_backend_available(JpegBackend::Turbo)) {
+        printf("turbo  not built (make TURBOJPEG=1)\n");
+        return 0;
+    }
+    for (int m = 0; m < 3; ++m) {
+        JpegInput input;
+        parse_jpeg_input(names[m], input);
+        unsigned long turbo_bytes;
+        double turbo_ms = encode_ms(clip, width, height, frames, input, JpegBackend::Turbo, turbo_bytes);
+        printf("turbo %-6s %7.3f ms CPU/frame  %8lu bytes/frame  saves %.3f ms (%.0f%%) against libjpeg\n",
+               names[m], turbo_ms, turbo_bytes, cpu_ms[m] - turbo_ms, 100.0 * (cpu_ms[m] - turbo_ms) / cpu_ms[m]);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Recovery rate and added latency of NACK retransmission (udp_retransmit.h)
+// against XOR parity and no protection, under simulated loss. The real
+// sender, retransmission ring and reassembler exchange packets through a
+// simulated link with a fixed one-way delay; data, parity, NACKs and resent
+// chunks are all lost at the same rate. Time advances in 1 ms ticks.
+//
+//   ./bench_nack [rtt_ms] [repair_ms] [frames]
+//
+// Added latency is the time from a frame's packets reaching the receiver to
+// the frame being handed over: zero for an intact frame, a round trip or
+// more for a repaired one, and for frames held behind it.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "udp_reassembly.h"
+#include "udp_retransmit.h"
+#include "udp_send.h"
+
+static const size_t PACKET_SIZE = 1400;
+static const int FRAME_INTERVAL_MS = 33;
+
+struct Config {
+    const char* name;
+    int fec_percent;
+    bool nack;
+};
+
+struct Result {
+    double delivered;  // fraction of frames shown
+    double repaired;   // fraction of frames that needed a resent chunk
+    double avg_ms;     // added latency over shown frames
+    double p99_ms;
+    double overhead;   // bytes sent beyond the frames' data chunks
+    bool corrupt;
+};
+
+struct Event {
+    bool to_sender;
+    std::vector<unsigned char> data;
+};
+
+static Result run(const std::vector<unsigned char>& frame, int frames, const Config& c, double loss, int rtt_ms,
+                  int repair_ms) {
+    UdpSender sender;
+    sockaddr_in dest{};
+    udp_sender_init(sender, -1, dest, UdpSendMode::Mmsg, PACKET_SIZE, frame.size(), c.fec_percent);
+    RetransmitRing ring;
+    retransmit_init(ring, sender, 16, frame.size(), repair_ms);
+
+    Reassembler r;
+    r.repair_ms = c.nack ? repair_ms : 0;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::multimap<uint64_t, Event> link;
+    auto transmit = [&](uint64_t now, bool to_sender, std::vector<unsigned char> data) {
+        if (u(rng) >= loss) link.emplace(now + rtt_ms / 2, Event{ to_sender, std::move(data) });
+    };
+
+    std::vector<uint8_t> jpeg;
+    std::vector<std::vector<uint8_t>> nacks;
+    std::vector<std::vector<unsigned char>> resend;
+    std::vector<double> latency;
+    uint64_t bytes = 0;
+    uint32_t id;
+    bool corrupt = false;
+
+    auto deliver = [&](uint64_t now) {
+        if (jpeg.size() != frame.size() || memcmp(jpeg.data(), frame.data(), frame.size()) != 0) corrupt = true;
+        latency.push_back(now - (id * FRAME_INTERVAL_MS + rtt_ms / 2));
+    };
+
+    uint64_t end = (uint64_t)frames * FRAME_INTERVAL_MS + repair_ms + rtt_ms + 250;
+    for (uint64_t now = 0; now < end; ++now) {
+        if (now % FRAME_INTERVAL_MS == 0 && now / FRAME_INTERVAL_MS < (uint64_t)frames) {
+            uint32_t f = now / FRAME_INTERVAL_MS;
+            retransmit_store(ring, f, frame.data(), frame.size(), now);
+            udp_build_packets(sender, f, frame.data(), frame.size());
+            for (size_t i = 0; i < sender.npackets; ++i) {
+                const UdpPacket& p = sender.packets[i];
+                std::vector<unsigned char> dgram(p.header, p.header + p.header_len);
+                dgram.insert(dgram.end(), p.payload, p.payload + p.payload_len);
+                bytes += dgram.size();
+                transmit(now, false, std::move(dgram));
+            }
+        }
+
+        while (!link.empty() && link.begin()->first <= now) {
+            Event e = std::move(link.begin()->second);
+            link.erase(link.begin());
+            if (e.to_sender) {
+                resend.clear();
+                retransmit_collect(ring, e.data.data(), e.data.size(), now, resend);
+                for (auto& p : resend) {
+                    bytes += p.size();
+                    transmit(now, false, std::move(p));
+                }
+            } else if (reassembler_add(r, e.data.data(), e.data.size(), now, jpeg, &id)) {
+                deliver(now);
+            }
+        }
+        while (reassembler_poll(r, now, jpeg, &id)) deliver(now);
+
+        nacks.clear();
+        reassembler_nacks(r, now, nacks);
+        for (auto& n : nacks) {
+            bytes += n.size();
+            transmit(now, true, std::move(n));
+        }
+        reassembler_expire(r, now);
+    }
+
+    Result res{};
+    res.delivered = (double)latency.size() / frames;
+    res.repaired = (double)r.stats.repaired_frames / frames;
+    std::sort(latency.begin(), latency.end());
+    double sum = 0;
+    for (double l : latency) sum += l;
+    res.avg_ms = latency.empty() ? 0 : sum / latency.size();
+    res.p99_ms = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+    res.corrupt = corrupt;
+
+    // Overhead against the same frames sent as bare chunks.
+    size_t chunk = PACKET_SIZE - UDP_HEADER_SIZE;
+    size_t parts = (frame.size() + chunk - 1) / chunk;
+    double base = (double)frames * (frame.size() + parts * UDP_HEADER_SIZE);
+    res.overhead = bytes / base - 1;
+    return res;
+}
+
+int main(int argc, char** argv) {
+    int rtt_ms = argc > 1 ? atoi(argv[1]) : 10;
+    int repair_ms = argc > 2 ? atoi(argv[2]) : 100;
+    int frames = argc > 3 ? atoi(argv[3]) : 1000;
+
+    std::vector<unsigned char> frame(20 * 1024);
+    std::mt19937 rng(7);
+    for (auto& b : frame) b = rng();
+
+    const Config configs[] = {
+        { "none", 0, false },
+        { "fec 20%", 20, false },
+        { "nack", 0, true },
+        { "nack + fec 20%", 20, true },
+    };
+    const double rates[] = { 0.01, 0.02, 0.05, 0.10 };
+
+    printf("20 KB frames every %d ms, RTT %d ms, repair window %d ms, %d frames\n", FRAME_INTERVAL_MS, rtt_ms,
+           repair_ms, frames);
+    printf("%-16s %6s %10s %10s %12s %12s %10s\n", "", "loss", "shown", "repaired", "avg +ms", "p99 +ms", "bytes");
+    for (const Config& c : configs) {
+        for (double rate : rates) {
+            Result res = run(frame, frames, c, rate, rtt_ms, repair_ms);
+            printf("%-16s %5.1f%% %9.1f%% %9.1f%% %12.1f %12.1f %+9.1f%%%s\n", c.name, rate * 100,
+                   res.delivered * 100, res.repaired * 100, res.avg_ms, res.p99_ms, res.overhead * 100,
+                   res.corrupt ? " CORRUPT" : "");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Runs the streamers' whole capture -> encode pipeline headless, with no
+// camera and no network: frames are counted and dropped where a streamer
+// would send them. Reports frame rate, CPU time per frame and encoded size.
+//
+//   ./bench_pipeline [streamer options] [-N frames]
+//
+// Takes the streamers' options (-d, -w, -s, -e, -T, -G, ...). By default
+// the source is the 640x480 test pattern, unpaced (-r 0), for 600 frames;
+// -d clip.yuyv or -d pattern:1920x1080 measure other inputs. With -a the
+// size counted is that of the abbreviated frames (jpeg_tables.h).
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "bench_util.h"
+#include "capture.h"
+#include "jpeg_tables.h"
+#include "pipeline.h"
+#include "stream_options.h"
+
+int main(int argc, char** argv) {
+    StreamOptions options;
+    options.device = "pattern";
+    options.pipeline.fps = 0;
+    options.pipeline.report_every = 0;
+    int frames = 600;
+
+    int opt;
+    while ((opt = getopt(argc, argv, STREAM_OPTSTRING "N:")) != -1) {
+        if (opt == 'N') {
+            frames = atoi(optarg);
+            continue;
+        }
+        if (!parse_stream_option(opt, optarg, options)) {
+            std::cerr << "Usage: " << argv[0] << " [options]\n" << STREAM_USAGE
+                      << "  -N frames            frames to run for (default 600)\n";
+            return 1;
+        }
+    }
+
+    Capture cap;
+    if (!capture_open(cap, options.device, 640, 480, options.nbuffers, options.format, options.memory)) return 1;
+
+    JpegTables tables;
+    std::vector<unsigned char> abbreviated;
+    if (options.abbreviated) abbreviated.resize(pipeline_frame_capacity(cap, options.pipeline));
+
+    int sent = 0;
+    uint64_t bytes = 0;
+    double wall = wall_seconds(), cpu = cpu_seconds();
+    bool ok = pipeline_run(cap, options.pipeline, [&](const PipelineFrame& frame) {
+        size_t size = frame.jpeg_size;
+        if (options.abbreviated) {
+            uint16_t needs;
+            size = jpeg_tables_abbreviate(tables, frame.jpeg, frame.jpeg_size, abbreviated.data(), needs);
+        }
+        bytes += size;
+        return ++sent < frames;
+    });
+    wall = wall_seconds() - wall;
+    cpu = cpu_seconds() - cpu;
+    capture_close(cap);
+
+    printf("%dx%d, %d workers, %d slices, %d frames in %.2f s: %.1f fps, %.3f ms CPU/frame, %lu bytes/frame\n",
+           cap.width, cap.height, options.pipeline.codec == VideoCodec::H264 ? 1 : options.pipeline.workers,
+           options.pipeline.slices, sent, wall, sent / wall, sent ? cpu * 1000 / sent : 0.0, sent ? (unsigned long)(bytes / sent) : 0UL);
+    if (options.abbreviated) jpeg_tables_report(tables);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// Encode time per frame against the number of slices (threads) the frame is
+// split into. Wall time is what matters for latency; CPU time shows the
+// overhead of the extra headers and thread hand-off.
+//
+//   ./bench_slices [clip.yuyv] [width] [height] [frames] [input]
+//
+// Without a clip, a moving gradient test pattern is generated at 1920x1080.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "slice_encoder.h"
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 && argv[1][0] ? argv[1] : nullptr;
+    int width = argc > 2 ? atoi(argv[2]) : 1920;
+    int height = argc > 3 ? atoi(argv[3]) : 1080;
+    int frames = argc > 4 ? atoi(argv[4]) : 60;
+    JpegInput input = JpegInput::Yuv;
+    if (argc > 5 && !parse_jpeg_input(argv[5], input)) {
+        std::cerr << "unknown input " << argv[5] << "\n";
+        return 1;
+    }
+    size_t frame_size = (size_t)width * height * 2;
+
+    std::vector<unsigned char> clip = load_clip(path, width, height);
+    if (clip.empty()) {
+        std::cerr << path << " holds less than one " << width << "x" << height << " frame\n";
+        return 1;
+    }
+    size_t clip_frames = clip.size() / frame_size;
+
+    unsigned cores = std::thread::hardware_concurrency();
+    printf("%dx%d, %d frames, %u cores\n", width, height, frames, cores);
+
+    double base = 0;
+    for (int slices = 1; slices <= 16; slices *= 2) {
+        SliceEncoder enc;
+        if (!slice_encoder_init(enc, width, height, 75, input, slices)) return 1;
+        std::vector<unsigned char> out(slice_encoder_bound(enc));
+
+        size_t bytes = 0;
+        double wall = wall_seconds();
+        double cpu = cpu_seconds();
+        for (int f = 0; f < frames; ++f) {
+            const unsigned char* src = clip.data() + (f % clip_frames) * frame_size;
+            bytes += slice_encode_yuyv(enc, src, out.data(), out.size());
+        }
+        wall = (wall_seconds() - wall) * 1000 / frames;
+        cpu = (cpu_seconds() - cpu) * 1000 / frames;
+        if (slices == 1) base = wall;
+
+        printf("slices %2zu: %7.2f ms/frame wall, %7.2f ms/frame cpu, %8zu bytes/frame, speedup %.2fx",
+               enc.bands.size(), wall, cpu, bytes / frames, base / wall);
+        // Bands are whole MCU rows of equal height, which may take fewer than asked for.
+        if (enc.bands.size() != (size_t)slices) printf(" (%d asked for)", slices);
+        printf("\n");
+        slice_encoder_destroy(enc);
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Compares whole-frame JPEGs with tile deltas (tile_delta.h) on a mostly
+// static scene: bytes and CPU time per frame, and the tile SAD paths.
+//
+//   ./bench_tiles [clip.yuyv] [width] [height] [frames] [save.yuyv]
+//
+// Without a clip, a static scene with sensor noise and a small moving box
+// is generated; save.yuyv writes it out for the streamers' -d option.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "bench_util.h"
+#include "jpeg_encoder.h"
+#include "tile_delta.h"
+
+static const int KEYFRAME_INTERVAL = 60;
+static const uint32_t THRESHOLD = 1024;
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 && argv[1][0] ? argv[1] : nullptr;
+    int width = argc > 2 ? atoi(argv[2]) : 640;
+    int height = argc > 3 ? atoi(argv[3]) : 480;
+    int frames = argc > 4 ? atoi(argv[4]) : 300;
+    const char* save = argc > 5 ? argv[5] : nullptr;
+    size_t frame_size = (size_t)width * height * 2;
+
+    std::vector<unsigned char> clip = path ? load_clip(path, width, height) : make_static_scene(width, height, frames);
+    if (clip.empty()) {
+        std::cerr << path << " holds less than one " << width << "x" << height << " frame\n";
+        return 1;
+    }
+    if (save) {
+        FILE* out = fopen(save, "wb");
+        if (!out || fwrite(clip.data(), 1, clip.size(), out) != clip.size()) { perror(save); return 1; }
+        fclose(out);
+    }
+    size_t clip_frames = clip.size() / frame_size;
+    auto frame = [&](int f) { return &clip[(f % clip_frames) * frame_size]; };
+
+    std::cout << width << "x" << height << ", " << frames << " frames from " << (path ? path : "static scene")
+              << ", keyframe every " << KEYFRAME_INTERVAL << ", threshold " << THRESHOLD << "\n";
+
+    JpegEncoder enc;
+    jpeg_encoder_init(enc, width, height, 75, JpegInput::Yuv);
+    std::vector<unsigned char> out(jpeg_encoder_bound(enc) + tile_delta_header_size(width, height));
+
+    // Whole frames
+    unsigned long full_bytes = 0;
+    double start = cpu_seconds();
+    for (int f = 0; f < frames; ++f) full_bytes += jpeg_encode_yuyv(enc, frame(f), out.data(), out.size());
+    double full_ms = (cpu_seconds() - start) * 1000.0 / frames;
+
+    // Tile deltas, as the pipeline does them
+    TileDiff diff;
+    if (!tile_diff_init(diff, width, height, THRESHOLD)) {
+        std::cerr << "frame size is not a whole number of tiles\n";
+        return 1;
+    }
+    JpegEncoder mosaic_enc;
+    jpeg_encoder_init(mosaic_enc, width, height, 75, JpegInput::Yuv);
+    std::vector<unsigned char> mosaic(frame_size);
+    std::vector<uint8_t> map(tile_map_bytes(width, height));
+    int tiles = tile_count_x(width) * tile_count_y(height);
+    unsigned long delta_bytes = 0, changed_tiles = 0;
+    int keyframes = 0, deltas = 0;
+    start = cpu_seconds();
+    for (int f = 0; f < frames; ++f) {
+        const unsigned char* src = frame(f);
+        int changed = 0;
+        bool key = !diff.have_reference || f % KEYFRAME_INTERVAL == 0;
+        if (!key) {
+            changed = tile_diff_compare(diff, src, map.data());
+            key = changed * 4 > tiles * 3;
+        }
+        if (key) {
+            delta_bytes += jpeg_encode_yuyv(enc, src, out.data(), out.size());
+            tile_diff_commit(diff, src, nullptr);
+            keyframes++;
+            continue;
+        }
+        size_t header = tile_delta_header_size(width, height);
+        tile_delta_write_header(out.data(), width, height, map.data(), changed);
+        size_t size = header;
+        if (changed) {
+            tile_delta_gather(src, width, height, map.data(), mosaic.data());
+            jpeg_encoder_set_height(mosaic_enc, tile_mosaic_height(width, changed));
+            size += jpeg_encode_yuyv(mosaic_enc, mosaic.data(), out.data() + header, out.size() - header);
+        }
+        tile_diff_commit(diff, src, map.data());
+        delta_bytes += size;
+        changed_tiles += changed;
+        deltas++;
+    }
+    double delta_ms = (cpu_seconds() - start) * 1000.0 / frames;
+    jpeg_encoder_destroy(mosaic_enc);
+    jpeg_encoder_destroy(enc);
+
+    printf("whole frames  %8.3f ms CPU/frame  %8lu bytes/frame\n", full_ms, full_bytes / frames);
+    printf("tile deltas   %8.3f ms CPU/frame  %8lu bytes/frame  (%d keyframes, %d deltas, %.1f%% of tiles changed)\n",
+           delta_ms, delta_bytes / frames, keyframes, deltas, deltas ? 100.0 * changed_tiles / ((double)deltas * tiles) : 0.0);
+    printf("tile deltas save %.0f%% of the bytes and %.0f%% of the CPU time\n",
+           100.0 * (1.0 - (double)delta_bytes / full_bytes), 100.0 * (1.0 - delta_ms / full_ms));
+
+    // The comparison alone, per SAD path, over every tile of one frame pair
+    // (kept in cache, so this is compute rather than memory bound).
+    const char* names[] = { "scalar", "sse2", "avx2" };
+    tile_sad_fn fns[] = { tile_sad_scalar, tile_sad_sse2, tile_sad_avx2 };
+    size_t stride = (size_t)width * 2;
+    for (int m = 0; m < 3; ++m) {
+        const int reps = 200;
+        uint64_t sink = 0;
+        start = cpu_seconds();
+        for (int r = 0; r < reps; ++r) {
+            const unsigned char* a = frame(0);
+            const unsigned char* b = frame(1);
+            for (int ty = 0; ty < tile_count_y(height); ++ty) {
+                for (int tx = 0; tx < tile_count_x(width); ++tx) {
+                    size_t off = (size_t)ty * TILE_SIZE * stride + tx * TILE_SIZE * 2;
+                    sink += fns[m](a + off, b + off, stride);
+                }
+            }
+        }
+        printf("sad %-6s %7.3f ms/frame (checksum %lu)\n", names[m], (cpu_seconds() - start) * 1000.0 / reps,
+               (unsigned long)sink);
+    }
+    printf("tile_sad() uses %s\n", tile_sad_path());
+    return 0;
+}
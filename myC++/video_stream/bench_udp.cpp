@@ -0,0 +1,102 @@
+// Compares the UDP chunk send modes (udp_send.h) over loopback: one sendto()
+// per chunk, one sendmmsg() per frame, and UDP_SEGMENT (GSO) sends.
+// Reports packets per second, syscalls and the sending thread's CPU time
+// per frame. A receiver thread reassembles frames and checks every byte, so
+// the modes are also verified to produce the same datagrams.
+//
+//   ./bench_udp [frame_kb] [frames]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "udp_send.h"
+
+static const size_t PACKET_SIZE = 1400;
+
+struct Received {
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bad{0};
+};
+
+// Checks each datagram against the frame it claims to be part of.
+static void receive(int fd, const std::vector<unsigned char>& frame, Received& r) {
+    size_t max_data = PACKET_SIZE - 8;
+    unsigned char buf[2048];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        if (n == 1) return;  // end marker
+
+        uint16_t total, index;
+        memcpy(&total, buf + 4, 2);
+        memcpy(&index, buf + 6, 2);
+        total = ntohs(total);
+        index = ntohs(index);
+        size_t expect = index < total - 1 ? max_data : frame.size() - index * max_data;
+        if ((size_t)n != expect + 8 || memcmp(buf + 8, frame.data() + index * max_data, expect) != 0) r.bad++;
+        r.packets++;
+    }
+}
+
+static void run(UdpSendMode mode, size_t frame_size, int frames) {
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int big = 64 << 20;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(rx, (sockaddr*)&addr, sizeof(addr));
+    getsockname(rx, (sockaddr*)&addr, &len);
+
+    std::vector<unsigned char> frame(frame_size);
+    for (size_t i = 0; i < frame_size; ++i) frame[i] = i * 131 + (i >> 8);
+
+    Received received;
+    std::thread receiver(receive, rx, std::cref(frame), std::ref(received));
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    UdpSender sender;
+    if (!udp_sender_init(sender, fd, addr, mode, PACKET_SIZE, frame_size)) return;
+
+    double wall = wall_seconds();
+    double cpu = thread_cpu_seconds();
+    for (int f = 0; f < frames; ++f) udp_send_frame(sender, f, frame.data(), frame.size());
+    cpu = thread_cpu_seconds() - cpu;
+    wall = wall_seconds() - wall;
+
+    // Let the receiver catch up, then stop it.
+    usleep(200000);
+    unsigned char end = 0;
+    sendto(fd, &end, 1, 0, (sockaddr*)&addr, sizeof(addr));
+    receiver.join();
+    close(fd);
+    close(rx);
+
+    const UdpSendStats& s = sender.stats;
+    printf("%-6s %9.0f packets/s %7.1f us CPU/frame %6.1f syscalls/frame, received %lu/%lu%s%s\n",
+           udp_send_mode_name(sender.mode), s.packets / wall, cpu * 1e6 / frames, (double)s.syscalls / frames,
+           (unsigned long)received.packets.load(), (unsigned long)s.packets,
+           received.bad ? ", CORRUPT" : "", sender.mode != mode ? " (fell back)" : "");
+}
+
+int main(int argc, char** argv) {
+    size_t frame_kb = argc > 1 ? atoi(argv[1]) : 64;
+    int frames = argc > 2 ? atoi(argv[2]) : 2000;
+
+    printf("%zu KB frames, %d frames, %zu-byte packets over loopback\n", frame_kb, frames, PACKET_SIZE);
+    run(UdpSendMode::Sendto, frame_kb * 1024, frames);
+    run(UdpSendMode::Mmsg, frame_kb * 1024, frames);
+    run(UdpSendMode::Gso, frame_kb * 1024, frames);
+    return 0;
+}
@@ -0,0 +1,255 @@
+// Compares the blocking send loop with the io_uring loop (uring_stream.h)
+// for one source fanned out to several loopback TCP viewers. The blocking
+// loop sleeps until each frame slot (clock_nanosleep, as pacer_wait() does
+// for replayed sources) and writes the frame to every socket with one
+// gathered sendmsg each. The io_uring loop waits on an absolute timeout
+// instead, queues one SENDMSG per viewer, and submits them and waits for
+// the next slot in a single io_uring_enter(). Reports syscalls and CPU time
+// per frame; the CPU column covers the whole process (including the
+// kernel's io-wq workers) minus the threads reading on the viewers' side.
+//
+//   ./bench_uring [viewers] [frame_kb] [frames] [fps]
+//
+// Capture and encoding are left out: both loops send the same buffer.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "tcp_send.h"
+#include "uring.h"
+
+struct Viewer {
+    int sender = -1;
+    int receiver = -1;
+    std::thread rx;
+    double rx_cpu = 0;  // the reading thread's CPU time, once it is done
+};
+
+struct RunResult {
+    uint64_t syscalls = 0;
+    uint64_t skipped = 0;  // uring: frames a viewer missed with a send in flight
+    double cpu = 0;
+    double wall = 0;
+};
+
+static int connect_pair(int& receiver) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+        perror("bind/listen");
+        return -1;
+    }
+    getsockname(listener, (sockaddr*)&addr, &len);
+
+    receiver = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(receiver, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("connect"); return -1; }
+    int sender = accept(listener, nullptr, nullptr);
+    close(listener);
+    return sender;
+}
+
+static void drain(Viewer* v) {
+    std::vector<char> buf(1 << 18);
+    while (read(v->receiver, buf.data(), buf.size()) > 0) {}
+    v->rx_cpu = thread_cpu_seconds();
+}
+
+static bool open_viewers(std::vector<Viewer>& viewers) {
+    for (Viewer& v : viewers) {
+        v.sender = connect_pair(v.receiver);
+        if (v.sender < 0) return false;
+        v.rx = std::thread(drain, &v);
+    }
+    return true;
+}
+
+// Closes the viewers and takes their readers' CPU time out of result.cpu,
+// which holds the process CPU time at the start of the run.
+static void close_viewers(std::vector<Viewer>& viewers, RunResult& result) {
+    for (Viewer& v : viewers) shutdown(v.sender, SHUT_WR);
+    double rx_cpu = 0;
+    for (Viewer& v : viewers) {
+        v.rx.join();
+        rx_cpu += v.rx_cpu;
+        close(v.sender);
+        close(v.receiver);
+    }
+    result.cpu = cpu_seconds() - result.cpu - rx_cpu;
+}
+
+static void next_slot(timespec& slot, long interval_ns) {
+    slot.tv_nsec += interval_ns;
+    while (slot.tv_nsec >= 1000000000L) {
+        slot.tv_nsec -= 1000000000L;
+        slot.tv_sec++;
+    }
+}
+
+static RunResult run_blocking(int count, const std::vector<unsigned char>& frame, int frames, long interval_ns) {
+    RunResult result;
+    std::vector<Viewer> viewers(count);
+    if (!open_viewers(viewers)) return result;
+
+    unsigned char header[4];
+    uint32_t size_net = htonl(frame.size());
+    memcpy(header, &size_net, sizeof(header));
+
+    result.cpu = cpu_seconds();
+    result.wall = wall_seconds();
+    timespec slot;
+    clock_gettime(CLOCK_MONOTONIC, &slot);
+    for (int f = 0; f < frames; ++f) {
+        next_slot(slot, interval_ns);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slot, nullptr);
+        result.syscalls++;
+        for (Viewer& v : viewers) {
+            size_t offset = 0, total = sizeof(header) + frame.size();
+            while (offset < total) {
+                bool zerocopy;
+                ssize_t n = tcp_send_frame(v.sender, TcpSendMode::Gather, header, sizeof(header), frame.data(),
+                                           frame.size(), offset, &zerocopy);
+                result.syscalls++;
+                if (n < 0) { perror("send"); return result; }
+                offset += n;
+            }
+        }
+    }
+    result.wall = wall_seconds() - result.wall;
+    close_viewers(viewers, result);
+    return result;
+}
+
+struct UringViewerSend {
+    size_t offset = 0;
+    bool busy = false;
+    iovec iov[2];
+    msghdr msg;
+};
+
+static void queue_send(Uring& ring, Viewer& v, UringViewerSend& s, unsigned char* header,
+                       const std::vector<unsigned char>& frame, uint64_t index) {
+    int n = 0;
+    if (s.offset < 4) {
+        s.iov[n++] = iovec{ header + s.offset, 4 - s.offset };
+        s.iov[n++] = iovec{ (void*)frame.data(), frame.size() };
+    } else {
+        s.iov[n++] = iovec{ (void*)(frame.data() + s.offset - 4), frame.size() - (s.offset - 4) };
+    }
+    s.msg = msghdr{};
+    s.msg.msg_iov = s.iov;
+    s.msg.msg_iovlen = n;
+    io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) {
+        uring_submit(ring, 0);
+        sqe = uring_get_sqe(ring);
+    }
+    uring_prep_sendmsg(sqe, v.sender, &s.msg, MSG_NOSIGNAL, index + 1);
+    s.busy = true;
+}
+
+static RunResult run_uring(int count, const std::vector<unsigned char>& frame, int frames, long interval_ns) {
+    RunResult result;
+    Uring ring;
+    if (!uring_init(ring, 256)) return result;
+    std::vector<Viewer> viewers(count);
+    if (!open_viewers(viewers)) return result;
+    std::vector<UringViewerSend> sends(count);
+
+    unsigned char header[4];
+    uint32_t size_net = htonl(frame.size());
+    memcpy(header, &size_net, sizeof(header));
+
+    result.cpu = cpu_seconds();
+    result.wall = wall_seconds();
+    __kernel_timespec slot;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot.tv_sec = now.tv_sec;
+    slot.tv_nsec = now.tv_nsec;
+    auto arm_slot = [&] {
+        timespec next{ (time_t)slot.tv_sec, (long)slot.tv_nsec };
+        next_slot(next, interval_ns);
+        slot.tv_sec = next.tv_sec;
+        slot.tv_nsec = next.tv_nsec;
+        uring_prep_timeout(uring_get_sqe(ring), &slot, IORING_TIMEOUT_ABS, 0);
+    };
+    arm_slot();
+
+    // user_data 0 is the frame slot, i + 1 viewer i's send
+    int sent = 0;
+    bool sending = true;
+    while (sending || sent < frames) {
+        if (uring_submit(ring, 1) < 0 && errno != EINTR) { perror("io_uring_enter"); break; }
+        for (unsigned n = 0;; ++n) {
+            io_uring_cqe* cqe = uring_peek(ring, n);
+            if (!cqe) {
+                uring_advance(ring, n);
+                break;
+            }
+            if (cqe->user_data == 0) {
+                if (sent == frames) continue;
+                for (int i = 0; i < count; ++i) {
+                    if (sends[i].busy) {
+                        result.skipped++;
+                        continue;
+                    }
+                    sends[i].offset = 0;
+                    queue_send(ring, viewers[i], sends[i], header, frame, i);
+                }
+                if (++sent < frames) arm_slot();
+                continue;
+            }
+            int i = cqe->user_data - 1;
+            if (cqe->res <= 0) {
+                fprintf(stderr, "send: %s\n", strerror(-cqe->res));
+                sends[i].busy = false;
+                continue;
+            }
+            sends[i].offset += cqe->res;
+            sends[i].busy = false;
+            if (sends[i].offset < 4 + frame.size()) queue_send(ring, viewers[i], sends[i], header, frame, i);
+        }
+        sending = false;
+        for (const auto& s : sends) sending |= s.busy;
+    }
+    result.wall = wall_seconds() - result.wall;
+    result.syscalls = ring.stats.enters;
+    close_viewers(viewers, result);
+    uring_destroy(ring);
+    return result;
+}
+
+static void print_row(const char* name, const RunResult& r, int frames, size_t frame_size, int viewers) {
+    printf("%-9s %6.2f syscalls/frame %8.1f us CPU/frame %8.1f MB/s", name, (double)r.syscalls / frames,
+           r.cpu * 1e6 / frames, frame_size * (double)frames * viewers / r.wall / 1e6);
+    if (r.skipped) printf("  (%lu viewer frames skipped)", (unsigned long)r.skipped);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    int viewers = argc > 1 ? atoi(argv[1]) : 4;
+    size_t frame_kb = argc > 2 ? atoi(argv[2]) : 64;
+    int frames = argc > 3 ? atoi(argv[3]) : 1000;
+    double fps = argc > 4 ? atof(argv[4]) : 500;
+    long interval_ns = fps > 0 ? (long)(1e9 / fps) : 0;
+
+    std::vector<unsigned char> frame(frame_kb * 1024, 0x5a);
+    printf("%d viewers, %zu KB frames, %d frames at %.0f fps over loopback\n", viewers, frame_kb, frames, fps);
+    print_row("blocking", run_blocking(viewers, frame, frames, interval_ns), frames, frame.size(), viewers);
+    print_row("io_uring", run_uring(viewers, frame, frames, interval_ns), frames, frame.size(), viewers);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Helpers shared by the bench_* programs.
+
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "test_pattern.h"
+
+static inline double cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline double thread_cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline double wall_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The streamers' test pattern (test_pattern.h) as a clip of raw YUYV.
+static inline std::vector<unsigned char> make_pattern(int width, int height, int frames) {
+    size_t frame_size = (size_t)width * height * 2;
+    std::vector<unsigned char> clip(frame_size * frames);
+    for (int f = 0; f < frames; ++f) test_pattern_frame(&clip[f * frame_size], width, height, f);
+    return clip;
+}
+
+// A static camera view: a fixed textured background with a little sensor
+// noise in every frame, and a small box moving slowly across it.
+static inline std::vector<unsigned char> make_static_scene(int width, int height, int frames) {
+    std::vector<unsigned char> clip((size_t)width * height * 2 * frames);
+    unsigned char* p = clip.data();
+    unsigned seed = 1;
+    auto noise = [&seed](int amplitude) {
+        seed = seed * 1103515245 + 12345;
+        return (int)(seed >> 16) % (2 * amplitude + 1) - amplitude;
+    };
+    for (int f = 0; f < frames; ++f) {
+        int bx = 64 + f * 2 % (width - 160), by = height / 3;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; x += 2, p += 4) {
+                bool box = x >= bx && x < bx + 32 && y >= by && y < by + 32;
+                int base = 60 + (x * 120 / width) + (int)(30 * std::sin(x * 0.05) * std::cos(y * 0.07));
+                p[0] = box ? 200 : base + noise(2);
+                p[1] = 128 + (int)(40 * std::sin(y * 0.01)) + noise(1);
+                p[2] = box ? 200 : base + noise(2);
+                p[3] = 128 + (int)(40 * std::cos(x * 0.01)) + noise(1);
+            }
+        }
+    }
+    return clip;
+}
+
+// Loads a recorded YUYV clip, or generates the test pattern when path is
+// empty. Returns an empty vector if the clip holds less than one frame.
+static inline std::vector<unsigned char> load_clip(const char* path, int width, int height) {
+    if (!path || !path[0]) return make_pattern(width, height, 30);
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> clip((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (clip.size() < (size_t)width * height * 2) clip.clear();
+    return clip;
+}
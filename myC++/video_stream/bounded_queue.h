@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer/multi-consumer queue (Vyukov's array
+// queue). try_push/try_pop never block or allocate. pop_wait() and
+// push_wait() sleep on an atomic counter (futex) while the queue is empty or
+// full instead of spinning; pop_wait() returns false once the queue is
+// closed and drained, push_wait() once it is closed.
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask_ = n - 1;
+        cells_.reset(new Cell[n]);
+        for (size_t i = 0; i < n; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool try_push(const T& value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        // seq_cst pairs with a waiter registering itself in pop_wait().
+        pushes_.fetch_add(1);
+        if (pop_waiters_.load() > 0) pushes_.notify_one();
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->data;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+
+        pops_.fetch_add(1);
+        if (push_waiters_.load() > 0) pops_.notify_one();
+        return true;
+    }
+
+    bool push_wait(const T& value) {
+        for (;;) {
+            uint32_t seen = pops_.load(std::memory_order_acquire);
+            if (closed_.load(std::memory_order_acquire)) return false;
+            if (try_push(value)) return true;
+
+            push_waiters_.fetch_add(1);
+            if (!closed_.load()) pops_.wait(seen);
+            push_waiters_.fetch_sub(1);
+        }
+    }
+
+    bool pop_wait(T& value) {
+        for (;;) {
+            uint32_t seen = pushes_.load(std::memory_order_acquire);
+            if (try_pop(value)) return true;
+            if (closed_.load(std::memory_order_acquire)) return try_pop(value);
+
+            pop_waiters_.fetch_add(1);
+            if (!closed_.load()) pushes_.wait(seen);
+            pop_waiters_.fetch_sub(1);
+        }
+    }
+
+    // Wakes every waiter; pop_wait() returns false once the queue is empty.
+    void close() {
+        closed_.store(true);
+        pushes_.fetch_add(1);
+        pushes_.notify_all();
+        pops_.fetch_add(1);
+        pops_.notify_all();
+    }
+
+    // Approximate when other threads are pushing or popping.
+    size_t size() const {
+        size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+    alignas(64) std::atomic<uint32_t> pushes_{0};
+    std::atomic<uint32_t> pop_waiters_{0};
+    alignas(64) std::atomic<uint32_t> pops_{0};
+    std::atomic<uint32_t> push_waiters_{0};
+    std::atomic<bool> closed_{false};
+};
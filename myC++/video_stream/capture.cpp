@@ -0,0 +1,491 @@
+#include "capture.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include "mjpeg.h"
+#include "test_pattern.h"
+
+static const size_t PATTERN_FRAMES = 30;
+
+// Splits a concatenated MJPEG clip into frames at each EOI.
+static bool index_mjpeg_clip(Capture& cap) {
+    size_t pos = 0;
+    cap.replay_offsets.assign(1, 0);
+    cap.frame_size = 0;
+    while (pos < cap.replay_size) {
+        size_t len = mjpeg_frame_end(cap.replay_data + pos, cap.replay_size - pos);
+        if (!len) break;
+        pos += len;
+        cap.replay_offsets.push_back(pos);
+        cap.frame_size = std::max(cap.frame_size, len);
+    }
+    cap.replay_frames = cap.replay_offsets.size() - 1;
+
+    if (cap.replay_frames == 0 || !mjpeg_dimensions(cap.replay_data, cap.replay_size, cap.width, cap.height)) {
+        std::cerr << "Recorded MJPEG clip holds no complete frame\n";
+        return false;
+    }
+    return true;
+}
+
+// The ring is emulated: each slot is "queued" until handed out.
+static void init_replay_ring(Capture& cap, int nbuffers) {
+    cap.buffers.assign(nbuffers, buffer{nullptr, cap.frame_size});
+    cap.replay_busy.assign(nbuffers, false);
+    cap.stats.queued = nbuffers;
+    cap.stats.min_queued = nbuffers;
+}
+
+static bool open_file(Capture& cap, int nbuffers, CaptureFormat format) {
+    struct stat st{};
+    if (fstat(cap.fd, &st) < 0) { perror("fstat"); return false; }
+    if (st.st_size == 0) { std::cerr << "Recorded clip is empty\n"; return false; }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cap.fd, 0);
+    if (data == MAP_FAILED) { perror("mmap"); return false; }
+    cap.replay_data = static_cast<unsigned char*>(data);
+    cap.replay_size = st.st_size;
+
+    cap.mjpeg = cap.replay_size >= 2 && cap.replay_data[0] == 0xFF && cap.replay_data[1] == 0xD8;
+    if ((format == CaptureFormat::Mjpeg && !cap.mjpeg) || (format == CaptureFormat::Yuyv && cap.mjpeg)) {
+        std::cerr << "Recorded clip is " << (cap.mjpeg ? "MJPEG" : "raw YUYV") << ", not the requested format\n";
+        return false;
+    }
+
+    if (cap.mjpeg) {
+        if (!index_mjpeg_clip(cap)) return false;
+    } else {
+        cap.replay_frames = cap.replay_size / cap.frame_size;
+        if (cap.replay_frames == 0) {
+            std::cerr << "Recorded clip is shorter than one " << cap.width << "x" << cap.height << " frame\n";
+            return false;
+        }
+    }
+    init_replay_ring(cap, nbuffers);
+    return true;
+}
+
+// "pattern" or "pattern:WIDTHxHEIGHT". A second of the test pattern is
+// generated up front and replayed like a clip; generating every frame
+// would cost more than encoding it.
+static bool open_pattern(Capture& cap, const char* spec, int nbuffers, CaptureFormat format) {
+    if (format == CaptureFormat::Mjpeg) {
+        std::cerr << "The test pattern is YUYV, not MJPEG\n";
+        return false;
+    }
+    if (spec[0] == ':' && (sscanf(spec + 1, "%dx%d", &cap.width, &cap.height) != 2 || cap.width < 2 ||
+                           cap.height < 1 || cap.width % 2)) {
+        std::cerr << "Test pattern size must be WIDTHxHEIGHT with an even width\n";
+        return false;
+    }
+
+    cap.frame_size = (size_t)cap.width * cap.height * 2;
+    cap.replay_frames = PATTERN_FRAMES;
+    cap.pattern.resize(cap.frame_size * cap.replay_frames);
+    for (size_t f = 0; f < cap.replay_frames; ++f) {
+        test_pattern_frame(&cap.pattern[f * cap.frame_size], cap.width, cap.height, f);
+    }
+    cap.replay_data = cap.pattern.data();
+    cap.replay_size = cap.pattern.size();
+    init_replay_ring(cap, nbuffers);
+    return true;
+}
+
+static bool device_offers(int fd, uint32_t pixelformat) {
+    v4l2_fmtdesc desc{};
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        if (desc.pixelformat == pixelformat) return true;
+    }
+    return false;
+}
+
+// MJPEG if the camera lists it and TRY_FMT keeps it at this resolution.
+static bool negotiate_mjpeg(Capture& cap) {
+    if (!device_offers(cap.fd, V4L2_PIX_FMT_MJPEG)) return false;
+
+    v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = cap.width;
+    fmt.fmt.pix.height = cap.height;
+    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (ioctl(cap.fd, VIDIOC_TRY_FMT, &fmt) < 0) { perror("VIDIOC_TRY_FMT"); return false; }
+    return fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG;
+}
+
+static bool setup_mmap(Capture& cap, int nbuffers) {
+    v4l2_requestbuffers req{};
+    req.count = nbuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(cap.fd, VIDIOC_REQBUFS, &req) < 0) { perror("Requesting Buffer"); return false; }
+    if (req.count < 2) {
+        std::cerr << "Driver granted only " << req.count << " buffer(s), need at least 2\n";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < req.count; ++i) {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (ioctl(cap.fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("Querying Buffer"); return false; }
+
+        buffer b;
+        b.length = buf.length;
+        b.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, cap.fd, buf.m.offset);
+        if (b.start == MAP_FAILED) { perror("mmap"); return false; }
+        cap.buffers.push_back(b);
+
+        if (ioctl(cap.fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); return false; }
+    }
+
+    cap.memory = CaptureMemory::Mmap;
+    cap.stats.queued = req.count;
+    cap.stats.min_queued = req.count;
+    return true;
+}
+
+static bool queue_userptr(Capture& cap, uint32_t index, unsigned char* data) {
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.index = index;
+    buf.m.userptr = reinterpret_cast<unsigned long>(data);
+    buf.length = cap.pool.buffer_size;
+    if (ioctl(cap.fd, VIDIOC_QBUF, &buf) < 0) return false;
+    cap.buffers[index] = buffer{data, cap.pool.buffer_size};
+    return true;
+}
+
+// Queues a fresh pool buffer into every slot left empty by a failed refill.
+static void refill_userptr(Capture& cap) {
+    while (!cap.unfilled.empty()) {
+        unsigned char* spare = frame_pool_acquire(cap.pool);
+        if (!spare || !queue_userptr(cap, cap.unfilled.back(), spare)) {
+            perror("VIDIOC_QBUF (USERPTR)");
+            frame_pool_release(cap.pool, spare);
+            return;
+        }
+        cap.unfilled.pop_back();
+        cap.stats.queued++;
+    }
+}
+
+// Frees the driver's USERPTR slots (dequeuing anything still queued) and
+// the pool behind them.
+static void release_userptr(Capture& cap) {
+    v4l2_requestbuffers req{};
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ioctl(cap.fd, VIDIOC_REQBUFS, &req);
+    frame_pool_destroy(cap.pool);
+    cap.buffers.clear();
+    cap.unfilled.clear();
+}
+
+// Queues buffers from our own pool. Returns false, with nothing left
+// allocated, when the driver refuses them.
+static bool setup_userptr(Capture& cap, int nbuffers, size_t size) {
+    v4l2_requestbuffers req{};
+    req.count = nbuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+    if (ioctl(cap.fd, VIDIOC_REQBUFS, &req) < 0) return false;  // EINVAL: no USERPTR support
+    if (req.count < 2) {
+        release_userptr(cap);
+        return false;
+    }
+
+    // One set queued and one for the frames the caller holds; more are
+    // mapped (and counted) if the caller holds even more.
+    if (!frame_pool_init(cap.pool, size, req.count * 2, false)) {
+        release_userptr(cap);
+        return false;
+    }
+    cap.buffers.assign(req.count, buffer{nullptr, 0});
+    for (uint32_t i = 0; i < req.count; ++i) {
+        unsigned char* data = frame_pool_acquire(cap.pool);
+        if (!data || !queue_userptr(cap, i, data)) {
+            // Some drivers only find out at QBUF that they cannot use the memory.
+            perror("VIDIOC_QBUF (USERPTR)");
+            release_userptr(cap);
+            return false;
+        }
+    }
+
+    cap.memory = CaptureMemory::UserPtr;
+    cap.stats.queued = req.count;
+    cap.stats.min_queued = req.count;
+    return true;
+}
+
+static bool open_device(Capture& cap, int nbuffers, CaptureFormat format, CaptureMemory memory) {
+    cap.mjpeg = format != CaptureFormat::Yuyv && negotiate_mjpeg(cap);
+    if (format == CaptureFormat::Mjpeg && !cap.mjpeg) {
+        std::cerr << "Camera does not offer MJPEG at " << cap.width << "x" << cap.height << "\n";
+        return false;
+    }
+
+    v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = cap.width;
+    fmt.fmt.pix.height = cap.height;
+    fmt.fmt.pix.pixelformat = cap.mjpeg ? V4L2_PIX_FMT_MJPEG : V4L2_PIX_FMT_YUYV;  // raw YUV fallback
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+
+    if (ioctl(cap.fd, VIDIOC_S_FMT, &fmt) < 0) { perror("Setting Pixel Format"); return false; }
+
+    // The driver may round the resolution to something it supports.
+    cap.width = fmt.fmt.pix.width;
+    cap.height = fmt.fmt.pix.height;
+    cap.frame_size = cap.mjpeg ? fmt.fmt.pix.sizeimage : cap.width * cap.height * 2;
+
+    bool ready = false;
+    if (memory != CaptureMemory::Mmap) {
+        ready = setup_userptr(cap, nbuffers, std::max<size_t>(fmt.fmt.pix.sizeimage, cap.frame_size));
+        if (!ready && memory == CaptureMemory::UserPtr) {
+            std::cerr << "Driver refuses USERPTR buffers\n";
+            return false;
+        }
+        if (!ready) std::cerr << "Driver refuses USERPTR buffers; using MMAP\n";
+    }
+    if (!ready && !setup_mmap(cap, nbuffers)) return false;
+
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(cap.fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("Start Capture");
+        if (memory != CaptureMemory::Auto || cap.memory != CaptureMemory::UserPtr) return false;
+        // Some drivers accept user memory up to here; try again with their own.
+        release_userptr(cap);
+        std::cerr << "Retrying with MMAP buffers\n";
+        if (!setup_mmap(cap, nbuffers)) return false;
+        if (ioctl(cap.fd, VIDIOC_STREAMON, &type) < 0) { perror("Start Capture"); return false; }
+    }
+    return true;
+}
+
+static const char* source_name(const Capture& cap) {
+    switch (cap.source) {
+    case CaptureSource::File: return "clip";
+    case CaptureSource::Pattern: return "test pattern";
+    default: return capture_memory_name(cap.memory);
+    }
+}
+
+bool capture_open(Capture& cap, const char* path, int width, int height, int nbuffers, CaptureFormat format,
+                  CaptureMemory memory) {
+    cap.width = width;
+    cap.height = height;
+    cap.frame_size = width * height * 2;
+    if (nbuffers < 2) nbuffers = 2;
+
+    bool ok;
+    if (strncmp(path, "pattern", 7) == 0 && (path[7] == '\0' || path[7] == ':')) {
+        cap.source = CaptureSource::Pattern;
+        ok = open_pattern(cap, path + 7, nbuffers, format);
+    } else {
+        cap.fd = open(path, O_RDWR);
+        if (cap.fd < 0) cap.fd = open(path, O_RDONLY);
+        if (cap.fd < 0) { perror("Cannot open device"); return false; }
+
+        struct stat st{};
+        if (fstat(cap.fd, &st) < 0) { perror("fstat"); return false; }
+        cap.source = S_ISREG(st.st_mode) ? CaptureSource::File : CaptureSource::Device;
+        ok = cap.source == CaptureSource::File ? open_file(cap, nbuffers, format)
+                                               : open_device(cap, nbuffers, format, memory);
+    }
+    if (!ok) return false;
+
+    std::cout << "Capture format: " << (cap.mjpeg ? "MJPEG (passthrough)" : "YUYV") << " "
+              << cap.width << "x" << cap.height << ", " << source_name(cap)
+              << (cap.source == CaptureSource::Device ? " buffers" : "") << "\n";
+    return true;
+}
+
+static void account_sequence(Capture& cap, uint32_t sequence) {
+    if (cap.have_sequence && sequence - cap.last_sequence > 1) {
+        cap.stats.dropped += sequence - cap.last_sequence - 1;
+    }
+    cap.have_sequence = true;
+    cap.last_sequence = sequence;
+}
+
+bool capture_dequeue(Capture& cap, CaptureFrame& frame) {
+    if (capture_is_replay(cap)) {
+        int slot = -1;
+        for (size_t i = 0; i < cap.replay_busy.size(); ++i) {
+            if (!cap.replay_busy[i]) { slot = i; break; }
+        }
+        if (slot < 0) {
+            std::cerr << "capture_dequeue: every buffer is still held by the caller\n";
+            return false;
+        }
+        cap.replay_busy[slot] = true;
+
+        size_t n = cap.replay_next % cap.replay_frames;
+        if (cap.mjpeg) {
+            frame.data = cap.replay_data + cap.replay_offsets[n];
+            frame.bytesused = cap.replay_offsets[n + 1] - cap.replay_offsets[n];
+        } else {
+            frame.data = cap.replay_data + n * cap.frame_size;
+            frame.bytesused = cap.frame_size;
+        }
+        frame.index = slot;
+        frame.sequence = cap.replay_next++;
+
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        frame.timestamp.tv_sec = ts.tv_sec;
+        frame.timestamp.tv_usec = ts.tv_nsec / 1000;
+    } else {
+        if (cap.memory == CaptureMemory::UserPtr) {
+            refill_userptr(cap);
+            if (cap.stats.queued == 0) {
+                std::cerr << "capture_dequeue: no USERPTR buffer left in the driver's queue\n";
+                return false;
+            }
+        }
+        v4l2_buffer buf;
+        while (true) {
+            buf = v4l2_buffer{};
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = cap.memory == CaptureMemory::UserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+
+            int r;
+            do {
+                r = ioctl(cap.fd, VIDIOC_DQBUF, &buf);
+            } while (r < 0 && errno == EINTR);
+            if (r < 0) { perror("VIDIOC_DQBUF"); return false; }
+            if (!(buf.flags & V4L2_BUF_FLAG_ERROR) && buf.bytesused > 0) break;
+
+            // A corrupt or empty frame goes straight back to the driver.
+            account_sequence(cap, buf.sequence);
+            cap.stats.discarded++;
+            bool queued = cap.memory == CaptureMemory::UserPtr
+                              ? queue_userptr(cap, buf.index, reinterpret_cast<unsigned char*>(buf.m.userptr))
+                              : ioctl(cap.fd, VIDIOC_QBUF, &buf) == 0;
+            if (!queued) { perror("VIDIOC_QBUF"); return false; }
+        }
+
+        if (cap.memory == CaptureMemory::UserPtr) {
+            frame.data = reinterpret_cast<const unsigned char*>(buf.m.userptr);
+            // Refill the slot at once; the filled buffer now belongs to the caller.
+            cap.unfilled.push_back(buf.index);
+            refill_userptr(cap);
+        } else {
+            frame.data = static_cast<const unsigned char*>(cap.buffers[buf.index].start);
+        }
+        frame.bytesused = buf.bytesused;
+        frame.index = buf.index;
+        frame.sequence = buf.sequence;
+        frame.timestamp = buf.timestamp;
+
+        // Drivers that stamp with another clock get the dequeue time instead.
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            frame.timestamp.tv_sec = ts.tv_sec;
+            frame.timestamp.tv_usec = ts.tv_nsec / 1000;
+        }
+    }
+
+    account_sequence(cap, frame.sequence);
+    cap.stats.frames++;
+    cap.stats.queued--;
+    if (cap.stats.queued < cap.stats.min_queued) cap.stats.min_queued = cap.stats.queued;
+    return true;
+}
+
+bool capture_requeue(Capture& cap, const CaptureFrame& frame) {
+    if (capture_is_replay(cap)) {
+        cap.replay_busy[frame.index] = false;
+    } else if (cap.memory == CaptureMemory::UserPtr) {
+        // The slot was refilled at dequeue.
+        frame_pool_release(cap.pool, const_cast<unsigned char*>(frame.data));
+        return true;
+    } else {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = frame.index;
+        if (ioctl(cap.fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); return false; }
+    }
+    cap.stats.queued++;
+    return true;
+}
+
+void capture_close(Capture& cap) {
+    if (cap.source == CaptureSource::File) {
+        if (cap.replay_data) munmap(cap.replay_data, cap.replay_size);
+        cap.replay_data = nullptr;
+    } else if (cap.source == CaptureSource::Pattern) {
+        cap.pattern.clear();
+        cap.replay_data = nullptr;
+    } else if (cap.fd >= 0) {
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ioctl(cap.fd, VIDIOC_STREAMOFF, &type);
+        if (cap.memory == CaptureMemory::UserPtr) release_userptr(cap);
+        else for (auto& b : cap.buffers) munmap(b.start, b.length);
+    }
+    cap.buffers.clear();
+    if (cap.fd >= 0) close(cap.fd);
+    cap.fd = -1;
+}
+
+uint64_t capture_timestamp_ns(const CaptureFrame& frame) {
+    return frame.timestamp.tv_sec * 1000000000ULL + frame.timestamp.tv_usec * 1000ULL;
+}
+
+void capture_report(Capture& cap) {
+    std::cout << "capture: frames=" << cap.stats.frames
+              << " dropped=" << cap.stats.dropped
+              << " queued=" << cap.stats.queued << "/" << cap.buffers.size()
+              << " min_queued=" << cap.stats.min_queued;
+    if (cap.stats.discarded) std::cout << " discarded=" << cap.stats.discarded;
+    if (capture_owns_frames(cap)) {
+        std::lock_guard<std::mutex> guard(cap.pool.lock);
+        std::cout << " held=" << cap.pool.stats.in_use - cap.stats.queued
+                  << " pool_buffers=" << cap.pool.mapped.size();
+    }
+    std::cout << "\n";
+    cap.stats.min_queued = cap.stats.queued;
+}
+
+bool parse_capture_format(const char* name, CaptureFormat& format) {
+    if (strcmp(name, "auto") == 0) format = CaptureFormat::Auto;
+    else if (strcmp(name, "yuyv") == 0) format = CaptureFormat::Yuyv;
+    else if (strcmp(name, "mjpeg") == 0) format = CaptureFormat::Mjpeg;
+    else return false;
+    return true;
+}
+
+bool parse_capture_memory(const char* name, CaptureMemory& memory) {
+    if (strcmp(name, "auto") == 0) memory = CaptureMemory::Auto;
+    else if (strcmp(name, "mmap") == 0) memory = CaptureMemory::Mmap;
+    else if (strcmp(name, "userptr") == 0) memory = CaptureMemory::UserPtr;
+    else return false;
+    return true;
+}
+
+const char* capture_memory_name(CaptureMemory memory) {
+    switch (memory) {
+    case CaptureMemory::Mmap: return "MMAP";
+    case CaptureMemory::UserPtr: return "USERPTR";
+    default: return "auto";
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/time.h>
+
+#include "frame_pool.h"
+
+// Capture ring shared by v4l2_tcp_stream and v4l2_udp_stream.
+//
+// All N buffers stay queued with the driver except the ones the caller is
+// currently processing, so the camera keeps filling the next buffer while
+// the previous frame is converted, encoded and sent.
+//
+// Cameras that offer MJPEG are opened in that format unless YUYV is forced;
+// the frames are then already JPEGs (cap.mjpeg) and need no encoding.
+//
+// Frames come from one of three sources:
+//
+//   - a V4L2 device
+//   - a regular file: a recorded clip, mapped and replayed in a loop with the
+//     same ring semantics, either raw YUYV (width*height*2 bytes per frame)
+//     or, if it starts with a JPEG SOI, concatenated MJPEG frames
+//   - "pattern" or "pattern:WIDTHxHEIGHT": the generated test pattern
+//     (test_pattern.h), replayed the same way, for benchmarks and tests on
+//     machines without a camera
+//
+// Replayed sources deliver frames as fast as they are asked for; the
+// caller paces them (pacer.h).
+//
+// Device buffers are either mapped from the driver (V4L2_MEMORY_MMAP) or
+// come from a FramePool of our own (V4L2_MEMORY_USERPTR). With USERPTR a
+// dequeued buffer is replaced in the driver's queue by a spare from the
+// pool at once, so frames held by later stages never leave the camera
+// short of buffers, and capture_requeue() only returns the buffer to the
+// pool. Drivers that refuse USERPTR buffers get the MMAP ring instead.
+
+struct buffer {
+    void* start;
+    size_t length;
+};
+
+// A dequeued frame. Hand it back with capture_requeue() when done with it.
+struct CaptureFrame {
+    const unsigned char* data;
+    size_t bytesused;
+    uint32_t index;
+    uint32_t sequence;
+    timeval timestamp;  // CLOCK_MONOTONIC, from the driver when it provides one
+};
+
+enum class CaptureMemory {
+    Auto,     // USERPTR if the driver accepts it, else MMAP
+    Mmap,
+    UserPtr,
+};
+
+enum class CaptureFormat {
+    Auto,   // MJPEG if the camera offers it, else YUYV
+    Yuyv,   // always capture YUYV and encode in software
+    Mjpeg,  // fail unless the camera offers MJPEG
+};
+
+struct CaptureStats {
+    uint64_t frames;      // frames dequeued
+    uint64_t dropped;     // frames the driver skipped (gaps in buf.sequence)
+    uint64_t discarded;   // buffers flagged V4L2_BUF_FLAG_ERROR or empty, requeued unseen
+    uint32_t queued;      // buffers currently owned by the driver
+    uint32_t min_queued;  // low-water mark of queued since the last report
+};
+
+enum class CaptureSource {
+    Device,
+    File,
+    Pattern,
+};
+
+struct Capture {
+    int fd = -1;
+    CaptureSource source = CaptureSource::Device;
+    int width = 0;
+    int height = 0;
+    bool mjpeg = false;
+    size_t frame_size = 0;  // bytes per YUYV frame, or the largest MJPEG frame
+    std::vector<buffer> buffers;  // USERPTR: the pool buffer queued in each slot
+    CaptureMemory memory = CaptureMemory::Mmap;
+    FramePool pool;               // USERPTR buffers, queued or held by the caller
+    std::vector<uint32_t> unfilled;  // USERPTR slots whose refill failed, retried at each dequeue
+
+    // Replay: the whole clip is mapped (or the pattern generated) and served
+    // frame by frame.
+    unsigned char* replay_data = nullptr;
+    size_t replay_size = 0;
+    size_t replay_frames = 0;
+    size_t replay_next = 0;
+    std::vector<size_t> replay_offsets;  // MJPEG clip: frame i spans [i], [i + 1]
+    std::vector<bool> replay_busy;
+    std::vector<unsigned char> pattern;
+
+    bool have_sequence = false;
+    uint32_t last_sequence = 0;
+    CaptureStats stats{};
+};
+
+bool capture_open(Capture& cap, const char* path, int width, int height, int nbuffers,
+                  CaptureFormat format = CaptureFormat::Auto, CaptureMemory memory = CaptureMemory::Auto);
+// Device buffers the driver flags as corrupt (V4L2_BUF_FLAG_ERROR) or that
+// hold no data are requeued at once and the next frame is waited for.
+// USERPTR slots that could not be refilled are retried first; fails if none
+// is left in the driver's queue, where VIDIOC_DQBUF would wait forever.
+bool capture_dequeue(Capture& cap, CaptureFrame& frame);
+
+// With USERPTR buffers this may be called from any thread; otherwise only
+// from the one calling capture_dequeue().
+bool capture_requeue(Capture& cap, const CaptureFrame& frame);
+
+// Whether frames come from memory rather than a camera that paces itself.
+inline bool capture_is_replay(const Capture& cap) { return cap.source != CaptureSource::Device; }
+
+// Whether frames live in pool memory rather than a driver buffer.
+inline bool capture_owns_frames(const Capture& cap) {
+    return cap.source == CaptureSource::Device && cap.memory == CaptureMemory::UserPtr;
+}
+
+void capture_close(Capture& cap);
+
+uint64_t capture_timestamp_ns(const CaptureFrame& frame);
+
+// Prints the counters and resets the queue low-water mark.
+void capture_report(Capture& cap);
+
+// Accepts "auto", "yuyv" or "mjpeg".
+bool parse_capture_format(const char* name, CaptureFormat& format);
+
+// Accepts "auto", "mmap" or "userptr".
+bool parse_capture_memory(const char* name, CaptureMemory& memory);
+const char* capture_memory_name(CaptureMemory memory);
@@ -0,0 +1,73 @@
+#include "frame_gate.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void frame_gate_init(FrameGate& gate, int width, int height, int threshold) {
+    gate.width = width;
+    gate.height = height;
+    gate.blocks_x = (width + GATE_BLOCK - 1) / GATE_BLOCK;
+    gate.blocks_y = (height + GATE_BLOCK - 1) / GATE_BLOCK;
+    gate.threshold = threshold;
+    gate.sent.assign((size_t)gate.blocks_x * gate.blocks_y, 0);
+    gate.current.assign(gate.sent.size(), 0);
+    gate.have_sent = false;
+}
+
+// Adds the luma of one pixel row to the sums of its whole blocks.
+#ifdef __SSE2__
+
+// A block row is 16 bytes of YUYV. Masking out chroma and summing against
+// zero with psadbw leaves the 8 luma samples summed in two 64-bit lanes.
+static void add_block_rows(const uint8_t* row, int blocks, uint16_t* out) {
+    const __m128i luma = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    for (int bx = 0; bx < blocks; ++bx, row += GATE_BLOCK * 2) {
+        __m128i sum = _mm_sad_epu8(_mm_and_si128(_mm_loadu_si128((const __m128i*)row), luma), zero);
+        out[bx] += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+    }
+}
+
+#else
+
+static void add_block_rows(const uint8_t* row, int blocks, uint16_t* out) {
+    for (int bx = 0; bx < blocks; ++bx, row += GATE_BLOCK * 2) {
+        unsigned sum = 0;
+        for (int i = 0; i < GATE_BLOCK; ++i) sum += row[i * 2];
+        out[bx] += sum;
+    }
+}
+
+#endif
+
+static void signature(const FrameGate& gate, const uint8_t* yuyv, uint16_t* sig) {
+    memset(sig, 0, gate.current.size() * sizeof(uint16_t));
+    size_t stride = (size_t)gate.width * 2;
+    int whole = gate.width / GATE_BLOCK;
+    for (int y = 0; y < gate.height; ++y) {
+        const uint8_t* row = yuyv + y * stride;
+        uint16_t* out = sig + (size_t)(y / GATE_BLOCK) * gate.blocks_x;
+        add_block_rows(row, whole, out);
+        for (int x = whole * GATE_BLOCK; x < gate.width; ++x) out[whole] += row[x * 2];
+    }
+}
+
+bool frame_gate_changed(FrameGate& gate, const uint8_t* yuyv) {
+    signature(gate, yuyv, gate.current.data());
+    if (!gate.have_sent) return true;
+
+    int limit = gate.threshold * GATE_BLOCK * GATE_BLOCK;
+    for (size_t i = 0; i < gate.current.size(); ++i) {
+        if (abs(gate.current[i] - gate.sent[i]) > limit) return true;
+    }
+    return false;
+}
+
+void frame_gate_commit(FrameGate& gate) {
+    gate.sent.swap(gate.current);
+    gate.have_sent = true;
+}
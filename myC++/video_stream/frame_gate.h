@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Skips frames that look the same as the last one sent.
+//
+// The gate reduces a YUYV frame's luma to the sum over each 8x8 block (an
+// 80x60 signature at 640x480; blocks at the right and bottom edge may be
+// partial). Averaging 64 pixels removes most sensor noise, while anything
+// that moves or a light switched on shifts some blocks by many levels. A
+// frame counts as changed when any block's mean luma differs from the last
+// frame let through by more than the threshold. Comparing with the last
+// frame sent, not the previous one, means a slow fade is noticed once it
+// adds up.
+//
+// Reading the luma bytes costs a few percent of an encode, so a static scene
+// saves almost all of the conversion and encoding work.
+
+static const int GATE_BLOCK = 8;
+
+struct FrameGate {
+    int width = 0;
+    int height = 0;
+    int blocks_x = 0;
+    int blocks_y = 0;
+    int threshold = 0;              // mean luma change of a block, in levels
+    std::vector<uint16_t> sent;     // signature of the last frame let through
+    std::vector<uint16_t> current;  // signature of the last frame checked
+    bool have_sent = false;
+};
+
+void frame_gate_init(FrameGate& gate, int width, int height, int threshold);
+
+// Computes the frame's signature and returns whether it differs from the
+// last frame committed (always true before the first commit).
+bool frame_gate_changed(FrameGate& gate, const uint8_t* yuyv);
+
+// Records that the frame last passed to frame_gate_changed() was sent.
+void frame_gate_commit(FrameGate& gate);
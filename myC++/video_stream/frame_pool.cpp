@@ -0,0 +1,86 @@
+#include "frame_pool.h"
+
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static unsigned char* map_buffer(FramePool& pool) {
+    void* p = MAP_FAILED;
+    bool huge_tlb = false;
+
+    if (pool.huge_pages) {
+        p = mmap(NULL, pool.map_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        huge_tlb = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, pool.map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) { perror("mmap"); return nullptr; }
+        if (pool.huge_pages) madvise(p, pool.map_size, MADV_HUGEPAGE);
+        // Pre-fault every page now instead of in the frame loop.
+        memset(p, 0, pool.map_size);
+    }
+
+    unsigned char* buf = static_cast<unsigned char*>(p);
+    pool.mapped.push_back({buf, huge_tlb});
+    pool.stats.allocations++;
+    if (huge_tlb) pool.stats.huge_tlb++;
+    return buf;
+}
+
+bool frame_pool_init(FramePool& pool, size_t buffer_size, int count, bool huge_pages) {
+    pool.buffer_size = buffer_size;
+    pool.huge_pages = huge_pages;
+    size_t page = huge_pages ? HUGE_PAGE_SIZE : 4096;
+    pool.map_size = (buffer_size + page - 1) / page * page;
+
+    for (int i = 0; i < count; ++i) {
+        unsigned char* buf = map_buffer(pool);
+        if (!buf) return false;
+        pool.free_list.push_back(buf);
+    }
+    return true;
+}
+
+unsigned char* frame_pool_acquire(FramePool& pool) {
+    std::lock_guard<std::mutex> guard(pool.lock);
+    unsigned char* buf;
+    if (pool.free_list.empty()) {
+        buf = map_buffer(pool);
+        if (!buf) return nullptr;
+    } else {
+        buf = pool.free_list.back();
+        pool.free_list.pop_back();
+    }
+    pool.stats.acquires++;
+    pool.stats.in_use++;
+    return buf;
+}
+
+void frame_pool_release(FramePool& pool, unsigned char* buf) {
+    if (!buf) return;
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.free_list.push_back(buf);
+    pool.stats.in_use--;
+}
+
+void frame_pool_destroy(FramePool& pool) {
+    for (auto& m : pool.mapped) munmap(m.first, pool.map_size);
+    pool.mapped.clear();
+    pool.free_list.clear();
+}
+
+void frame_pool_report(FramePool& pool) {
+    std::lock_guard<std::mutex> guard(pool.lock);
+    std::cout << "pool: buffers=" << pool.mapped.size()
+              << " size=" << pool.buffer_size
+              << " in_use=" << pool.stats.in_use
+              << " huge_tlb=" << pool.stats.huge_tlb
+              << " allocations=" << pool.stats.allocations
+              << " (+" << pool.stats.allocations - pool.reported_allocations << " since last report)\n";
+    pool.reported_allocations = pool.stats.allocations;
+}
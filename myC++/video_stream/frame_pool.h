@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Fixed-size buffers reused frame after frame for the RGB conversion target
+// and the JPEG output, so the streamers make no heap allocations once they
+// reach steady state.
+//
+// Buffers are mmap'd and touched up front so the page faults happen at
+// startup, not in the frame loop. With huge_pages they come from
+// MAP_HUGETLB when the system has reserved huge pages, otherwise from
+// transparent huge pages via madvise().
+//
+// If the pool runs dry, acquire() maps another buffer rather than failing
+// and counts it in stats.allocations; a steady allocation count is the
+// proof that the frame loop is allocation free.
+
+struct FramePoolStats {
+    uint64_t allocations;  // buffers mapped, including the initial ones
+    uint64_t acquires;
+    uint32_t in_use;
+    uint32_t huge_tlb;     // buffers backed by MAP_HUGETLB
+};
+
+struct FramePool {
+    size_t buffer_size = 0;
+    size_t map_size = 0;
+    bool huge_pages = false;
+    std::vector<unsigned char*> free_list;
+    std::vector<std::pair<unsigned char*, bool>> mapped;  // buffer, from MAP_HUGETLB
+    FramePoolStats stats{};
+    uint64_t reported_allocations = 0;
+    std::mutex lock;
+};
+
+bool frame_pool_init(FramePool& pool, size_t buffer_size, int count, bool huge_pages);
+unsigned char* frame_pool_acquire(FramePool& pool);
+void frame_pool_release(FramePool& pool, unsigned char* buf);
+void frame_pool_destroy(FramePool& pool);
+
+// Prints the counters, including allocations since the previous report.
+void frame_pool_report(FramePool& pool);
@@ -0,0 +1,94 @@
+#include "h264_decoder.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef HAVE_OPENH264
+#include <wels/codec_api.h>
+#endif
+
+// Length of the start code at data[pos], 0 if there is none.
+static size_t start_code(const unsigned char* data, size_t size, size_t pos) {
+    if (pos + 3 <= size && data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) return 3;
+    if (pos + 4 <= size && data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 0 && data[pos + 3] == 1) return 4;
+    return 0;
+}
+
+bool h264_is_access_unit(const unsigned char* data, size_t size) {
+    return start_code(data, size, 0) != 0;
+}
+
+bool h264_is_idr(const unsigned char* data, size_t size) {
+    for (size_t pos = 0; pos + 3 < size; ++pos) {
+        size_t n = start_code(data, size, pos);
+        if (n && pos + n < size && (data[pos + n] & 0x1F) == 5) return true;
+        pos += n ? n - 1 : 0;
+    }
+    return false;
+}
+
+#ifdef HAVE_OPENH264
+
+bool h264_decoder_init(H264Decoder& dec) {
+    ISVCDecoder* svc = nullptr;
+    if (WelsCreateDecoder(&svc) != 0 || !svc) {
+        std::cerr << "openh264: cannot create a decoder\n";
+        return false;
+    }
+    SDecodingParam param;
+    memset(&param, 0, sizeof(param));
+    param.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+    // A damaged frame is reported rather than concealed, so the viewer can
+    // wait for (and ask for) the next IDR frame.
+    param.eEcActiveIdc = ERROR_CON_DISABLE;
+    if (svc->Initialize(&param) != cmResultSuccess) {
+        std::cerr << "openh264: cannot initialize the decoder\n";
+        WelsDestroyDecoder(svc);
+        return false;
+    }
+    dec.svc = svc;
+    return true;
+}
+
+bool h264_decode(H264Decoder& dec, const unsigned char* data, size_t size, H264Picture& picture,
+                 bool& have_picture) {
+    ISVCDecoder* svc = static_cast<ISVCDecoder*>(dec.svc);
+    have_picture = false;
+    unsigned char* planes[3] = {};
+    SBufferInfo info;
+    memset(&info, 0, sizeof(info));
+    if (svc->DecodeFrameNoDelay(data, (int)size, planes, &info) != dsErrorFree) return false;
+    if (info.iBufferStatus != 1) return true;
+
+    const SSysMEMBuffer& buffer = info.UsrData.sSystemBuffer;
+    picture.width = buffer.iWidth;
+    picture.height = buffer.iHeight;
+    for (int i = 0; i < 3; ++i) picture.planes[i] = planes[i];
+    picture.strides[0] = buffer.iStride[0];
+    picture.strides[1] = picture.strides[2] = buffer.iStride[1];
+    have_picture = true;
+    return true;
+}
+
+void h264_decoder_destroy(H264Decoder& dec) {
+    ISVCDecoder* svc = static_cast<ISVCDecoder*>(dec.svc);
+    if (!svc) return;
+    svc->Uninitialize();
+    WelsDestroyDecoder(svc);
+    dec.svc = nullptr;
+}
+
+#else
+bool h264_decoder_init(H264Decoder&) {
+    std::cerr << "Built without openh264; rebuild with make OPENH264=1 to show H.264 streams\n";
+    return false;
+}
+
+bool h264_decode(H264Decoder&, const unsigned char*, size_t, H264Picture&, bool& have_picture) {
+    have_picture = false;
+    return false;
+}
+
+void h264_decoder_destroy(H264Decoder&) {}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+// Software H.264 decoding for the SDL clients, through openh264 (`make
+// OPENH264=1`), of the access units h264_encoder.h produces. Errors are
+// reported rather than concealed, so a viewer that lost a frame waits for
+// the next IDR frame instead of showing a smeared picture.
+
+struct H264Decoder {
+    void* svc = nullptr;        // ISVCDecoder*
+};
+
+// A decoded I420 picture; the planes belong to the decoder and stay valid
+// until the next call.
+struct H264Picture {
+    int width, height;
+    const unsigned char* planes[3];
+    int strides[3];
+};
+
+bool h264_decoder_init(H264Decoder& dec);
+
+// Decodes one access unit. Returns false on a decoding error; otherwise
+// have_picture says whether picture was filled in.
+bool h264_decode(H264Decoder& dec, const unsigned char* data, size_t size, H264Picture& picture,
+                 bool& have_picture);
+
+void h264_decoder_destroy(H264Decoder& dec);
+
+// Whether data starts with an Annex B start code, i.e. is H.264 rather than
+// a JPEG or a tile delta. Needs no openh264.
+bool h264_is_access_unit(const unsigned char* data, size_t size);
+
+// Whether the access unit holds an IDR slice.
+bool h264_is_idr(const unsigned char* data, size_t size);
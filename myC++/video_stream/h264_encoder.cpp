@@ -0,0 +1,195 @@
+#include "h264_encoder.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef HAVE_OPENH264
+#include <wels/codec_api.h>
+#endif
+
+#include "perf_counters.h"
+
+bool parse_video_codec(const char* name, VideoCodec& codec) {
+    if (strcmp(name, "jpeg") == 0) codec = VideoCodec::Jpeg;
+    else if (strcmp(name, "h264") == 0) codec = VideoCodec::H264;
+    else return false;
+    return true;
+}
+
+const char* video_codec_name(VideoCodec codec) {
+    return codec == VideoCodec::H264 ? "h264" : "jpeg";
+}
+
+bool video_codec_available(VideoCodec codec) {
+#ifdef HAVE_OPENH264
+    const bool h264 = true;
+#else
+    const bool h264 = false;
+#endif
+    return codec == VideoCodec::Jpeg || h264;
+}
+
+#ifdef HAVE_OPENH264
+
+// YUYV to I420: luma as is, chroma averaged over each pair of rows (the
+// last row pairs with itself when the height is odd).
+static void yuyv_to_i420(H264Encoder& enc, const unsigned char* yuyv) {
+    int width = enc.width, height = enc.height;
+    size_t stride = (size_t)width * 2;
+    int cw = width / 2;
+    for (int row = 0; row < height; ++row) {
+        const unsigned char* src = yuyv + row * stride;
+        unsigned char* y = &enc.y_plane[(size_t)row * width];
+        for (int x = 0; x < width; ++x) y[x] = src[x * 2];
+    }
+    for (int row = 0; row < height; row += 2) {
+        const unsigned char* a = yuyv + row * stride;
+        const unsigned char* b = row + 1 < height ? a + stride : a;
+        unsigned char* u = &enc.u_plane[(size_t)(row / 2) * cw];
+        unsigned char* v = &enc.v_plane[(size_t)(row / 2) * cw];
+        for (int x = 0; x < cw; ++x) {
+            u[x] = (a[x * 4 + 1] + b[x * 4 + 1] + 1) >> 1;
+            v[x] = (a[x * 4 + 3] + b[x * 4 + 3] + 1) >> 1;
+        }
+    }
+}
+
+bool h264_encoder_init(H264Encoder& enc, int width, int height, double fps, int kbps, int gop) {
+    enc.width = width;
+    enc.height = height;
+    enc.fps = fps > 0 ? fps : 30;
+    enc.frames = 0;
+
+    ISVCEncoder* svc = nullptr;
+    if (WelsCreateSVCEncoder(&svc) != 0 || !svc) {
+        std::cerr << "openh264: cannot create an encoder\n";
+        return false;
+    }
+
+    SEncParamExt param;
+    svc->GetDefaultParams(&param);
+    param.iUsageType = CAMERA_VIDEO_REAL_TIME;
+    param.iPicWidth = width;
+    param.iPicHeight = height;
+    param.fMaxFrameRate = enc.fps;
+    param.iTargetBitrate = kbps * 1000;
+    param.iRCMode = RC_BITRATE_MODE;
+    param.bEnableFrameSkip = false;
+    param.uiIntraPeriod = gop;
+    param.eSpsPpsIdStrategy = CONSTANT_ID;
+    param.bPrefixNalAddingCtrl = false;
+    param.iEntropyCodingModeFlag = 0;  // CAVLC: Constrained Baseline
+    param.iMultipleThreadIdc = 1;      // the pipeline runs one encoder per stream
+    param.iSpatialLayerNum = 1;
+    param.iTemporalLayerNum = 1;
+    SSpatialLayerConfig& layer = param.sSpatialLayers[0];
+    layer.iVideoWidth = width;
+    layer.iVideoHeight = height;
+    layer.fFrameRate = enc.fps;
+    layer.iSpatialBitrate = param.iTargetBitrate;
+    layer.iMaxSpatialBitrate = UNSPECIFIED_BIT_RATE;
+    layer.sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
+
+    if (svc->InitializeExt(&param) != cmResultSuccess) {
+        std::cerr << "openh264: cannot encode " << width << "x" << height << " at " << kbps << " kbit/s\n";
+        WelsDestroySVCEncoder(svc);
+        return false;
+    }
+    int format = videoFormatI420;
+    svc->SetOption(ENCODER_OPTION_DATAFORMAT, &format);
+    enc.svc = svc;
+
+    enc.y_plane.resize((size_t)width * height);
+    enc.u_plane.resize((size_t)(width / 2) * ((height + 1) / 2));
+    enc.v_plane.resize(enc.u_plane.size());
+    return true;
+}
+
+void h264_encoder_set_bitrate(H264Encoder& enc, int kbps) {
+    if (!enc.svc) return;
+    SBitrateInfo bitrate;
+    bitrate.iLayer = SPATIAL_LAYER_ALL;
+    bitrate.iBitrate = kbps * 1000;
+    static_cast<ISVCEncoder*>(enc.svc)->SetOption(ENCODER_OPTION_BITRATE, &bitrate);
+}
+
+size_t h264_encode_yuyv(H264Encoder& enc, const unsigned char* yuyv, bool force_idr, unsigned char* out,
+                        size_t capacity, bool& idr, bool& skipped) {
+    ISVCEncoder* svc = static_cast<ISVCEncoder*>(enc.svc);
+    idr = false;
+    skipped = false;
+    if (!svc) return 0;
+    PerfStage outer = perf_enter(PERF_CONVERT);
+    yuyv_to_i420(enc, yuyv);
+    perf_enter(outer);
+
+    SSourcePicture picture;
+    memset(&picture, 0, sizeof(picture));
+    picture.iColorFormat = videoFormatI420;
+    picture.iPicWidth = enc.width;
+    picture.iPicHeight = enc.height;
+    picture.iStride[0] = enc.width;
+    picture.iStride[1] = picture.iStride[2] = enc.width / 2;
+    picture.pData[0] = enc.y_plane.data();
+    picture.pData[1] = enc.u_plane.data();
+    picture.pData[2] = enc.v_plane.data();
+    picture.uiTimeStamp = (long long)(enc.frames++ * 1000 / enc.fps);
+
+    if (force_idr || enc.lost) svc->ForceIntraFrame(true);
+    SFrameBSInfo info;
+    memset(&info, 0, sizeof(info));
+    if (svc->EncodeFrame(&picture, &info) != cmResultSuccess || info.eFrameType == videoFrameTypeInvalid) {
+        std::cerr << "openh264: encoding failed\n";
+        enc.lost = true;
+        return 0;
+    }
+    if (info.eFrameType == videoFrameTypeSkip) {
+        skipped = true;
+        return 0;
+    }
+
+    // The layers' NAL units, start codes included, back to back.
+    size_t size = 0;
+    for (int i = 0; i < info.iLayerNum; ++i) {
+        const SLayerBSInfo& layer = info.sLayerInfo[i];
+        size_t bytes = 0;
+        for (int n = 0; n < layer.iNalCount; ++n) bytes += layer.pNalLengthInByte[n];
+        if (size + bytes > capacity) {
+            std::cerr << "openh264: " << size + bytes << "-byte frame exceeds the buffer size\n";
+            enc.lost = true;
+            return 0;
+        }
+        memcpy(out + size, layer.pBsBuf, bytes);
+        size += bytes;
+    }
+    idr = info.eFrameType == videoFrameTypeIDR;
+    if (idr) enc.lost = false;
+    return size;
+}
+
+void h264_encoder_destroy(H264Encoder& enc) {
+    ISVCEncoder* svc = static_cast<ISVCEncoder*>(enc.svc);
+    if (!svc) return;
+    svc->Uninitialize();
+    WelsDestroySVCEncoder(svc);
+    enc.svc = nullptr;
+}
+
+#else
+
+bool h264_encoder_init(H264Encoder&, int, int, double, int, int) {
+    std::cerr << "Built without openh264; rebuild with make OPENH264=1\n";
+    return false;
+}
+
+void h264_encoder_set_bitrate(H264Encoder&, int) {}
+
+size_t h264_encode_yuyv(H264Encoder&, const unsigned char*, bool, unsigned char*, size_t, bool& idr, bool& skipped) {
+    idr = false;
+    skipped = false;
+    return 0;
+}
+
+void h264_encoder_destroy(H264Encoder&) {}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// H.264 encoding for the streamers, through Cisco's openh264 (`make
+// OPENH264=1`); h264_decoder.h is the viewers' side. Frames in a JPEG
+// stream stand alone; an H.264 P-frame only codes what changed since the
+// frame before it, so a mostly static scene costs a fraction of the bytes.
+//
+// The encoder is set up for live video: Constrained Baseline, no B-frames
+// and no lookahead, so every access unit comes out of the call that took its
+// frame. It takes YUYV, converted to I420 (chroma averaged over row pairs,
+// studio range as the camera delivers it), and holds a target bitrate with
+// frame skipping off, so every frame produces output. An IDR frame starts
+// every gop frames (0: only when forced) and carries the SPS and PPS, so a
+// viewer can start decoding at any IDR.
+//
+// Each encoded frame is one Annex B access unit (start codes, no length
+// prefixes), which the streamers send where a JPEG would go; viewers tell
+// the two apart by the first bytes (h264_is_access_unit()).
+
+enum class VideoCodec { Jpeg, H264 };
+
+// Accepts "jpeg" or "h264".
+bool parse_video_codec(const char* name, VideoCodec& codec);
+const char* video_codec_name(VideoCodec codec);
+bool video_codec_available(VideoCodec codec);
+
+struct H264Encoder {
+    int width = 0;
+    int height = 0;
+    void* svc = nullptr;        // ISVCEncoder*
+    uint64_t frames = 0;        // for timestamps
+    double fps = 30;
+    bool lost = false;          // the last frame failed; the next one must be an IDR frame
+    std::vector<unsigned char> y_plane, u_plane, v_plane;
+};
+
+// fps only guides rate control; 0 is taken as 30. Fails when built without
+// openh264.
+bool h264_encoder_init(H264Encoder& enc, int width, int height, double fps, int kbps, int gop);
+
+// Takes effect from the next frame.
+void h264_encoder_set_bitrate(H264Encoder& enc, int kbps);
+
+// Encodes one YUYV frame into out, as an IDR frame when force_idr is set.
+// Returns the size of the access unit and sets idr when the frame decodes on
+// its own. Returns 0 with skipped set when the encoder chose not to code the
+// frame (the stream carries on without it), or 0 alone when encoding failed
+// or the access unit did not fit; the next frame is then an IDR frame, as
+// the encoder's reference is a frame nobody received.
+size_t h264_encode_yuyv(H264Encoder& enc, const unsigned char* yuyv, bool force_idr, unsigned char* out,
+                        size_t capacity, bool& idr, bool& skipped);
+
+void h264_encoder_destroy(H264Encoder& enc);
@@ -0,0 +1,405 @@
+#include "jpeg_encoder.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <jerror.h>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "perf_counters.h"
+#include "yuyv_rgb.h"
+
+// Camera YUYV is BT.601 studio range (Y 16..235, C 16..240) while JFIF
+// YCbCr is full range, so rescale while deinterleaving. This matches what
+// the RGB path ends up with after libjpeg's own RGB->YCbCr conversion.
+// Fixed point: x' = (((x - offset) * 64 + 28) * k) >> 16, with k = 1192
+// (255/219) for luma and 1166 (255/224) for chroma; the +28 rounds. The
+// SSE2 path computes the same thing with pmulhw.
+static inline unsigned char clamp(int val) {
+    return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
+
+static inline unsigned char scale_luma(int y) {
+    return clamp((((y - 16) * 64 + 28) * 1192) >> 16);
+}
+
+static inline unsigned char scale_chroma(int c) {
+    return clamp(128 + ((((c - 128) * 64 + 28) * 1166) >> 16));
+}
+
+// libjpeg errors would exit() the process; instead the message is printed
+// and the encode in progress jumps back out and fails.
+static void error_exit(j_common_ptr cinfo) {
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(static_cast<JpegEncoder*>(cinfo->client_data)->jump, 1);
+}
+
+// The output buffer is sized by jpeg_encoder_bound(); running out of room
+// fails the frame.
+static void dest_init(j_compress_ptr) {}
+
+static boolean dest_empty(j_compress_ptr cinfo) {
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    return FALSE;
+}
+
+static void dest_term(j_compress_ptr) {}
+
+// JpegBackend::Turbo, further down.
+static bool turbo_init(JpegEncoder& enc, int quality, FramePool* pool);
+static void turbo_set_quality(JpegEncoder& enc, int quality);
+static size_t turbo_encode(JpegEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity);
+static void turbo_destroy(JpegEncoder& enc);
+
+bool jpeg_encoder_init(JpegEncoder& enc, int width, int height, int quality, JpegInput input,
+                       FramePool* pool, JpegBackend backend) {
+    enc.width = width;
+    enc.height = height;
+    enc.input = input;
+    enc.backend = backend;
+    enc.chroma_v = input == JpegInput::Yuv422 ? 1 : 2;
+    if (backend == JpegBackend::Turbo) return turbo_init(enc, quality, pool);
+
+    enc.cinfo.err = jpeg_std_error(&enc.jerr);
+    enc.jerr.error_exit = error_exit;
+    enc.cinfo.client_data = &enc;
+    if (setjmp(enc.jump)) {
+        jpeg_destroy_compress(&enc.cinfo);
+        return false;
+    }
+    jpeg_create_compress(&enc.cinfo);
+
+    enc.dest.init_destination = dest_init;
+    enc.dest.empty_output_buffer = dest_empty;
+    enc.dest.term_destination = dest_term;
+    enc.cinfo.dest = &enc.dest;
+
+    jpeg_compress_struct& cinfo = enc.cinfo;
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = input == JpegInput::Rgb ? JCS_RGB : JCS_YCbCr;
+
+    // Parameters survive jpeg_finish_compress(), so this is done once.
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    if (input != JpegInput::Rgb) {
+        cinfo.raw_data_in = TRUE;
+        cinfo.comp_info[0].h_samp_factor = 2;  // Y
+        cinfo.comp_info[0].v_samp_factor = enc.chroma_v;
+        cinfo.comp_info[1].h_samp_factor = 1;  // Cb
+        cinfo.comp_info[1].v_samp_factor = 1;
+        cinfo.comp_info[2].h_samp_factor = 1;  // Cr
+        cinfo.comp_info[2].v_samp_factor = 1;
+
+        // libjpeg reads whole MCUs (16 luma columns) in raw mode.
+        enc.y_stride = (width + 15) & ~15;
+        enc.c_stride = enc.y_stride / 2;
+        enc.y_plane.resize(enc.y_stride * DCTSIZE * enc.chroma_v);
+        enc.cb_plane.resize(enc.c_stride * DCTSIZE * enc.chroma_v);
+        enc.cr_plane.resize(enc.c_stride * DCTSIZE * enc.chroma_v);
+    } else {
+        enc.pool = pool;
+        if (!pool) enc.rgb.resize((size_t)width * height * 3);
+    }
+    return true;
+}
+
+void jpeg_encoder_set_quality(JpegEncoder& enc, int quality) {
+    if (enc.backend == JpegBackend::Turbo) turbo_set_quality(enc, quality);
+    else jpeg_set_quality(&enc.cinfo, quality, TRUE);
+}
+
+void jpeg_encoder_set_height(JpegEncoder& enc, int height) {
+    enc.height = height;
+    if (enc.backend == JpegBackend::Libjpeg) enc.cinfo.image_height = height;
+}
+
+size_t jpeg_encoder_bound(const JpegEncoder& enc) {
+    // Bytes per pixel of MCU-padded area: 2 for luma plus chroma overhead.
+    int mcu_h = 8 * enc.chroma_v;
+    size_t chroma = enc.chroma_v == 2 ? 1 : 2;
+    size_t padded = (size_t)((enc.width + 15) & ~15) * ((enc.height + mcu_h - 1) / mcu_h * mcu_h);
+    return padded * (2 + chroma) + 2048;
+}
+
+static void deinterleave_row(const JpegEncoder& enc, const unsigned char* src,
+                             unsigned char* y, unsigned char* cb, unsigned char* cr) {
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(28);
+    const __m128i y_offset = _mm_set1_epi16(16);
+    const __m128i c_offset = _mm_set1_epi16(128);
+    const __m128i y_scale = _mm_set1_epi16(1192);
+    const __m128i c_scale = _mm_set1_epi16(1166);
+
+    for (; x + 16 <= enc.width; x += 16, src += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)src);
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+
+        __m128i ya = _mm_sub_epi16(_mm_and_si128(a, low_bytes), y_offset);
+        __m128i yb = _mm_sub_epi16(_mm_and_si128(b, low_bytes), y_offset);
+        ya = _mm_mulhi_epi16(_mm_add_epi16(_mm_slli_epi16(ya, 6), round), y_scale);
+        yb = _mm_mulhi_epi16(_mm_add_epi16(_mm_slli_epi16(yb, 6), round), y_scale);
+        _mm_storeu_si128((__m128i*)(y + x), _mm_packus_epi16(ya, yb));
+
+        __m128i ca = _mm_sub_epi16(_mm_srli_epi16(a, 8), c_offset);  // u v u v ...
+        __m128i cc = _mm_sub_epi16(_mm_srli_epi16(b, 8), c_offset);
+        ca = _mm_add_epi16(_mm_mulhi_epi16(_mm_add_epi16(_mm_slli_epi16(ca, 6), round), c_scale), c_offset);
+        cc = _mm_add_epi16(_mm_mulhi_epi16(_mm_add_epi16(_mm_slli_epi16(cc, 6), round), c_scale), c_offset);
+        __m128i uv = _mm_packus_epi16(ca, cc);
+        _mm_storel_epi64((__m128i*)(cb + x / 2), _mm_packus_epi16(_mm_and_si128(uv, low_bytes), low_bytes));
+        _mm_storel_epi64((__m128i*)(cr + x / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), low_bytes));
+    }
+#endif
+    for (; x < enc.width; x += 2, src += 4) {
+        y[x] = scale_luma(src[0]);
+        cb[x / 2] = scale_chroma(src[1]);
+        y[x + 1] = scale_luma(src[2]);
+        cr[x / 2] = scale_chroma(src[3]);
+    }
+
+    // Replicate the right edge into the MCU padding.
+    for (int x = enc.width; x < enc.y_stride; ++x) y[x] = y[enc.width - 1];
+    for (int x = enc.width / 2; x < enc.c_stride; ++x) {
+        cb[x] = cb[enc.width / 2 - 1];
+        cr[x] = cr[enc.width / 2 - 1];
+    }
+}
+
+// 4:2:0 output: average a pair of 4:2:2 chroma rows, rounding up like pavgb.
+static void halve_chroma_rows(unsigned char* dst, const unsigned char* a, const unsigned char* b, int n) {
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 16 <= n; x += 16) {
+        __m128i avg = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(a + x)), _mm_loadu_si128((const __m128i*)(b + x)));
+        _mm_storeu_si128((__m128i*)(dst + x), avg);
+    }
+#endif
+    for (; x < n; ++x) dst[x] = (a[x] + b[x] + 1) >> 1;
+}
+
+static void write_raw(JpegEncoder& enc, const unsigned char* yuyv) {
+    jpeg_compress_struct& cinfo = enc.cinfo;
+    const int rows = DCTSIZE * enc.chroma_v;  // luma rows per jpeg_write_raw_data() call
+    JSAMPROW y_rows[DCTSIZE * 2], cb_rows[DCTSIZE], cr_rows[DCTSIZE];
+    JSAMPARRAY planes[3] = { y_rows, cb_rows, cr_rows };
+
+    for (int r = 0; r < rows; ++r) y_rows[r] = &enc.y_plane[r * enc.y_stride];
+    for (int r = 0; r < DCTSIZE; ++r) {
+        cb_rows[r] = &enc.cb_plane[r * enc.chroma_v * enc.c_stride];
+        cr_rows[r] = &enc.cr_plane[r * enc.chroma_v * enc.c_stride];
+    }
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        PerfStage outer = perf_enter(PERF_CONVERT);
+        for (int r = 0; r < rows; ++r) {
+            // Rows past the bottom edge repeat the last image row.
+            int row = cinfo.next_scanline + r;
+            if (row >= enc.height) row = enc.height - 1;
+            deinterleave_row(enc, yuyv + (size_t)row * enc.width * 2, y_rows[r],
+                             &enc.cb_plane[r * enc.c_stride], &enc.cr_plane[r * enc.c_stride]);
+        }
+        if (enc.chroma_v == 2) {
+            for (int r = 0; r < DCTSIZE; ++r) {
+                const unsigned char* cb = &enc.cb_plane[2 * r * enc.c_stride];
+                const unsigned char* cr = &enc.cr_plane[2 * r * enc.c_stride];
+                halve_chroma_rows(cb_rows[r], cb, cb + enc.c_stride, enc.c_stride);
+                halve_chroma_rows(cr_rows[r], cr, cr + enc.c_stride, enc.c_stride);
+            }
+        }
+        perf_enter(outer);
+        jpeg_write_raw_data(&cinfo, planes, rows);
+    }
+}
+
+static void write_rgb(JpegEncoder& enc, const unsigned char* yuyv, unsigned char* rgb) {
+    jpeg_compress_struct& cinfo = enc.cinfo;
+    int width = enc.width;
+
+    PerfStage outer = perf_enter(PERF_CONVERT);
+    yuyv_to_rgb24(yuyv, rgb, width * enc.height);
+    perf_enter(outer);
+
+    JSAMPROW row_pointer[1];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        row_pointer[0] = &rgb[cinfo.next_scanline * width * 3];
+        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+}
+
+#ifdef HAVE_TURBOJPEG
+
+static bool turbo_init(JpegEncoder& enc, int quality, FramePool* pool) {
+    enc.tj = tj3Init(TJINIT_COMPRESS);
+    if (!enc.tj) {
+        std::cerr << "tj3Init: " << tj3GetErrorStr(nullptr) << "\n";
+        return false;
+    }
+    // Parameters stay with the handle from frame to frame. NOREALLOC: the
+    // caller's buffer is jpeg_encoder_bound() bytes and is used as is.
+    tj3Set(enc.tj, TJPARAM_QUALITY, quality);
+    tj3Set(enc.tj, TJPARAM_SUBSAMP, enc.chroma_v == 2 ? TJSAMP_420 : TJSAMP_422);
+    tj3Set(enc.tj, TJPARAM_NOREALLOC, 1);
+
+    if (enc.input != JpegInput::Rgb) {
+        // Whole planes, no padding: TurboJPEG pads the edge MCUs itself.
+        enc.y_stride = enc.width;
+        enc.c_stride = enc.width / 2;
+        int chroma_h = (enc.height + enc.chroma_v - 1) / enc.chroma_v;
+        enc.y_plane.resize((size_t)enc.y_stride * enc.height);
+        enc.cb_plane.resize((size_t)enc.c_stride * chroma_h);
+        enc.cr_plane.resize((size_t)enc.c_stride * chroma_h);
+        if (enc.chroma_v == 2) enc.chroma_rows.resize((size_t)enc.c_stride * 4);
+    } else {
+        enc.pool = pool;
+        if (!pool) enc.rgb.resize((size_t)enc.width * enc.height * 3);
+    }
+    return true;
+}
+
+static void turbo_set_quality(JpegEncoder& enc, int quality) {
+    tj3Set(enc.tj, TJPARAM_QUALITY, quality);
+}
+
+// The Libjpeg backend's planes, for the whole frame.
+static void turbo_planes(JpegEncoder& enc, const unsigned char* yuyv) {
+    size_t src_stride = (size_t)enc.width * 2;
+    if (enc.chroma_v == 1) {
+        for (int row = 0; row < enc.height; ++row) {
+            deinterleave_row(enc, yuyv + row * src_stride, &enc.y_plane[(size_t)row * enc.y_stride],
+                             &enc.cb_plane[(size_t)row * enc.c_stride], &enc.cr_plane[(size_t)row * enc.c_stride]);
+        }
+        return;
+    }
+
+    unsigned char* cb = enc.chroma_rows.data();
+    unsigned char* cr = cb + 2 * enc.c_stride;
+    for (int row = 0; row < enc.height; row += 2) {
+        // An odd last row pairs with itself.
+        int next = row + 1 < enc.height ? row + 1 : row;
+        deinterleave_row(enc, yuyv + row * src_stride, &enc.y_plane[(size_t)row * enc.y_stride], cb, cr);
+        if (next != row) {
+            deinterleave_row(enc, yuyv + next * src_stride, &enc.y_plane[(size_t)next * enc.y_stride],
+                             cb + enc.c_stride, cr + enc.c_stride);
+        } else {
+            memcpy(cb + enc.c_stride, cb, enc.c_stride);
+            memcpy(cr + enc.c_stride, cr, enc.c_stride);
+        }
+        size_t out = (size_t)(row / 2) * enc.c_stride;
+        halve_chroma_rows(&enc.cb_plane[out], cb, cb + enc.c_stride, enc.c_stride);
+        halve_chroma_rows(&enc.cr_plane[out], cr, cr + enc.c_stride, enc.c_stride);
+    }
+}
+
+static size_t turbo_encode(JpegEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity) {
+    unsigned char* jpeg = out;
+    size_t size = capacity;
+    int result;
+
+    if (enc.input == JpegInput::Rgb) {
+        unsigned char* rgb = enc.pool ? frame_pool_acquire(*enc.pool) : enc.rgb.data();
+        PerfStage outer = perf_enter(PERF_CONVERT);
+        yuyv_to_rgb24(yuyv, rgb, enc.width * enc.height);
+        perf_enter(outer);
+        result = tj3Compress8(enc.tj, rgb, enc.width, enc.width * 3, enc.height, TJPF_RGB, &jpeg, &size);
+        if (enc.pool) frame_pool_release(*enc.pool, rgb);
+    } else {
+        PerfStage outer = perf_enter(PERF_CONVERT);
+        turbo_planes(enc, yuyv);
+        perf_enter(outer);
+        const unsigned char* planes[3] = { enc.y_plane.data(), enc.cb_plane.data(), enc.cr_plane.data() };
+        int strides[3] = { enc.y_stride, enc.c_stride, enc.c_stride };
+        result = tj3CompressFromYUVPlanes8(enc.tj, planes, enc.width, strides, enc.height, &jpeg, &size);
+    }
+
+    if (result < 0) {
+        std::cerr << "TurboJPEG: " << tj3GetErrorStr(enc.tj) << "\n";
+        return 0;
+    }
+    return size;
+}
+
+static void turbo_destroy(JpegEncoder& enc) {
+    tj3Destroy(enc.tj);
+    enc.tj = nullptr;
+}
+
+#else
+
+static bool turbo_init(JpegEncoder&, int, FramePool*) {
+    std::cerr << "Built without TurboJPEG; rebuild with make TURBOJPEG=1\n";
+    return false;
+}
+
+static void turbo_set_quality(JpegEncoder&, int) {}
+static size_t turbo_encode(JpegEncoder&, const unsigned char*, unsigned char*, size_t) { return 0; }
+static void turbo_destroy(JpegEncoder&) {}
+
+#endif
+
+size_t jpeg_encode_yuyv(JpegEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity) {
+    if (enc.backend == JpegBackend::Turbo) return turbo_encode(enc, yuyv, out, capacity);
+
+    // Taken before the jump point, so a failed encode still gives it back.
+    bool to_rgb = enc.input == JpegInput::Rgb;
+    unsigned char* const rgb = !to_rgb ? nullptr : enc.pool ? frame_pool_acquire(*enc.pool) : enc.rgb.data();
+    if (to_rgb && !rgb) return 0;
+
+    size_t size = 0;
+    enc.dest.next_output_byte = out;
+    enc.dest.free_in_buffer = capacity;
+    if (setjmp(enc.jump) == 0) {
+        jpeg_start_compress(&enc.cinfo, TRUE);
+        if (to_rgb) write_rgb(enc, yuyv, rgb);
+        else write_raw(enc, yuyv);
+        jpeg_finish_compress(&enc.cinfo);
+        size = capacity - enc.dest.free_in_buffer;
+    } else {
+        jpeg_abort_compress(&enc.cinfo);
+    }
+    if (rgb && enc.pool) frame_pool_release(*enc.pool, rgb);
+    return size;
+}
+
+void jpeg_encoder_destroy(JpegEncoder& enc) {
+    if (enc.backend == JpegBackend::Turbo) turbo_destroy(enc);
+    else jpeg_destroy_compress(&enc.cinfo);
+}
+
+bool parse_jpeg_input(const char* name, JpegInput& input) {
+    if (strcmp(name, "rgb") == 0) input = JpegInput::Rgb;
+    else if (strcmp(name, "yuv") == 0) input = JpegInput::Yuv;
+    else if (strcmp(name, "yuv422") == 0) input = JpegInput::Yuv422;
+    else return false;
+    return true;
+}
+
+bool parse_jpeg_backend(const char* name, JpegBackend& backend) {
+    if (strcmp(name, "libjpeg") == 0) backend = JpegBackend::Libjpeg;
+    else if (strcmp(name, "turbo") == 0) backend = JpegBackend::Turbo;
+    else return false;
+    return true;
+}
+
+const char* jpeg_backend_name(JpegBackend backend) {
+    return backend == JpegBackend::Turbo ? "turbo" : "libjpeg";
+}
+
+bool jpeg_backend_available(JpegBackend backend) {
+#ifdef HAVE_TURBOJPEG
+    const bool turbo = true;
+#else
+    const bool turbo = false;
+#endif
+    return backend == JpegBackend::Libjpeg || turbo;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <csetjmp>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "frame_pool.h"
+
+// JPEG encoder shared by the streamers. Takes YUYV frames straight from the
+// capture ring and produces a baseline JFIF image in memory.
+//
+// JpegInput::Rgb converts to RGB24 first and lets libjpeg convert back to
+// YCbCr. The Yuv inputs deinterleave YUYV into planar 4:2:2 (rescaled from
+// studio to full range) and hand it to jpeg_write_raw_data(), skipping both
+// colour-space conversions. Yuv averages chroma row pairs so the image keeps
+// the 4:2:0 sampling the Rgb path produces; Yuv422 encodes the camera's
+// 4:2:2 chroma as is. Either way the result is an ordinary JPEG.
+//
+// Two backends produce it. JpegBackend::Libjpeg drives the classic libjpeg
+// API: raw planar rows one MCU row at a time, or RGB one scanline at a
+// time. JpegBackend::Turbo, built with `make TURBOJPEG=1` (libjpeg-turbo 3.0
+// or later), keeps a TurboJPEG handle with its parameters set once and
+// compresses the whole frame in one call, tj3CompressFromYUVPlanes8() for
+// the Yuv inputs (the same full-range planes, for the whole frame) or
+// tj3Compress8() for Rgb, straight into the caller's buffer.
+
+enum class JpegInput { Rgb, Yuv, Yuv422 };
+
+enum class JpegBackend { Libjpeg, Turbo };
+
+struct JpegEncoder {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    jmp_buf jump;  // libjpeg errors return here, in jpeg_encode_yuyv()
+    int width = 0;
+    int height = 0;
+    JpegInput input = JpegInput::Yuv;
+    JpegBackend backend = JpegBackend::Libjpeg;
+    int chroma_v = 2;  // luma rows per chroma row in the encoded image
+
+    // Rgb input: the conversion target comes from this pool when set.
+    FramePool* pool = nullptr;
+    std::vector<unsigned char> rgb;
+
+    // Destination writing straight into the caller's buffer.
+    jpeg_destination_mgr dest;
+
+    // Yuv inputs: one MCU-row stripe per plane, padded to a whole MCU width
+    // (Libjpeg), or whole planes (Turbo).
+    int y_stride = 0;
+    int c_stride = 0;
+    std::vector<unsigned char> y_plane, cb_plane, cr_plane;
+
+    // Turbo
+    void* tj = nullptr;                      // tjhandle
+    std::vector<unsigned char> chroma_rows;  // Yuv: a pair of 4:2:2 rows to average
+};
+
+// Fails for JpegBackend::Turbo when built without it.
+bool jpeg_encoder_init(JpegEncoder& enc, int width, int height, int quality, JpegInput input,
+                       FramePool* pool = nullptr, JpegBackend backend = JpegBackend::Libjpeg);
+
+// Takes effect from the next frame.
+void jpeg_encoder_set_quality(JpegEncoder& enc, int quality);
+
+// Encodes the next frames height rows high, at most the height given to
+// jpeg_encoder_init() (tile mosaics, tile_delta.h). Takes effect from the
+// next frame.
+void jpeg_encoder_set_height(JpegEncoder& enc, int height);
+
+// Worst-case size of one encoded frame (same bound as libjpeg-turbo's
+// tjBufSize()); output buffers at least this large can never overflow.
+size_t jpeg_encoder_bound(const JpegEncoder& enc);
+
+// Compresses one YUYV frame into out, which must hold jpeg_encoder_bound()
+// bytes. Returns the size of the JPEG, or 0 if the encoder failed.
+size_t jpeg_encode_yuyv(JpegEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity);
+
+void jpeg_encoder_destroy(JpegEncoder& enc);
+
+bool parse_jpeg_input(const char* name, JpegInput& input);
+
+// Accepts "libjpeg" or "turbo".
+bool parse_jpeg_backend(const char* name, JpegBackend& backend);
+const char* jpeg_backend_name(JpegBackend backend);
+bool jpeg_backend_available(JpegBackend backend);
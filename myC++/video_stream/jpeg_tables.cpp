@@ -0,0 +1,145 @@
+#include "jpeg_tables.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "tile_delta.h"
+
+static const unsigned char SOI = 0xD8;
+static const unsigned char EOI = 0xD9;
+static const unsigned char SOS = 0xDA;
+static const unsigned char DQT = 0xDB;
+static const unsigned char DHT = 0xC4;
+static const unsigned char COM = 0xFE;
+
+static bool is_table(unsigned char marker) {
+    return marker == DQT || marker == DHT;
+}
+
+// Markers without a length: SOI, EOI, RST0..7 and TEM.
+static bool standalone(unsigned char marker) {
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9);
+}
+
+// Moves the DQT and DHT segments in front of the first SOS into
+// tables.found and copies everything else into out (after SOI and the tag,
+// when there is one). Returns the size written, 0 if jpeg cannot be split.
+static size_t split(JpegTables& tables, const unsigned char* jpeg, size_t size, unsigned char* out) {
+    if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != SOI) return 0;
+    tables.found.clear();
+    size_t o = 2 + (tables.tag ? JPEG_TABLES_TAG_SIZE : 0);
+    size_t pos = 2;
+    for (;;) {
+        if (pos + 2 > size || jpeg[pos] != 0xFF) return 0;
+        unsigned char marker = jpeg[pos + 1];
+        if (marker == 0xFF) {  // fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == SOS) break;
+        if (standalone(marker) || pos + 4 > size) return 0;
+        size_t len = 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+        if (len < 4 || pos + len > size) return 0;
+        if (is_table(marker)) {
+            tables.found.insert(tables.found.end(), jpeg + pos, jpeg + pos + len);
+        } else {
+            memcpy(out + o, jpeg + pos, len);
+            o += len;
+        }
+        pos += len;
+    }
+    if (tables.found.empty()) return 0;
+    if (tables.max_size && tables.found.size() + 4 > tables.max_size) return 0;
+
+    memcpy(out, jpeg, 2);
+    memcpy(out + o, jpeg + pos, size - pos);
+    return o + size - pos;
+}
+
+// Makes tables.found the current generation unless it already is.
+static void update_generation(JpegTables& tables) {
+    const std::vector<unsigned char>& found = tables.found;
+    bool same = tables.generation && tables.data.size() == found.size() + 4 &&
+                memcmp(tables.data.data() + 2, found.data(), found.size()) == 0;
+    if (same && !tables.stale) return;
+
+    tables.data.assign({ 0xFF, SOI });
+    tables.data.insert(tables.data.end(), found.begin(), found.end());
+    tables.data.insert(tables.data.end(), { 0xFF, EOI });
+    if (++tables.generation == 0) tables.generation = 1;
+    tables.stale = false;
+    tables.stats.changes++;
+}
+
+size_t jpeg_tables_abbreviate(JpegTables& tables, const unsigned char* frame, size_t size, unsigned char* out,
+                              uint16_t& needs) {
+    needs = 0;
+    size_t offset = 0;
+    if (tile_delta_is_delta(frame, size)) {
+        TileDeltaHeader delta;
+        bool valid = tile_delta_read(frame, size, delta);
+        if (valid && delta.jpeg) {
+            offset = delta.jpeg - frame;
+        } else {
+            // Nothing to decode; a malformed one is passed on whole.
+            memcpy(out, frame, size);
+            tables.stats.bytes += size;
+            return size;
+        }
+    }
+
+    memcpy(out, frame, offset);
+    size_t n = split(tables, frame + offset, size - offset, out + offset);
+    if (!n) {
+        memcpy(out + offset, frame + offset, size - offset);
+        tables.stale = true;
+        tables.stats.whole++;
+        tables.stats.bytes += size;
+        return size;
+    }
+
+    update_generation(tables);
+    if (tables.tag) {
+        unsigned char* tag = out + offset + 2;
+        const unsigned char head[6] = { 0xFF, COM, 0, 6, 'J', 'T' };
+        memcpy(tag, head, sizeof(head));
+        tag[6] = tables.generation >> 8;
+        tag[7] = tables.generation & 0xFF;
+    }
+    needs = tables.generation;
+    tables.stats.frames++;
+    tables.stats.saved += size - offset - n;
+    tables.stats.bytes += offset + n;
+    return offset + n;
+}
+
+uint16_t jpeg_tables_tag(const unsigned char* jpeg, size_t size) {
+    static const unsigned char head[8] = { 0xFF, SOI, 0xFF, COM, 0, 6, 'J', 'T' };
+    if (size < 2 + JPEG_TABLES_TAG_SIZE || memcmp(jpeg, head, sizeof(head)) != 0) return 0;
+    return jpeg[8] << 8 | jpeg[9];
+}
+
+bool jpeg_is_tables_only(const unsigned char* jpeg, size_t size) {
+    if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != SOI) return false;
+    size_t pos = 2;
+    while (pos + 2 <= size && jpeg[pos] == 0xFF) {
+        unsigned char marker = jpeg[pos + 1];
+        if (marker == EOI) return true;
+        if (!is_table(marker) || pos + 4 > size) return false;
+        pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+    }
+    return false;
+}
+
+void jpeg_tables_report(JpegTables& tables) {
+    JpegTablesStats& s = tables.stats;
+    uint64_t frames = s.frames + s.whole;
+    if (!frames) return;
+    printf("tables: %lu frames abbreviated, %lu sent whole, %.0f bytes/frame saved (%.1f%%), "
+           "%lu table changes, tables sent %lu times (%lu bytes)\n",
+           (unsigned long)s.frames, (unsigned long)s.whole, (double)s.saved / frames,
+           100.0 * s.saved / (s.saved + s.bytes), (unsigned long)s.changes, (unsigned long)s.sent,
+           (unsigned long)s.sent_bytes);
+    fflush(stdout);
+    s = JpegTablesStats{};
+}
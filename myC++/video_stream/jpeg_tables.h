@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Abbreviated JPEG sessions (StreamOptions::abbreviated, -a).
+//
+// Every JPEG carries its quantization (DQT) and Huffman (DHT) tables, about
+// 570 bytes that are the same frame after frame. In a session the sender
+// keeps them as a tables-only JPEG (SOI, the DQT and DHT segments, EOI: the
+// standard's "abbreviated format for table-specification data") and sends
+// frames as abbreviated datastreams, tables taken out. A viewer keeps one
+// decompressor for the whole session. libjpeg holds on to the tables it
+// reads, from a tables-only JPEG or from a frame, and decodes every later
+// frame with them.
+//
+// The tables change with the quality (rate control), possibly with every
+// frame of an MJPEG camera, and a frame that has to go out whole replaces
+// the viewers' tables with its own. Each set of tables is a generation; the
+// transports send the tables again ahead of the first frame that needs a new
+// generation.
+//
+// On TCP the tables go out as a frame of their own, in the stream's usual
+// framing, and each viewer gets them before the first frame that needs them.
+// On UDP they travel in a control packet (UDP_EXT_TABLES, udp_protocol.h)
+// that may be lost, so abbreviated frames carry their generation in a COM
+// segment right after SOI (JpegTables::tag):
+//
+//   FF FE 00 06 'J' 'T' [generation (2)]
+//
+// A viewer that does not hold that generation skips the frame and asks for
+// the tables with a keyframe request. Tile delta frames (tile_delta.h) keep
+// their header; only the mosaic JPEG is abbreviated.
+
+static const size_t JPEG_TABLES_TAG_SIZE = 8;
+
+struct JpegTablesStats {
+    uint64_t frames;    // abbreviated
+    uint64_t whole;     // sent with their tables: not a JPEG that could be split
+    uint64_t saved;     // bytes taken out of the abbreviated frames
+    uint64_t bytes;     // frame bytes after abbreviation
+    uint64_t changes;   // new generations
+    uint64_t sent;      // tables handed to the transport
+    uint64_t sent_bytes;
+};
+
+struct JpegTables {
+    std::vector<unsigned char> data;  // tables-only JPEG of the current generation
+    uint16_t generation = 0;          // 0: none yet
+    bool tag = false;                 // write the generation into abbreviated frames (UDP)
+    size_t max_size = 0;              // frames with larger tables go out whole (0: no limit)
+    bool stale = false;               // a frame went out whole; viewers now hold its tables
+    std::vector<unsigned char> found; // scratch: the tables of the frame being split
+    JpegTablesStats stats{};
+};
+
+// Copies frame (a JPEG or a tile delta, size bytes) into out without its
+// tables and returns the new size. out must hold size + JPEG_TABLES_TAG_SIZE
+// bytes. needs is set to the generation the copy decodes with, or to 0 when
+// it stands alone (sent whole, or a delta without a mosaic).
+size_t jpeg_tables_abbreviate(JpegTables& tables, const unsigned char* frame, size_t size, unsigned char* out,
+                              uint16_t& needs);
+
+// Viewer side: the generation in an abbreviated frame's tag, 0 if untagged.
+uint16_t jpeg_tables_tag(const unsigned char* jpeg, size_t size);
+
+// Whether jpeg holds tables only (no frame), as sent ahead of a session's frames.
+bool jpeg_is_tables_only(const unsigned char* jpeg, size_t size);
+
+// Prints the savings since the last call.
+void jpeg_tables_report(JpegTables& tables);
@@ -0,0 +1,180 @@
+#include "latency.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "udp_protocol.h"
+
+uint64_t latency_now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void latency_write_stamp(unsigned char* p, uint32_t seq, uint64_t capture_us) {
+    uint32_t seq_net = htonl(seq);
+    memcpy(p, &seq_net, 4);
+    for (int i = 11; i >= 4; --i, capture_us >>= 8) p[i] = (unsigned char)capture_us;
+}
+
+void latency_read_stamp(const unsigned char* p, uint32_t& seq, uint64_t& capture_us) {
+    memcpy(&seq, p, 4);
+    seq = ntohl(seq);
+    capture_us = 0;
+    for (int i = 4; i < 12; ++i) capture_us = capture_us << 8 | p[i];
+}
+
+static int bucket_of(uint64_t us) {
+    if (us < (uint64_t)LATENCY_SUB_BUCKETS) return (int)us;
+    int e = 63 - __builtin_clzll(us);  // 2^e <= us
+    int index = (e - 3) * LATENCY_SUB_BUCKETS + (int)((us >> (e - 4)) & (LATENCY_SUB_BUCKETS - 1));
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+// Middle of the bucket.
+static uint64_t bucket_value(int index) {
+    if (index < LATENCY_SUB_BUCKETS) return index;
+    int e = index / LATENCY_SUB_BUCKETS + 3;
+    uint64_t width = 1ULL << (e - 4);
+    return (LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) * width + width / 2;
+}
+
+void histogram_record(LatencyHistogram& h, uint64_t us) {
+    h.counts[bucket_of(us)]++;
+    h.total++;
+    if (us > h.max_us) h.max_us = us;
+}
+
+uint64_t histogram_percentile(const LatencyHistogram& h, double p) {
+    if (!h.total) return 0;
+    uint64_t rank = (uint64_t)std::ceil(p * h.total);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += h.counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(i);
+            return v < h.max_us ? v : h.max_us;
+        }
+    }
+    return h.max_us;
+}
+
+bool clock_answer(int fd, const unsigned char* p, size_t len, const sockaddr_in& from, socklen_t fromlen,
+                  uint64_t received_us) {
+    UdpClock clock;
+    if (!udp_read_clock(p, len, clock) || clock.reply) return false;
+
+    unsigned char reply[UDP_CLOCK_REPLY_SIZE];
+    udp_write_clock_reply(reply, clock.t0, received_us, latency_now_us());
+    if (sendto(fd, reply, sizeof(reply), 0, (const sockaddr*)&from, fromlen) < 0) perror("sendto clock");
+    return true;
+}
+
+bool clock_sync_request(ClockSync& sync, uint64_t now_us, unsigned char* out) {
+    // Quicker until the first answer, so the first report has an offset.
+    uint64_t interval_us = sync.interval_ms * (sync.synced ? 1000ULL : 200ULL);
+    if (sync.last_request_us && now_us - sync.last_request_us < interval_us) return false;
+    udp_write_clock_request(out, now_us);
+    sync.last_request_us = now_us;
+    return true;
+}
+
+bool clock_sync_on_packet(ClockSync& sync, const unsigned char* p, size_t len, uint64_t now_us) {
+    UdpClock clock;
+    if (!udp_read_clock(p, len, clock) || !clock.reply) return false;
+    if (clock.t0 > now_us || clock.t2 < clock.t1 || clock.t2 - clock.t1 > now_us - clock.t0) {
+        return true;  // not ours, or nonsense
+    }
+
+    // Round trip minus the time the sender held the request.
+    ClockSample& s = sync.samples[sync.next];
+    s.rtt_us = (now_us - clock.t0) - (clock.t2 - clock.t1);
+    s.offset_us = ((int64_t)(clock.t1 - clock.t0) + (int64_t)(clock.t2 - now_us)) / 2;
+    sync.next = (sync.next + 1) % CLOCK_SAMPLES;
+    if (sync.nsamples < CLOCK_SAMPLES) sync.nsamples++;
+
+    int best = 0;
+    for (int i = 1; i < sync.nsamples; ++i) {
+        if (sync.samples[i].rtt_us < sync.samples[best].rtt_us) best = i;
+    }
+    sync.synced = true;
+    sync.offset_us = sync.samples[best].offset_us;
+    sync.rtt_us = sync.samples[best].rtt_us;
+    return true;
+}
+
+void clock_sync_poll(ClockSync& sync, int fd) {
+    unsigned char reply[UDP_CLOCK_REPLY_SIZE];
+    ssize_t n;
+    while ((n = recv(fd, reply, sizeof(reply), MSG_DONTWAIT)) > 0) {
+        clock_sync_on_packet(sync, reply, n, latency_now_us());
+    }
+
+    unsigned char request[UDP_CLOCK_REQUEST_SIZE];
+    if (clock_sync_request(sync, latency_now_us(), request)) {
+        send(fd, request, sizeof(request), MSG_DONTWAIT);  // nobody listening: keep the default
+    }
+}
+
+void clock_sync_wait(ClockSync& sync, int fd, int data_fd) {
+    pollfd pfd[2] = { { data_fd, POLLIN, 0 }, { fd, POLLIN, 0 } };
+    do {
+        clock_sync_poll(sync, fd);
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR) return;
+    } while (!pfd[0].revents);
+}
+
+static void print_line(const char* label, const LatencyHistogram& h, uint64_t frames, uint64_t lost,
+                       const ClockSync& sync) {
+    uint64_t expected = frames + lost;
+    printf("%s: %lu frames, p50 %.1f ms, p99 %.1f ms, max %.1f ms, %lu lost (%.1f%%), ", label,
+           (unsigned long)frames, histogram_percentile(h, 0.50) / 1000.0, histogram_percentile(h, 0.99) / 1000.0,
+           h.max_us / 1000.0, (unsigned long)lost, expected ? 100.0 * lost / expected : 0.0);
+    if (sync.synced) {
+        printf("clock offset %+.3f ms, rtt %.3f ms\n", sync.offset_us / 1000.0, sync.rtt_us / 1000.0);
+    } else {
+        printf("no clock answer (same host assumed)\n");
+    }
+    fflush(stdout);
+}
+
+void latency_on_frame(LatencyStats& stats, const ClockSync& sync, uint32_t seq, uint64_t capture_us,
+                      uint64_t now_us) {
+    if (stats.have_seq) {
+        int32_t gap = (int32_t)(seq - stats.last_seq);
+        if (gap > 1) {
+            stats.lost += gap - 1;
+            stats.interval_lost += gap - 1;
+        }
+        if (gap > 0) stats.last_seq = seq;
+    } else {
+        stats.have_seq = true;
+        stats.last_seq = seq;
+    }
+
+    // On the sender's clock; a small negative is offset error, count it as 0.
+    int64_t latency = (int64_t)(now_us + sync.offset_us) - (int64_t)capture_us;
+    uint64_t us = latency > 0 ? (uint64_t)latency : 0;
+    histogram_record(stats.interval, us);
+    histogram_record(stats.total, us);
+    stats.frames++;
+    stats.interval_frames++;
+
+    if (stats.report_every && stats.interval_frames >= (uint64_t)stats.report_every) {
+        print_line("latency", stats.interval, stats.interval_frames, stats.interval_lost, sync);
+        stats.interval = LatencyHistogram{};
+        stats.interval_frames = stats.interval_lost = 0;
+    }
+}
+
+void latency_summary(const LatencyStats& stats, const ClockSync& sync) {
+    if (stats.frames) print_line("latency (whole run)", stats.total, stats.frames, stats.lost, sync);
+}
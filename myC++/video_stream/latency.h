@@ -0,0 +1,112 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Capture-to-display latency, measured by the viewers.
+//
+// With -t the streamers stamp every frame with a sequence number and its
+// capture time (the V4L2 buffer timestamp, CLOCK_MONOTONIC on the
+// streamer's host, in microseconds):
+//   TCP  the 4-byte length has LATENCY_STAMP_FLAG set and LATENCY_STAMP_SIZE
+//        bytes follow it before the JPEG: [seq (4)] [capture_us (8)],
+//        big-endian; the length itself is the JPEG's
+//   UDP  a UDP_EXT_TIMESTAMP packet (udp_protocol.h) ahead of the frame's
+//        chunks; frame_id is the sequence number
+//
+// A viewer takes the time a frame was shown, moves it onto the streamer's
+// clock and records the difference in a histogram; gaps in the sequence
+// numbers count as lost frames (dropped by the fan-out for a slow viewer,
+// or never completed over UDP).
+//
+// ClockSync finds the offset between the two clocks with NTP-style
+// UDP_EXT_CLOCK exchanges, one a second: offset = ((t1 - t0) + (t2 - t3)) / 2
+// from the sample with the shortest round trip of the last CLOCK_SAMPLES.
+// Its error is at most half that round trip. Without an answer the clocks
+// are taken to be the same one, which holds when both ends run on one host.
+
+static const uint32_t LATENCY_STAMP_FLAG = 0x80000000;
+static const size_t LATENCY_STAMP_SIZE = 12;
+static const int CLOCK_SAMPLES = 8;
+
+// Log-linear buckets in microseconds: exact below 16, then 16 per power of
+// two (within 6.25%), up to about 70 minutes.
+static const int LATENCY_SUB_BUCKETS = 16;
+static const int LATENCY_BUCKETS = LATENCY_SUB_BUCKETS * 29;
+
+struct LatencyHistogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t max_us;
+};
+
+struct ClockSample {
+    int64_t offset_us;  // sender clock minus ours
+    uint64_t rtt_us;
+};
+
+struct ClockSync {
+    uint32_t interval_ms = 1000;
+    uint64_t last_request_us = 0;
+    ClockSample samples[CLOCK_SAMPLES] = {};
+    int nsamples = 0;
+    int next = 0;
+
+    // Best of the window
+    bool synced = false;
+    int64_t offset_us = 0;
+    uint64_t rtt_us = 0;
+};
+
+struct LatencyStats {
+    LatencyHistogram interval{};  // since the last report
+    LatencyHistogram total{};
+    uint64_t frames = 0;
+    uint64_t lost = 0;
+    uint64_t interval_frames = 0;
+    uint64_t interval_lost = 0;
+    bool have_seq = false;
+    uint32_t last_seq = 0;
+    int report_every = 300;       // frames between reports (0: only latency_summary)
+};
+
+// CLOCK_MONOTONIC in microseconds.
+uint64_t latency_now_us();
+
+// TCP stamp: LATENCY_STAMP_SIZE bytes.
+void latency_write_stamp(unsigned char* p, uint32_t seq, uint64_t capture_us);
+void latency_read_stamp(const unsigned char* p, uint32_t& seq, uint64_t& capture_us);
+
+void histogram_record(LatencyHistogram& h, uint64_t us);
+uint64_t histogram_percentile(const LatencyHistogram& h, double p);
+
+// Streamer side: answers p if it is a clock request. Returns false for any
+// other packet. received_us is when p arrived.
+bool clock_answer(int fd, const unsigned char* p, size_t len, const sockaddr_in& from, socklen_t fromlen,
+                  uint64_t received_us);
+
+// Viewer side. clock_sync_request() fills UDP_CLOCK_REQUEST_SIZE bytes into
+// out when a request is due; clock_sync_on_packet() takes in a reply and
+// returns false for any other packet.
+bool clock_sync_request(ClockSync& sync, uint64_t now_us, unsigned char* out);
+bool clock_sync_on_packet(ClockSync& sync, const unsigned char* p, size_t len, uint64_t now_us);
+
+// For viewers that have no UDP socket of their own to poll, with fd a UDP
+// socket connected to the streamer. clock_sync_poll() takes in any replies
+// already waiting and sends a request when one is due, without blocking.
+// clock_sync_wait() blocks until data_fd (the frame socket) is readable,
+// taking in replies as they arrive so they are timed on arrival rather
+// than after the next frame.
+void clock_sync_poll(ClockSync& sync, int fd);
+void clock_sync_wait(ClockSync& sync, int fd, int data_fd);
+
+// Records a frame shown at now_us (our clock) and prints a report every
+// report_every frames.
+void latency_on_frame(LatencyStats& stats, const ClockSync& sync, uint32_t seq, uint64_t capture_us,
+                      uint64_t now_us);
+
+// Whole-run numbers, for when the viewer quits.
+void latency_summary(const LatencyStats& stats, const ClockSync& sync);
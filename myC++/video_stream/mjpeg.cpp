@@ -0,0 +1,112 @@
+#include "mjpeg.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <jpeglib.h>
+
+// Offset of the SOS marker, or 0 if the headers are malformed. Calls found()
+// on every marker segment before it.
+template <typename Fn>
+static size_t find_sos(const unsigned char* data, size_t size, Fn found) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return 0;
+        unsigned char marker = data[pos + 1];
+        if (marker == 0xFF) { pos++; continue; }  // fill byte
+        if (marker == 0xDA) return pos;
+
+        size_t end = pos + 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if (end > size) return 0;
+        found(marker, pos);
+        pos = end;
+    }
+    return 0;
+}
+
+// libjpeg writes the Annex K tables whenever optimize_coding is off, so the
+// segments are lifted from a tiny colour encode instead of being hard-coded.
+static const std::vector<unsigned char>& standard_dht() {
+    static const std::vector<unsigned char> dht = [] {
+        jpeg_compress_struct cinfo;
+        jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
+
+        unsigned char* buf = nullptr;
+        unsigned long size = 0;
+        jpeg_mem_dest(&cinfo, &buf, &size);
+        cinfo.image_width = 16;
+        cinfo.image_height = 16;
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_start_compress(&cinfo, TRUE);
+
+        unsigned char row[16 * 3] = {};
+        JSAMPROW rows[1] = { row };
+        while (cinfo.next_scanline < cinfo.image_height) jpeg_write_scanlines(&cinfo, rows, 1);
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+
+        std::vector<unsigned char> tables;
+        find_sos(buf, size, [&](unsigned char marker, size_t pos) {
+            if (marker != 0xC4) return;
+            size_t len = 2 + ((buf[pos + 2] << 8) | buf[pos + 3]);
+            tables.insert(tables.end(), buf + pos, buf + pos + len);
+        });
+        free(buf);
+        return tables;
+    }();
+    return dht;
+}
+
+size_t mjpeg_dht_size() {
+    return standard_dht().size();
+}
+
+bool mjpeg_has_dht(const unsigned char* data, size_t size) {
+    bool dht = false;
+    find_sos(data, size, [&](unsigned char marker, size_t) { if (marker == 0xC4) dht = true; });
+    return dht;
+}
+
+size_t mjpeg_insert_dht(const unsigned char* data, size_t size, unsigned char* out, size_t capacity) {
+    const std::vector<unsigned char>& dht = standard_dht();
+    size_t sos = find_sos(data, size, [](unsigned char, size_t) {});
+    if (!sos || size + dht.size() > capacity) return 0;
+
+    memcpy(out, data, sos);
+    memcpy(out + sos, dht.data(), dht.size());
+    memcpy(out + sos + dht.size(), data + sos, size - sos);
+    return size + dht.size();
+}
+
+size_t mjpeg_frame_end(const unsigned char* data, size_t size) {
+    size_t sos = find_sos(data, size, [](unsigned char, size_t) {});
+    if (!sos) return 0;
+
+    // Entropy-coded data escapes 0xFF as FF 00, so the first FF D9 is the EOI.
+    const unsigned char* p = data + sos + 2;
+    const unsigned char* end = data + size;
+    while ((p = static_cast<const unsigned char*>(memchr(p, 0xFF, end - p))) && p + 1 < end) {
+        if (p[1] == 0xD9) return p + 2 - data;
+        p++;
+    }
+    return 0;
+}
+
+bool mjpeg_dimensions(const unsigned char* data, size_t size, int& width, int& height) {
+    bool found = false;
+    find_sos(data, size, [&](unsigned char marker, size_t pos) {
+        // SOF0..SOF15 except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker < 0xC0 || marker > 0xCF || marker == 0xC4 || marker == 0xC8 || marker == 0xCC) return;
+        height = (data[pos + 5] << 8) | data[pos + 6];
+        width = (data[pos + 7] << 8) | data[pos + 8];
+        found = true;
+    });
+    return found;
+}
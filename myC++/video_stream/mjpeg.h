@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+// Helpers for passing camera MJPEG frames through without re-encoding.
+//
+// UVC cameras commonly emit "MJPEG" frames with no DHT segment and rely on
+// the decoder falling back to the standard Huffman tables (JPEG Annex K.3).
+// Strict decoders reject such frames, so mjpeg_insert_dht() adds the standard
+// tables in front of the SOS.
+
+// Size of the standard DHT segments mjpeg_insert_dht() adds.
+size_t mjpeg_dht_size();
+
+// True if a DHT segment appears before the frame's SOS.
+bool mjpeg_has_dht(const unsigned char* data, size_t size);
+
+// Copies the frame to out with the standard tables inserted before the SOS.
+// Returns the new size, or 0 if the frame is malformed or out is too small.
+size_t mjpeg_insert_dht(const unsigned char* data, size_t size, unsigned char* out, size_t capacity);
+
+// Offset just past the EOI of the frame starting at data, or 0 if none.
+size_t mjpeg_frame_end(const unsigned char* data, size_t size);
+
+// Reads the frame size from the SOF segment.
+bool mjpeg_dimensions(const unsigned char* data, size_t size, int& width, int& height);
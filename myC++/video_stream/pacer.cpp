@@ -0,0 +1,80 @@
+#include "pacer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+
+uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void pacer_init(Pacer& pacer, double fps) {
+    pacer = Pacer{};
+    if (fps > 0) pacer.interval_ns = (uint64_t)(1e9 / fps);
+    pacer.report_ns = monotonic_ns();
+}
+
+void pacer_set_fps(Pacer& pacer, double fps) {
+    pacer.interval_ns = fps > 0 ? (uint64_t)(1e9 / fps) : 0;
+}
+
+void pacer_wait(Pacer& pacer) {
+    if (!pacer.interval_ns || !pacer.started) return;
+
+    timespec ts;
+    ts.tv_sec = pacer.next_ns / 1000000000ULL;
+    ts.tv_nsec = pacer.next_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+}
+
+bool pacer_admit(Pacer& pacer, uint64_t frame_ns) {
+    if (!pacer.interval_ns) {
+        pacer.stats.admitted++;
+        return true;
+    }
+    if (!pacer.started) {
+        pacer.next_ns = frame_ns;
+        pacer.started = true;
+    }
+
+    // A quarter interval of slack: at exactly twice the target rate every
+    // other frame lands half an interval early and must be skipped.
+    if (frame_ns + pacer.interval_ns / 4 < pacer.next_ns) {
+        pacer.stats.skipped++;
+        return false;
+    }
+
+    uint64_t jitter;
+    if (frame_ns >= pacer.next_ns + pacer.interval_ns) {
+        pacer.stats.late++;
+        pacer.next_ns = frame_ns;
+        jitter = 0;
+    } else {
+        jitter = frame_ns > pacer.next_ns ? frame_ns - pacer.next_ns : pacer.next_ns - frame_ns;
+    }
+
+    pacer.stats.admitted++;
+    pacer.stats.jitter_ns += jitter;
+    if (jitter > pacer.stats.max_jitter_ns) pacer.stats.max_jitter_ns = jitter;
+    pacer.next_ns += pacer.interval_ns;
+    return true;
+}
+
+void pacer_report(Pacer& pacer) {
+    uint64_t now = monotonic_ns();
+    double seconds = (now - pacer.report_ns) / 1e9;
+    const PacerStats& s = pacer.stats;
+
+    printf("pacer: target %.2f fps, achieved %.2f fps, jitter avg %.2f ms max %.2f ms, skipped %lu, late %lu\n",
+           pacer.interval_ns ? 1e9 / pacer.interval_ns : 0.0,
+           seconds > 0 ? s.admitted / seconds : 0.0,
+           s.admitted ? s.jitter_ns / 1e6 / s.admitted : 0.0,
+           s.max_jitter_ns / 1e6,
+           (unsigned long)s.skipped, (unsigned long)s.late);
+    fflush(stdout);
+
+    pacer.stats = PacerStats{};
+    pacer.report_ns = now;
+}
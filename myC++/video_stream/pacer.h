@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Paces the capture loop to a target frame rate from frame timestamps
+// (CLOCK_MONOTONIC) instead of sleeping a fixed time after each frame.
+//
+// Frames are admitted against a fixed schedule of slots one interval apart.
+// A frame that arrives over a quarter interval before its slot is skipped
+// (a 30 fps camera streamed at 15 fps drops every other frame). A frame that
+// arrives a whole interval or more after its slot restarts the schedule from
+// itself, so time lost to a slow encode or send is dropped instead of being
+// made up with a burst. Sources that do not pace themselves (clip replay)
+// call pacer_wait() before each frame to sleep until the next slot.
+
+struct PacerStats {
+    uint64_t admitted;
+    uint64_t skipped;   // early frames decimated to hit the target rate
+    uint64_t late;      // times the schedule was restarted after falling behind
+    uint64_t jitter_ns; // summed |frame time - slot| over admitted frames
+    uint64_t max_jitter_ns;
+};
+
+struct Pacer {
+    uint64_t interval_ns = 0;  // 0: admit every frame
+    uint64_t next_ns = 0;      // slot of the next frame
+    bool started = false;
+    PacerStats stats{};
+    uint64_t report_ns = 0;    // start of the current report period
+};
+
+// CLOCK_MONOTONIC in nanoseconds, the clock of frame timestamps and slots.
+uint64_t monotonic_ns();
+
+// fps <= 0 admits every frame.
+void pacer_init(Pacer& pacer, double fps);
+
+// Changes the target rate, keeping the slot already scheduled.
+void pacer_set_fps(Pacer& pacer, double fps);
+
+// Sleeps (clock_nanosleep, absolute) until the next slot is due.
+void pacer_wait(Pacer& pacer);
+
+// Decides whether the frame captured at frame_ns is sent.
+bool pacer_admit(Pacer& pacer, uint64_t frame_ns);
+
+// Prints achieved fps and jitter since the last report and resets them.
+void pacer_report(Pacer& pacer);
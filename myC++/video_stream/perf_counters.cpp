@@ -0,0 +1,200 @@
+#include "perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+thread_local PerfThread* perf_thread = nullptr;
+
+static const uint64_t COUNTER_CONFIGS[PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+static const char* COUNTER_NAMES[PERF_COUNTERS] = { "cycles", "instructions", "cache_misses" };
+
+static uint64_t clock_ns(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int open_counter(uint64_t config, int group_fd, bool kernel) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = !kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Opens the group on the calling thread. Returns the leader, or -1.
+static int open_group(int* member_fds, bool kernel) {
+    int leader = open_counter(COUNTER_CONFIGS[0], -1, kernel);
+    if (leader < 0) return -1;
+    for (int i = 1; i < PERF_COUNTERS; ++i) {
+        member_fds[i - 1] = open_counter(COUNTER_CONFIGS[i], leader, kernel);
+        if (member_fds[i - 1] < 0) {
+            for (int j = 0; j < i - 1; ++j) close(member_fds[j]);
+            close(leader);
+            return -1;
+        }
+    }
+    return leader;
+}
+
+static void close_group(PerfThread& t) {
+    if (t.fd < 0) return;
+    for (int& fd : t.member_fds) {
+        close(fd);
+        fd = -1;
+    }
+    close(t.fd);
+    t.fd = -1;
+}
+
+static void read_counters(const PerfThread& t, PerfReading& r) {
+    r.wall_ns = clock_ns(CLOCK_MONOTONIC);
+    r.cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (t.fd < 0) return;
+
+    // nr, time_enabled, time_running, then one value per counter
+    uint64_t buf[3 + PERF_COUNTERS];
+    if (read(t.fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) return;
+    r.enabled_ns = buf[1];
+    r.running_ns = buf[2];
+    for (int i = 0; i < PERF_COUNTERS; ++i) r.counts[i] = buf[3 + i];
+}
+
+// Adds what happened between a and b to stage.
+static void charge(PerfStageTotals& stage, const PerfThread& t, const PerfReading& a, const PerfReading& b) {
+    stage.wall_ns.fetch_add(b.wall_ns - a.wall_ns, std::memory_order_relaxed);
+    stage.cpu_ns.fetch_add(b.cpu_ns - a.cpu_ns, std::memory_order_relaxed);
+    if (t.fd < 0) return;
+
+    // The group was only counting part of the time when the PMU is shared.
+    uint64_t enabled = b.enabled_ns - a.enabled_ns;
+    uint64_t running = b.running_ns - a.running_ns;
+    double scale = running && running < enabled ? (double)enabled / running : 1.0;
+    for (int i = 0; i < PERF_COUNTERS; ++i) {
+        stage.counts[i].fetch_add((uint64_t)((b.counts[i] - a.counts[i]) * scale), std::memory_order_relaxed);
+    }
+}
+
+bool perf_monitor_init(PerfMonitor& monitor, const char* path) {
+    // Kernel time matters for capture and send; fall back to user only.
+    int members[PERF_COUNTERS - 1];
+    for (bool kernel : { true, false }) {
+        int fd = open_group(members, kernel);
+        if (fd < 0) continue;
+        for (int m : members) close(m);
+        close(fd);
+        monitor.hardware = true;
+        monitor.kernel = kernel;
+        break;
+    }
+    if (!monitor.hardware) {
+        std::cerr << "perf: hardware counters unavailable (" << strerror(errno) << "); recording times only\n";
+    }
+
+    if (strcmp(path, "-") == 0) {
+        monitor.json = stdout;
+    } else {
+        monitor.json = fopen(path, "a");
+        if (!monitor.json) {
+            perror(path);
+            return false;
+        }
+        monitor.close_json = true;
+    }
+    monitor.start_ns = monitor.interval_start_ns = clock_ns(CLOCK_MONOTONIC);
+    return true;
+}
+
+void perf_monitor_close(PerfMonitor& monitor) {
+    if (monitor.close_json) fclose(monitor.json);
+    monitor.json = nullptr;
+    monitor.close_json = false;
+}
+
+void perf_thread_start(PerfMonitor* monitor) {
+    if (!monitor) return;
+    PerfThread* t = new PerfThread;
+    t->monitor = monitor;
+    if (monitor->hardware) t->fd = open_group(t->member_fds, monitor->kernel);
+    perf_thread = t;
+}
+
+void perf_thread_stop() {
+    if (!perf_thread) return;
+    perf_switch(PERF_NONE);
+    close_group(*perf_thread);
+    delete perf_thread;
+    perf_thread = nullptr;
+}
+
+PerfStage perf_switch(PerfStage stage) {
+    PerfThread& t = *perf_thread;
+    PerfStage prev = t.stage;
+    if (stage == prev) return prev;
+
+    PerfReading now = t.last;
+    read_counters(t, now);
+    if (prev != PERF_NONE) charge(t.monitor->stages[prev], t, t.last, now);
+    t.last = now;
+    t.stage = stage;
+    return prev;
+}
+
+const char* perf_stage_name(PerfStage stage) {
+    switch (stage) {
+    case PERF_CAPTURE: return "capture";
+    case PERF_CONVERT: return "convert";
+    case PERF_ENCODE: return "encode";
+    case PERF_SEND: return "send";
+    default: return "none";
+    }
+}
+
+void perf_report(PerfMonitor& monitor) {
+    if (!monitor.json) return;
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    fprintf(monitor.json, "{\"time_s\":%.3f,\"interval_s\":%.3f,\"hardware\":%s,\"kernel\":%s,\"stages\":{",
+            (now - monitor.start_ns) / 1e9, (now - monitor.interval_start_ns) / 1e9,
+            monitor.hardware ? "true" : "false", monitor.kernel ? "true" : "false");
+    monitor.interval_start_ns = now;
+
+    for (int s = 0; s < PERF_STAGES; ++s) {
+        PerfStageTotals& stage = monitor.stages[s];
+        uint64_t frames = stage.frames.exchange(0);
+        uint64_t wall_ns = stage.wall_ns.exchange(0);
+        uint64_t cpu_ns = stage.cpu_ns.exchange(0);
+        uint64_t counts[PERF_COUNTERS];
+        for (int i = 0; i < PERF_COUNTERS; ++i) counts[i] = stage.counts[i].exchange(0);
+        double per = frames ? 1.0 / frames : 0.0;
+
+        // Per frame
+        fprintf(monitor.json, "%s\"%s\":{\"frames\":%lu,\"wall_us\":%.1f,\"cpu_us\":%.1f", s ? "," : "",
+                perf_stage_name((PerfStage)s), (unsigned long)frames, wall_ns * per / 1e3, cpu_ns * per / 1e3);
+        if (monitor.hardware) {
+            for (int i = 0; i < PERF_COUNTERS; ++i) {
+                fprintf(monitor.json, ",\"%s\":%.0f", COUNTER_NAMES[i], counts[i] * per);
+            }
+            // Instructions per cycle and cache misses per thousand instructions
+            fprintf(monitor.json, ",\"ipc\":%.2f,\"mpki\":%.2f", counts[0] ? (double)counts[1] / counts[0] : 0.0,
+                    counts[1] ? 1000.0 * counts[2] / counts[1] : 0.0);
+        }
+        fprintf(monitor.json, "}");
+    }
+    fprintf(monitor.json, "}}\n");
+    fflush(monitor.json);
+}
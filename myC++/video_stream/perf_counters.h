@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// Per-stage hardware counters for the pipeline (PipelineConfig::perf_json).
+//
+// Each pipeline thread opens its own perf_event_open() group (CPU cycles,
+// instructions and cache misses, the last being last-level misses on most
+// CPUs) and tells the module which stage it is working on with
+// perf_enter(). Every switch reads the group once and charges what was
+// counted since the previous switch, together with wall and thread CPU
+// time, to the stage being left. Stages nest by switching:
+// the conversion inside an encode is charged to convert only, so the
+// stages add up to the work done without counting anything twice.
+//
+//   capture  dequeuing a frame (DQBUF, or copying a replayed one)
+//   convert  YUYV to RGB or planar YUV, downscaling, gathering tiles
+//   encode   JPEG compression and MJPEG table insertion, slice helpers
+//            included
+//   send     the streamer's send_frame
+//
+// perf_report() divides the totals by the frames each stage handled and
+// appends them as one JSON object per line. Without a PMU (most VMs and
+// containers) or permission (perf_event_paranoid) only the times are
+// recorded; kernel time is left out when only user counting is allowed.
+//
+// Threads that never call perf_thread_start() only pay for a thread-local
+// null check in perf_enter(), so the hooks stay in the encoder when
+// counting is off.
+
+enum PerfStage {
+    PERF_CAPTURE,
+    PERF_CONVERT,
+    PERF_ENCODE,
+    PERF_SEND,
+    PERF_STAGES,
+    PERF_NONE = PERF_STAGES,  // not charged to any stage
+};
+
+static const int PERF_COUNTERS = 3;  // cycles, instructions, cache misses
+
+struct PerfStageTotals {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> wall_ns{0};
+    std::atomic<uint64_t> cpu_ns{0};
+    std::atomic<uint64_t> counts[PERF_COUNTERS] = {};
+};
+
+struct PerfMonitor {
+    bool hardware = false;     // counters open on the thread that probed
+    bool kernel = false;       // counting kernel time too
+    FILE* json = nullptr;
+    bool close_json = false;
+    uint64_t interval_start_ns = 0;
+    uint64_t start_ns = 0;
+    PerfStageTotals stages[PERF_STAGES];
+};
+
+struct PerfReading {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t enabled_ns;
+    uint64_t running_ns;
+    uint64_t counts[PERF_COUNTERS];
+};
+
+struct PerfThread {
+    PerfMonitor* monitor = nullptr;
+    int fd = -1;               // group leader (cycles), -1 without counters
+    int member_fds[PERF_COUNTERS - 1] = { -1, -1 };
+    PerfStage stage = PERF_NONE;
+    PerfReading last{};
+};
+
+extern thread_local PerfThread* perf_thread;
+
+// Probes the counters and opens path for the JSON lines ("-" for stdout).
+bool perf_monitor_init(PerfMonitor& monitor, const char* path);
+void perf_monitor_close(PerfMonitor& monitor);
+
+// The monitor this thread reports to, for threads it starts (null if none).
+inline PerfMonitor* perf_current() { return perf_thread ? perf_thread->monitor : nullptr; }
+
+// Opens this thread's counters; a null monitor leaves the thread uncounted.
+void perf_thread_start(PerfMonitor* monitor);
+void perf_thread_stop();
+
+PerfStage perf_switch(PerfStage stage);
+
+// Starts charging this thread's work to stage; returns the previous stage.
+inline PerfStage perf_enter(PerfStage stage) { return perf_thread ? perf_switch(stage) : PERF_NONE; }
+
+inline void perf_count_frame(PerfStage stage) {
+    if (perf_thread) perf_thread->monitor->stages[stage].frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Writes the per-frame averages since the last call as one JSON line.
+void perf_report(PerfMonitor& monitor);
+
+const char* perf_stage_name(PerfStage stage);
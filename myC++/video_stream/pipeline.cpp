@@ -0,0 +1,620 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "mjpeg.h"
+#include "pacer.h"
+#include "perf_counters.h"
+#include "yuyv_rgb.h"
+
+static const uint64_t KEYFRAME_REQUEST_GAP_NS = 500000000;  // requested keyframes at most this often
+
+struct Pipeline {
+    Capture& cap;
+    const PipelineConfig& config;
+    FramePool pool;
+    BoundedQueue<PipelineFrame> encode_q;
+    BoundedQueue<PipelineFrame> send_q;
+    BoundedQueue<CaptureFrame> release_q;
+    PipelineStats stats;
+    std::atomic<bool> stop{false};
+    int workers;              // encode threads: config.workers, one for H.264
+    std::atomic<int> active_workers{0};
+    bool capture_failed = false;
+    std::atomic<bool> encoder_failed{false};
+    bool h264;                // VideoCodec::H264
+
+    // Tile deltas; capture thread only
+    bool tiles = false;
+    TileDiff diff;
+    int since_key = 0;        // deltas since the last keyframe
+    uint64_t key_request_ns = 0;
+
+    // Frame gate; capture thread only
+    bool gating = false;
+    FrameGate gate;
+    uint64_t gate_sent_ns = 0;  // when the last frame was let through
+    int gate_scale = 0;
+
+    // Per-stage counters; null when off
+    PerfMonitor perf;
+    PerfMonitor* perf_monitor = nullptr;
+
+    Pipeline(Capture& c, const PipelineConfig& cfg)
+        : cap(c), config(cfg),
+          encode_q(c.buffers.size()),
+          send_q(cfg.workers * 2),
+          release_q(c.buffers.size()),
+          workers(cfg.codec == VideoCodec::H264 ? 1 : cfg.workers),
+          h264(cfg.codec == VideoCodec::H264) {
+        stats.encode_q.capacity = encode_q.capacity();
+        stats.send_q.capacity = send_q.capacity();
+    }
+};
+
+static void record(StageStats& stage, uint64_t ns) {
+    stage.frames.fetch_add(1, std::memory_order_relaxed);
+    stage.busy_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+static void sample(QueueStats& q, size_t occupancy) {
+    q.samples.fetch_add(1, std::memory_order_relaxed);
+    q.occupancy.fetch_add(occupancy, std::memory_order_relaxed);
+    uint32_t prev = q.max.load(std::memory_order_relaxed);
+    while (occupancy > prev && !q.max.compare_exchange_weak(prev, occupancy, std::memory_order_relaxed)) {}
+}
+
+// Whether the frame goes on to the encoders. Sets heartbeat when only
+// heartbeat_ms lets it through.
+static bool gate_frame(Pipeline& p, const PipelineFrame& frame, bool& heartbeat) {
+    uint64_t start = monotonic_ns();
+    bool changed = frame_gate_changed(p.gate, frame.capture.data);
+    record(p.stats.gate.check, monotonic_ns() - start);
+
+    PipelineControl* control = p.config.control;
+    heartbeat = false;
+    if (changed || frame.scale != p.gate_scale || (control && control->keyframe.load())) return true;
+    heartbeat = frame.captured_ns - p.gate_sent_ns >= (uint64_t)p.config.heartbeat_ms * 1000000;
+    return heartbeat;
+}
+
+static void commit_gate(Pipeline& p, const PipelineFrame& frame, bool heartbeat) {
+    frame_gate_commit(p.gate);
+    p.gate_sent_ns = frame.captured_ns;
+    p.gate_scale = frame.scale;
+    p.stats.gate.passed.fetch_add(1, std::memory_order_relaxed);
+    if (heartbeat) p.stats.gate.heartbeats.fetch_add(1, std::memory_order_relaxed);
+
+    // Without tile deltas or H.264 every frame is whole, so any answers a request.
+    if (!p.tiles && !p.h264 && p.config.control) p.config.control->keyframe = false;
+}
+
+// Decides whether the frame goes out whole or as changed tiles and fills in
+// its tile map. Sets requested when it answers PipelineControl::keyframe.
+static void plan_tiles(Pipeline& p, PipelineFrame& frame, bool heartbeat, bool& requested) {
+    uint64_t start = monotonic_ns();
+    PipelineControl* control = p.config.control;
+    int interval = p.config.keyframe_interval;
+    bool key = !p.diff.have_reference || frame.scale != 1 || heartbeat || (interval && p.since_key + 1 >= interval);
+    requested = false;
+    if (!key && control && control->keyframe.load() && frame.captured_ns - p.key_request_ns >= KEYFRAME_REQUEST_GAP_NS) {
+        key = requested = true;
+    }
+
+    if (!key) {
+        frame.tile_map.resize(tile_map_bytes(p.diff.width, p.diff.height));
+        frame.changed_tiles = tile_diff_compare(p.diff, frame.capture.data, frame.tile_map.data());
+        // A delta covering most of the picture costs about as much as a keyframe.
+        frame.delta = frame.changed_tiles * 4 <= p.stats.tiles.tiles_per_frame * 3;
+    }
+    record(p.stats.tiles.diff, monotonic_ns() - start);
+}
+
+// Brings the reference up to date with a frame accepted into encode_q.
+static void commit_tiles(Pipeline& p, const PipelineFrame& frame, bool requested) {
+    TileStats& stats = p.stats.tiles;
+    if (frame.delta) {
+        tile_diff_commit(p.diff, frame.capture.data, frame.tile_map.data());
+        p.since_key++;
+        stats.deltas.fetch_add(1, std::memory_order_relaxed);
+        stats.changed_tiles.fetch_add(frame.changed_tiles, std::memory_order_relaxed);
+        return;
+    }
+
+    // A half-size keyframe leaves nothing to compare full-size frames with.
+    if (frame.scale == 1) tile_diff_commit(p.diff, frame.capture.data, nullptr);
+    else tile_diff_reset(p.diff);
+    p.since_key = 0;
+    stats.keyframes.fetch_add(1, std::memory_order_relaxed);
+
+    // Any keyframe answers a pending request.
+    if (p.config.control) p.config.control->keyframe = false;
+    if (requested) p.key_request_ns = frame.captured_ns;
+}
+
+static void capture_loop(Pipeline& p) {
+    uint64_t seq = 0;
+    CaptureFrame done;
+    Pacer pacer;
+    double fps = p.config.control ? p.config.control->fps.load() : p.config.fps;
+    pacer_init(pacer, fps);
+    perf_thread_start(p.perf_monitor);
+
+    while (!p.stop.load()) {
+        if (p.config.control && p.config.control->fps.load() != fps) {
+            fps = p.config.control->fps.load();
+            pacer_set_fps(pacer, fps);
+        }
+        while (p.release_q.try_pop(done)) capture_requeue(p.cap, done);
+        if (p.cap.stats.queued == 0 && !capture_owns_frames(p.cap)) {
+            // Every buffer is with the encoders; wait for one to come back.
+            // USERPTR slots are refilled from the pool by capture_dequeue().
+            if (p.release_q.pop_wait(done)) capture_requeue(p.cap, done);
+            continue;
+        }
+
+        // A camera paces itself; a replayed clip is held back to the next slot.
+        if (capture_is_replay(p.cap)) pacer_wait(pacer);
+
+        PipelineFrame frame{};
+        uint64_t start = monotonic_ns();
+        PerfStage outer = perf_enter(PERF_CAPTURE);
+        bool dequeued = capture_dequeue(p.cap, frame.capture);
+        perf_enter(outer);
+        if (!dequeued) {
+            p.capture_failed = true;
+            break;
+        }
+        frame.captured_ns = monotonic_ns();
+        record(p.stats.capture, frame.captured_ns - start);
+        perf_count_frame(PERF_CAPTURE);
+
+        bool admitted = pacer_admit(pacer, capture_timestamp_ns(frame.capture));
+        frame.scale = p.config.control ? p.config.control->scale.load() : 1;
+        bool heartbeat = false;
+        if (admitted && p.gating && !gate_frame(p, frame, heartbeat)) {
+            p.stats.gate.suppressed.fetch_add(1, std::memory_order_relaxed);
+            admitted = false;
+        }
+
+        if (!admitted) {
+            capture_requeue(p.cap, frame.capture);
+        } else {
+            bool requested = false;
+            if (p.tiles) plan_tiles(p, frame, heartbeat, requested);
+
+            // Drop the new frame rather than queue it behind busy encoders.
+            sample(p.stats.encode_q, p.encode_q.size());
+            frame.seq = seq;
+            if (p.encode_q.try_push(frame)) {
+                seq++;
+                // The buffer stays ours to read until a worker releases it (release_capture).
+                if (p.gating) commit_gate(p, frame, heartbeat);
+                if (p.tiles) commit_tiles(p, frame, requested);
+            } else {
+                p.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                capture_requeue(p.cap, frame.capture);
+            }
+        }
+
+        if (p.config.report_every && p.cap.stats.frames % p.config.report_every == 0) {
+            capture_report(p.cap);
+            pacer_report(pacer);
+            if (p.gating) gate_report(p.stats.gate);
+        }
+    }
+
+    perf_thread_stop();
+    p.stop = true;
+    p.encode_q.close();
+}
+
+// Hands a capture buffer back: USERPTR buffers go straight to the capture
+// pool, driver buffers to the capture thread for requeueing.
+static void release_capture(Pipeline& p, const CaptureFrame& capture) {
+    if (capture_owns_frames(p.cap)) capture_requeue(p.cap, capture);
+    else p.release_q.try_push(capture);
+}
+
+// Hands a finished frame's buffer back to the pool or, for passthrough
+// frames, to the capture thread.
+static void release_frame(Pipeline& p, const PipelineFrame& frame) {
+    if (frame.passthrough) release_capture(p, frame.capture);
+    else frame_pool_release(p.pool, frame.jpeg);
+}
+
+static void passthrough_mjpeg(Pipeline& p, PipelineFrame& frame) {
+    const unsigned char* data = frame.capture.data;
+    size_t size = frame.capture.bytesused;
+
+    if (mjpeg_has_dht(data, size)) {
+        // Only read from here on; the buffer is owned by the ring until requeued.
+        frame.jpeg = const_cast<unsigned char*>(data);
+        frame.jpeg_size = size;
+        frame.passthrough = true;
+        return;
+    }
+
+    frame.jpeg = frame_pool_acquire(p.pool);
+    frame.jpeg_size = 0;
+    if (frame.jpeg) frame.jpeg_size = mjpeg_insert_dht(data, size, frame.jpeg, p.pool.buffer_size);
+    release_capture(p, frame.capture);
+}
+
+static void scaled_size(const Pipeline& p, int scale, int& width, int& height) {
+    width = scale == 2 ? p.cap.width / 2 & ~1 : p.cap.width;
+    height = p.cap.height / scale;
+}
+
+static void init_encoder(Pipeline& p, SliceEncoder& enc, int quality, int scale) {
+    int width, height;
+    scaled_size(p, scale, width, height);
+    slice_encoder_init(enc, width, height, quality, p.config.input, p.config.slices, &p.pool,
+                       p.config.backend);
+}
+
+// The H.264 bitrate follows the quality rate control picks, in proportion
+// to the configured pair.
+static int h264_bitrate(const Pipeline& p, int quality) {
+    return std::max(1, p.config.bitrate_kbps * quality / std::max(1, p.config.quality));
+}
+
+static bool init_h264(Pipeline& p, H264Encoder& enc, int quality, int scale) {
+    int width, height;
+    scaled_size(p, scale, width, height);
+    double fps = p.config.control ? p.config.control->fps.load() : p.config.fps;
+    return h264_encoder_init(enc, width, height, fps, h264_bitrate(p, quality), p.config.gop);
+}
+
+// Retunes or rebuilds the encoder when rate control changed the quality or
+// picture size since the last frame. The size comes with the frame, so it
+// matches what the capture thread diffed.
+static void follow_control(Pipeline& p, SliceEncoder& enc, JpegEncoder* mosaic_enc, int& quality, int& scale,
+                           int want_scale) {
+    int want_quality = p.config.control->quality.load();
+    if (want_scale != scale) {
+        slice_encoder_destroy(enc);
+        init_encoder(p, enc, want_quality, want_scale);
+    } else if (want_quality != quality) {
+        slice_encoder_set_quality(enc, want_quality);
+    }
+    if (mosaic_enc && want_quality != quality) jpeg_encoder_set_quality(*mosaic_enc, want_quality);
+    quality = want_quality;
+    scale = want_scale;
+}
+
+// H.264 under rate control: a new picture size needs a new encoder, which
+// starts with an IDR frame; a new quality only changes the bitrate. If the
+// new encoder cannot be set up the old one stays, at the old size, and
+// that size is not tried again until rate control picks another
+// (refused_scale).
+static void follow_h264(Pipeline& p, H264Encoder& enc, int& quality, int& scale, int& refused_scale,
+                        int want_scale) {
+    int want_quality = p.config.control->quality.load();
+    if (want_scale != scale && want_scale != refused_scale) {
+        H264Encoder next;
+        if (init_h264(p, next, want_quality, want_scale)) {
+            h264_encoder_destroy(enc);
+            enc = std::move(next);
+            scale = want_scale;
+            refused_scale = 0;
+        } else {
+            refused_scale = want_scale;
+        }
+    } else if (want_scale == scale) {
+        refused_scale = 0;
+    }
+    if (want_quality != quality) {
+        h264_encoder_set_bitrate(enc, h264_bitrate(p, want_quality));
+    }
+    quality = want_quality;
+}
+
+// Keyframe requests become IDR frames, at most every KEYFRAME_REQUEST_GAP_NS
+// (key_request_ns: when the last forced one was encoded). A frame the
+// encoder skips or fails on comes back empty and is dropped; after a
+// failure the encoder makes the next frame an IDR frame itself.
+static size_t encode_h264(Pipeline& p, H264Encoder& enc, PipelineFrame& frame, const unsigned char* src,
+                          uint64_t& key_request_ns) {
+    PipelineControl* control = p.config.control;
+    bool force = control && control->keyframe.load() && frame.captured_ns - key_request_ns >= KEYFRAME_REQUEST_GAP_NS;
+    bool idr, skipped;
+    size_t size = h264_encode_yuyv(enc, src, force, frame.jpeg, p.pool.buffer_size, idr, skipped);
+    if (force) key_request_ns = frame.captured_ns;
+    // Any IDR frame answers a pending request.
+    if (idr && control) control->keyframe = false;
+    frame.delta = !idr;
+    return size;
+}
+
+// A delta frame: header and tile map, then the changed tiles as one JPEG.
+static size_t encode_tiles(Pipeline& p, JpegEncoder& enc, std::vector<unsigned char>& mosaic,
+                           const PipelineFrame& frame, unsigned char* out) {
+    int width = p.cap.width, height = p.cap.height;
+    size_t header = tile_delta_header_size(width, height);
+    tile_delta_write_header(out, width, height, frame.tile_map.data(), frame.changed_tiles);
+    if (!frame.changed_tiles) return header;
+
+    PerfStage outer = perf_enter(PERF_CONVERT);
+    tile_delta_gather(frame.capture.data, width, height, frame.tile_map.data(), mosaic.data());
+    perf_enter(outer);
+    jpeg_encoder_set_height(enc, tile_mosaic_height(width, frame.changed_tiles));
+    size_t size = jpeg_encode_yuyv(enc, mosaic.data(), out + header, p.pool.buffer_size - header);
+    return size ? header + size : 0;  // a failed encode drops the frame
+}
+
+static void encode_loop(Pipeline& p) {
+    // First, so the slice encoder's helpers report to the same monitor.
+    perf_thread_start(p.perf_monitor);
+    SliceEncoder enc;
+    int quality = p.config.control ? p.config.control->quality.load() : p.config.quality;
+    int scale = p.config.control ? p.config.control->scale.load() : 1;
+    std::vector<unsigned char> half;  // downscaled frame when scale is 2
+    H264Encoder h264;
+    uint64_t key_request_ns = 0;
+    int refused_scale = 0;  // H.264: picture size the encoder could not be rebuilt for
+    if (p.h264 && !init_h264(p, h264, quality, scale)) {
+        // Nothing can be sent; the frames already queued are released below.
+        p.encoder_failed = true;
+        p.stop = true;
+    } else if (!p.h264 && !p.cap.mjpeg) {
+        init_encoder(p, enc, quality, scale);
+    }
+
+    // Tile deltas: the changed tiles, packed, and their own encoder
+    JpegEncoder mosaic_enc;
+    std::vector<unsigned char> mosaic;
+    if (p.tiles) {
+        jpeg_encoder_init(mosaic_enc, p.cap.width, p.cap.height, quality, p.config.input, &p.pool, p.config.backend);
+        mosaic.resize((size_t)p.cap.width * p.cap.height * 2);
+    }
+
+    PipelineFrame frame;
+    while (p.encode_q.pop_wait(frame)) {
+        if (p.stop.load()) {
+            release_capture(p, frame.capture);
+            continue;
+        }
+
+        uint64_t start = monotonic_ns();
+        PerfStage outer = perf_enter(PERF_ENCODE);
+        if (p.cap.mjpeg) {
+            passthrough_mjpeg(p, frame);
+        } else {
+            if (p.config.control && p.h264) follow_h264(p, h264, quality, scale, refused_scale, frame.scale);
+            else if (p.config.control) follow_control(p, enc, p.tiles ? &mosaic_enc : nullptr, quality, scale, frame.scale);
+            const unsigned char* src = frame.capture.data;
+            if (scale == 2) {
+                int width, height;
+                scaled_size(p, scale, width, height);
+                half.resize((size_t)width * height * 2);
+                perf_enter(PERF_CONVERT);
+                yuyv_downscale_half(src, p.cap.width, p.cap.height, half.data());
+                perf_enter(PERF_ENCODE);
+                src = half.data();
+            }
+
+            frame.jpeg = frame_pool_acquire(p.pool);
+            frame.jpeg_size = 0;
+            if (frame.jpeg && p.h264) frame.jpeg_size = encode_h264(p, h264, frame, src, key_request_ns);
+            else if (frame.jpeg && frame.delta) frame.jpeg_size = encode_tiles(p, mosaic_enc, mosaic, frame, frame.jpeg);
+            else if (frame.jpeg) frame.jpeg_size = slice_encode_yuyv(enc, src, frame.jpeg, p.pool.buffer_size);
+            release_capture(p, frame.capture);
+            perf_count_frame(PERF_CONVERT);
+        }
+        perf_enter(outer);
+        perf_count_frame(PERF_ENCODE);
+        uint64_t encode_ns = monotonic_ns() - start;
+        record(p.stats.encode, encode_ns);
+        if (p.gating) record(p.stats.gate.encoded, encode_ns);
+
+        sample(p.stats.send_q, p.send_q.size());
+        if (!p.send_q.push_wait(frame)) release_frame(p, frame);
+    }
+
+    slice_encoder_destroy(enc);
+    h264_encoder_destroy(h264);
+    if (p.tiles) jpeg_encoder_destroy(mosaic_enc);
+    perf_thread_stop();
+    if (p.active_workers.fetch_sub(1) == 1) p.send_q.close();
+}
+
+static bool later(const PipelineFrame& a, const PipelineFrame& b) {
+    return a.seq > b.seq;
+}
+
+// Reorders by seq (min-heap) and sends on the calling thread.
+static void send_loop(Pipeline& p, const SendFrameFn& send_frame) {
+    std::vector<PipelineFrame> pending;
+    pending.reserve(64);
+    uint64_t next = 0;
+    uint64_t sent = 0;
+
+    PipelineFrame frame;
+    while (p.send_q.pop_wait(frame)) {
+        if (p.stop.load()) {
+            release_frame(p, frame);
+            continue;
+        }
+
+        pending.push_back(frame);
+        std::push_heap(pending.begin(), pending.end(), later);
+
+        while (!pending.empty() && pending.front().seq == next) {
+            std::pop_heap(pending.begin(), pending.end(), later);
+            PipelineFrame out = pending.back();
+            pending.pop_back();
+            next++;
+
+            if (!out.jpeg || !out.jpeg_size) {
+                // Nothing to send (no pool buffer, or the encoder gave up on
+                // the frame): drop it and keep going. Later tile deltas were
+                // diffed against it, so ask for a keyframe; the H.264
+                // encoder looks after its own references (encode_h264).
+                release_frame(p, out);
+                p.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                if (p.tiles && p.config.control) p.config.control->keyframe = true;
+                continue;
+            }
+
+            uint64_t start = monotonic_ns();
+            PerfStage outer = perf_enter(PERF_SEND);
+            bool ok = send_frame(out);
+            perf_enter(outer);
+            release_frame(p, out);
+            record(p.stats.send, monotonic_ns() - start);
+            if (ok) perf_count_frame(PERF_SEND);
+
+            if (!ok) {
+                p.stop = true;
+                break;
+            }
+            if (p.config.report_every && ++sent % p.config.report_every == 0) {
+                pipeline_report(p.stats);
+                frame_pool_report(p.pool);
+                if (p.perf_monitor) perf_report(*p.perf_monitor);
+            }
+        }
+    }
+
+    for (auto& f : pending) release_frame(p, f);
+}
+
+// MJPEG frames only need room for the frame plus the inserted tables.
+// Encoded frames share the pool with the RGB conversion targets; an H.264
+// frame, even an IDR one, stays well below that.
+static size_t frame_capacity(const Capture& cap, const PipelineConfig& config, size_t* slices) {
+    *slices = 0;
+    if (cap.mjpeg) return cap.frame_size + mjpeg_dht_size();
+    if (config.codec == VideoCodec::H264) return (size_t)cap.width * cap.height * 3;
+
+    SliceEncoder probe;
+    if (!slice_encoder_init(probe, cap.width, cap.height, config.quality, config.input, config.slices, nullptr,
+                            config.backend)) {
+        return 0;
+    }
+    size_t size = std::max(slice_encoder_bound(probe), (size_t)cap.width * cap.height * 3);
+    *slices = probe.bands.size();
+    slice_encoder_destroy(probe);
+    return size;
+}
+
+size_t pipeline_frame_capacity(const Capture& cap, const PipelineConfig& config) {
+    size_t slices;
+    return frame_capacity(cap, config, &slices);
+}
+
+bool pipeline_run(Capture& cap, const PipelineConfig& config, const SendFrameFn& send_frame) {
+    Pipeline p(cap, config);
+    if (p.h264 && cap.mjpeg) {
+        std::cerr << "H.264 needs YUYV capture; MJPEG frames are only passed through\n";
+        return false;
+    }
+    if (p.h264 && config.workers > 1) std::cerr << "H.264 encodes on one worker\n";
+
+    // Each worker holds an RGB target per slice and an output buffer, plus
+    // one output buffer per slot of the send queue and the reorder stage.
+    size_t slices;
+    size_t buffer_size = frame_capacity(cap, config, &slices);
+    if (!buffer_size) return false;
+    size_t count = p.workers * (slices + 1) + p.send_q.capacity() + 2;
+    if (!frame_pool_init(p.pool, buffer_size, count, config.huge_pages)) return false;
+
+    if (config.tile_deltas && p.h264) {
+        std::cerr << "Tile deltas do not apply to H.264; P-frames take their place\n";
+    } else if (config.tile_deltas && !cap.mjpeg) {
+        p.tiles = tile_diff_init(p.diff, cap.width, cap.height, config.tile_threshold);
+        if (p.tiles) p.stats.tiles.tiles_per_frame = tile_count_x(cap.width) * tile_count_y(cap.height);
+        else std::cerr << "Tile deltas need a frame size in whole 16x16 tiles; sending whole frames\n";
+    }
+    if (config.gate_threshold > 0 && !cap.mjpeg) {
+        frame_gate_init(p.gate, cap.width, cap.height, config.gate_threshold);
+        p.gating = p.stats.gate.enabled = true;
+    }
+
+    if (config.perf_json && perf_monitor_init(p.perf, config.perf_json)) p.perf_monitor = &p.perf;
+    perf_thread_start(p.perf_monitor);  // the sender
+
+    p.active_workers = p.workers;
+    std::thread capture_thread(capture_loop, std::ref(p));
+    std::vector<std::thread> workers;
+    for (int i = 0; i < p.workers; ++i) workers.emplace_back(encode_loop, std::ref(p));
+
+    send_loop(p, send_frame);
+
+    // Unblock the capture thread if it is waiting for a buffer to return.
+    p.stop = true;
+    p.release_q.close();
+    capture_thread.join();
+    for (auto& w : workers) w.join();
+
+    CaptureFrame done;
+    while (p.release_q.try_pop(done)) capture_requeue(cap, done);
+
+    pipeline_report(p.stats);
+    if (p.gating) gate_report(p.stats.gate);
+    frame_pool_report(p.pool);
+    frame_pool_destroy(p.pool);
+    perf_thread_stop();
+    if (p.perf_monitor) {
+        perf_report(*p.perf_monitor);
+        perf_monitor_close(*p.perf_monitor);
+    }
+    return !p.capture_failed && !p.encoder_failed;
+}
+
+static double take_ms_per_frame(StageStats& stage) {
+    uint64_t frames = stage.frames.exchange(0);
+    uint64_t ns = stage.busy_ns.exchange(0);
+    return frames ? ns / 1e6 / frames : 0.0;
+}
+
+void gate_report(GateStats& gate) {
+    double check_ms = take_ms_per_frame(gate.check);
+    double encode_ms = take_ms_per_frame(gate.encoded);
+    uint64_t passed = gate.passed.exchange(0);
+    uint64_t suppressed = gate.suppressed.exchange(0);
+    uint64_t heartbeats = gate.heartbeats.exchange(0);
+    uint64_t checked = passed + suppressed;
+
+    // Each suppressed frame saves an encode at the cost of the frames just
+    // encoded; every checked frame paid for the check.
+    double saved_ms = suppressed * encode_ms - checked * check_ms;
+    printf("gate: check %.3f ms/frame, suppressed %lu of %lu frames (%.1f%%), %lu heartbeats, "
+           "saved ~%.0f ms CPU (%.0f%% of encoding every frame)\n",
+           check_ms, (unsigned long)suppressed, (unsigned long)checked, checked ? 100.0 * suppressed / checked : 0.0,
+           (unsigned long)heartbeats, saved_ms, checked && encode_ms > 0 ? 100.0 * saved_ms / (checked * encode_ms) : 0.0);
+    fflush(stdout);
+}
+
+static void print_queue(const char* name, QueueStats& q) {
+    uint64_t samples = q.samples.exchange(0);
+    uint64_t occupancy = q.occupancy.exchange(0);
+    uint32_t max = q.max.exchange(0);
+    printf(" %s avg %.2f max %u/%zu", name, samples ? (double)occupancy / samples : 0.0, max, q.capacity);
+}
+
+void pipeline_report(PipelineStats& stats) {
+    printf("pipeline: capture %.2f ms/frame, encode %.2f ms/frame, send %.2f ms/frame;",
+           take_ms_per_frame(stats.capture), take_ms_per_frame(stats.encode), take_ms_per_frame(stats.send));
+    print_queue("encode_q", stats.encode_q);
+    print_queue("send_q", stats.send_q);
+    printf(" dropped %lu\n", (unsigned long)stats.dropped.load());
+
+    TileStats& tiles = stats.tiles;
+    if (tiles.tiles_per_frame) {
+        double diff_ms = take_ms_per_frame(tiles.diff);
+        uint64_t keyframes = tiles.keyframes.exchange(0);
+        uint64_t deltas = tiles.deltas.exchange(0);
+        uint64_t changed = tiles.changed_tiles.exchange(0);
+        printf("tiles: diff %.3f ms/frame (%s), %lu keyframes, %lu deltas with %.1f%% of tiles changed\n", diff_ms,
+               tile_sad_path(), (unsigned long)keyframes, (unsigned long)deltas,
+               deltas ? 100.0 * changed / (deltas * tiles.tiles_per_frame) : 0.0);
+    }
+    fflush(stdout);
+}
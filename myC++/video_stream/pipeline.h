@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "capture.h"
+#include "frame_gate.h"
+#include "frame_pool.h"
+#include "h264_encoder.h"
+#include "jpeg_encoder.h"
+#include "slice_encoder.h"
+#include "tile_delta.h"
+
+// Capture -> encode -> send engine used by both streamers.
+//
+//   capture thread --encode_q--> N encode workers --send_q--> sender
+//        ^                              |
+//        +---------- release_q ---------+   (capture buffers to requeue)
+//
+// Only the capture thread touches the V4L2 ring; workers hand finished
+// capture buffers back through release_q, or straight to the capture pool
+// when the driver fills our own buffers (USERPTR, capture.h). When the
+// encoders fall behind the capture thread drops the newest frame instead of
+// queueing it, so latency stays bounded. Workers finish out of order, so
+// the sender reorders by sequence number before calling send_frame, keeping
+// frame order on the wire.
+//
+// When the camera delivers MJPEG the workers only check each frame for
+// Huffman tables: complete frames are sent straight from the capture buffer,
+// which the sender hands back through release_q; frames without a DHT are
+// copied into a pool buffer with the standard tables inserted.
+//
+// With tile deltas (PipelineConfig::tile_deltas, tile_delta.h) the capture
+// thread, which sees every frame in order, compares each frame with the
+// reference and gives it a tile map; workers then encode only the changed
+// tiles. The reference follows the frames accepted into encode_q. A frame
+// is sent whole (a keyframe) when there is no reference yet, every
+// keyframe_interval frames, when more than three quarters of the tiles
+// changed, at half size, and when a sender asks for one through
+// PipelineControl::keyframe (a viewer joined or missed a delta).
+//
+// With the frame gate (PipelineConfig::gate_threshold, frame_gate.h) the
+// capture thread hands a frame to the encoders only when it differs from the
+// last one sent, when heartbeat_ms passed without one, when the picture size
+// changed or when a sender asks for a keyframe. Suppressed frames go straight
+// back to the driver. A heartbeat is a keyframe when tile deltas are on.
+//
+// With VideoCodec::H264 (h264_encoder.h) a single worker runs one H.264
+// encoder, which must see every frame in order; P-frames are marked as
+// deltas, and keyframe requests force an IDR frame. Tile deltas and slices
+// do not apply, and MJPEG capture cannot be encoded to H.264.
+//
+// With PipelineConfig::perf_json every pipeline thread counts cycles,
+// instructions, cache misses and time per stage (perf_counters.h), and the
+// per-frame averages are appended to that file with each report.
+
+struct PipelineFrame {
+    uint64_t seq;           // assigned to frames accepted into the pipeline
+    CaptureFrame capture;
+    unsigned char* jpeg;    // from the pool (an H.264 access unit with VideoCodec::H264); released after send_frame
+    size_t jpeg_size;
+    bool passthrough;       // jpeg is the capture buffer itself, requeued after send_frame
+    uint64_t captured_ns;   // CLOCK_MONOTONIC when dequeued
+    int scale;              // 1 or 2, from PipelineControl at capture
+    bool delta;             // changed tiles only (tile_delta.h) or an H.264 P-frame; otherwise stands alone
+    int changed_tiles;
+    std::vector<uint8_t> tile_map;
+};
+
+// Settings a sender may change while the pipeline runs (rate control). The
+// capture thread picks up fps and scale before each frame and the workers
+// pick up quality before each encode; MJPEG passthrough only honours fps.
+struct PipelineControl {
+    std::atomic<int> quality{75};
+    std::atomic<int> scale{1};       // 1: full size, 2: half width and height
+    std::atomic<double> fps{0};
+    std::atomic<bool> keyframe{false};  // tile deltas, H.264: send the next frame whole
+};
+
+struct PipelineConfig {
+    int workers = 2;
+    int slices = 1;             // bands per frame, each on its own thread
+    int quality = 75;
+    JpegInput input = JpegInput::Yuv;
+    JpegBackend backend = JpegBackend::Libjpeg;
+    VideoCodec codec = VideoCodec::Jpeg;
+    int gop = 60;               // H.264: frames between IDR frames (0: only when asked for)
+    int bitrate_kbps = 2000;    // H.264 target; rate control scales it with the quality it picks
+    bool huge_pages = false;
+    double fps = 0;             // target frame rate (0: every frame the source delivers)
+    int report_every = 300;     // frames between stats reports (0: never)
+    PipelineControl* control = nullptr;  // overrides quality and fps when set
+    bool tile_deltas = false;   // send changed 16x16 tiles between keyframes
+    int keyframe_interval = 0;  // frames between keyframes (0: only when asked for)
+    uint32_t tile_threshold = 1024;  // tile SAD counted as a change
+    int gate_threshold = 0;     // block mean luma change that lets a frame through (0: no gate)
+    int heartbeat_ms = 1000;    // gate: longest time without a frame
+    const char* perf_json = nullptr;  // per-stage counters as JSON lines ("-": stdout)
+};
+
+struct StageStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> busy_ns{0};
+};
+
+struct QueueStats {
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> occupancy{0};  // summed over samples
+    std::atomic<uint32_t> max{0};
+    size_t capacity = 0;
+};
+
+struct TileStats {
+    StageStats diff;                        // tile comparison, capture thread
+    std::atomic<uint64_t> keyframes{0};
+    std::atomic<uint64_t> deltas{0};
+    std::atomic<uint64_t> changed_tiles{0};  // summed over deltas
+    int tiles_per_frame = 0;
+};
+
+struct GateStats {
+    StageStats check;                        // signature and comparison, capture thread
+    StageStats encoded;                      // encodes since the last gate report, for the savings
+    std::atomic<uint64_t> passed{0};
+    std::atomic<uint64_t> suppressed{0};
+    std::atomic<uint64_t> heartbeats{0};     // passed only because of heartbeat_ms
+    bool enabled = false;
+};
+
+struct PipelineStats {
+    StageStats capture, encode, send;
+    QueueStats encode_q, send_q;
+    std::atomic<uint64_t> dropped{0};  // frames dropped: encode_q was full, or nothing came out of the encoder
+    TileStats tiles;
+    GateStats gate;
+};
+
+// Returns false to stop the pipeline (e.g. the peer went away).
+typedef std::function<bool(const PipelineFrame&)> SendFrameFn;
+
+// Runs until send_frame returns false or capture fails. The sender runs on
+// the calling thread.
+bool pipeline_run(Capture& cap, const PipelineConfig& config, const SendFrameFn& send_frame);
+
+// Upper bound on PipelineFrame::jpeg_size for this capture and config.
+size_t pipeline_frame_capacity(const Capture& cap, const PipelineConfig& config);
+
+void pipeline_report(PipelineStats& stats);
+
+// Suppression rate and estimated CPU saved since the last call; printed with
+// the capture report, as suppressed frames never reach the sender.
+void gate_report(GateStats& gate);
@@ -0,0 +1,126 @@
+#include "rate_control.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static const double LOSS_CONGESTED = 0.05;
+static const double LOSS_CLEAN = 0.01;
+static const uint32_t JITTER_CONGESTED_US = 20000;
+static const double HEADROOM = 0.85;
+static const double PROBE_GAIN = 1.05;
+static const uint64_t HOLD_MS = 1000;
+static const uint64_t DRAIN_MS = 750;     // reports this soon after a step down still describe the old level
+static const uint64_t BACKOFF_MIN_MS = 2000;
+static const uint64_t BACKOFF_MAX_MS = 32000;
+static const uint64_t SETTLED_MS = 5000;  // a level that lasted this long resets its backoff
+
+// Rough relative size of a frame stream at a level: bytes per frame grow
+// about linearly with quality in the 30..90 range, and a half-size picture
+// takes about a third of the bytes.
+static double level_cost(const RateLevel& l) {
+    return l.fps * (l.scale == 2 ? 0.33 : 1.0) * (0.3 + l.quality / 100.0);
+}
+
+static void apply_level(RateControl& rc) {
+    const RateLevel& l = rc.levels[rc.level];
+    rc.control->quality = l.quality;
+    rc.control->scale = l.scale;
+    rc.control->fps = l.fps;
+}
+
+void rate_control_init(RateControl& rc, PipelineControl& control, int quality, double fps, bool passthrough,
+                       int width, int height) {
+    rc.control = &control;
+    rc.width = width;
+    rc.height = height;
+
+    // A source without a target rate is laddered as if it ran at 30 fps,
+    // the top level included, so every level has a nonzero cost.
+    double top_fps = fps > 0 ? fps : 30;
+    rc.levels.push_back(RateLevel{ quality, 1, top_fps });
+    if (!passthrough) {
+        for (int q : { 60, 45, 30 }) {
+            if (q < quality) rc.levels.push_back(RateLevel{ q, 1, top_fps });
+        }
+        rc.levels.push_back(RateLevel{ rc.levels.back().quality, 1, top_fps * 2 / 3 });
+        rc.levels.push_back(RateLevel{ 50, 2, top_fps });
+        rc.levels.push_back(RateLevel{ 30, 2, top_fps });
+    }
+    int last_quality = rc.levels.back().quality;
+    int last_scale = rc.levels.back().scale;
+    for (double f : { top_fps * 2 / 3, top_fps / 2, top_fps / 3, top_fps / 6 }) {
+        rc.levels.push_back(RateLevel{ last_quality, last_scale, f });
+    }
+    rc.level_bps.assign(rc.levels.size(), 0.0);
+    rc.backoff_ms.assign(rc.levels.size(), 0);
+    rc.retry_ms.assign(rc.levels.size(), 0);
+    apply_level(rc);
+}
+
+void rate_control_on_sent(RateControl& rc, size_t bytes, uint64_t now_ms) {
+    std::lock_guard<std::mutex> guard(rc.lock);
+    if (!rc.period_start_ms) rc.period_start_ms = now_ms;
+    rc.sent_bytes += bytes;
+}
+
+static double estimate_bps(const RateControl& rc, size_t level, double current_bps) {
+    if (rc.level_bps[level] > 0) return rc.level_bps[level];
+    return current_bps * level_cost(rc.levels[level]) / level_cost(rc.levels[rc.level]);
+}
+
+void rate_control_on_report(RateControl& rc, const UdpReport& report, uint64_t now_ms) {
+    std::lock_guard<std::mutex> guard(rc.lock);
+    if (!rc.period_start_ms || now_ms <= rc.period_start_ms) return;
+
+    // What the current level costs, from the bytes sent since the last report.
+    double sent_bps = rc.sent_bytes * 8000.0 / (now_ms - rc.period_start_ms);
+    if (!rc.level_changed && sent_bps > 0) {
+        double& m = rc.level_bps[rc.level];
+        m = m > 0 ? 0.7 * m + 0.3 * sent_bps : sent_bps;
+    }
+    double current_bps = rc.level_bps[rc.level] > 0 ? rc.level_bps[rc.level] : sent_bps;
+    rc.sent_bytes = 0;
+    rc.period_start_ms = now_ms;
+    rc.level_changed = false;
+
+    double goodput_bps = report.goodput * 8.0;
+    bool congested = report.loss > LOSS_CONGESTED || report.jitter_us > JITTER_CONGESTED_US;
+    if (congested) {
+        rc.capacity_bps = goodput_bps;
+    } else if (report.loss < LOSS_CLEAN && rc.capacity_bps > 0) {
+        rc.capacity_bps = std::max(rc.capacity_bps, goodput_bps) * PROBE_GAIN;
+    }
+
+    size_t next = rc.level;
+    double target = rc.capacity_bps * HEADROOM;
+    if (congested) {
+        if (now_ms < rc.drain_until_ms) return;
+        // At least one step down, further while the estimate does not fit.
+        if (next + 1 < rc.levels.size()) next++;
+        while (next + 1 < rc.levels.size() && estimate_bps(rc, next, current_bps) > target) next++;
+    } else if (report.loss < LOSS_CLEAN && now_ms >= rc.hold_until_ms && rc.level > 0 &&
+               now_ms >= rc.retry_ms[rc.level - 1] && estimate_bps(rc, rc.level - 1, current_bps) <= target) {
+        next = rc.level - 1;
+    }
+    if (next == rc.level) return;
+
+    if (next > rc.level) {
+        rc.drain_until_ms = now_ms + DRAIN_MS;
+        uint64_t& backoff = rc.backoff_ms[rc.level];
+        if (now_ms - rc.entered_ms >= SETTLED_MS) backoff = BACKOFF_MIN_MS;
+        else backoff = std::min(std::max(backoff * 2, BACKOFF_MIN_MS), BACKOFF_MAX_MS);
+        rc.retry_ms[rc.level] = now_ms + backoff;
+    }
+    rc.level = next;
+    rc.entered_ms = now_ms;
+    rc.level_changed = true;
+    rc.hold_until_ms = now_ms + HOLD_MS;
+    apply_level(rc);
+
+    const RateLevel& l = rc.levels[next];
+    printf("rate: loss %.1f%%, jitter %.1f ms, goodput %.2f Mb/s, sent %.2f Mb/s, capacity ~%.2f Mb/s -> "
+           "q%d %dx%d %.0f fps\n",
+           report.loss * 100, report.jitter_us / 1000.0, goodput_bps / 1e6, sent_bps / 1e6, rc.capacity_bps / 1e6,
+           l.quality, rc.width / l.scale, rc.height / l.scale, l.fps);
+    fflush(stdout);
+}
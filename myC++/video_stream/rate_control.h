@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "pipeline.h"
+#include "udp_protocol.h"
+
+// Closed-loop rate control for the UDP streamer, driven by receiver reports
+// (udp_feedback.h).
+//
+// The encoder settings form a ladder of levels, best first: JPEG quality
+// steps down at full size, then the frame rate drops by a third, then the
+// picture is halved, then the frame rate drops further. MJPEG passthrough
+// can only change the frame rate. The controller keeps a capacity estimate
+// and picks the best level whose send rate fits in 85% of it:
+//
+//   - congestion (loss over 5% or jitter over 20 ms): the capacity is what
+//     actually got through, the goodput, and the controller drops as many
+//     levels as needed at once
+//   - clean reports (loss under 1%): the estimate grows 5% per report and
+//     the controller climbs one level at a time, at most once a second
+//
+// A level's send rate is measured while it is in use; levels not yet tried
+// are extrapolated from the current one with a rough size model. A level
+// that congests soon after being entered is not tried again for a backoff
+// that doubles each time (2 s up to 32 s), so a link just below a level's
+// rate is probed rarely instead of every few seconds.
+
+struct RateLevel {
+    int quality;
+    int scale;   // 1 or 2
+    double fps;
+};
+
+struct RateControl {
+    std::vector<RateLevel> levels;
+    std::vector<double> level_bps;  // measured send rate, 0 until used
+    std::vector<uint64_t> backoff_ms;
+    std::vector<uint64_t> retry_ms; // earliest time to climb back to a level
+    size_t level = 0;
+    uint64_t entered_ms = 0;        // when the current level was applied
+    double capacity_bps = 0;        // 0: unknown, no reason to step down yet
+    uint64_t hold_until_ms = 0;     // no climbing before
+    uint64_t drain_until_ms = 0;    // no further step down before
+
+    // Send rate over the current report period
+    uint64_t sent_bytes = 0;
+    uint64_t period_start_ms = 0;
+    bool level_changed = false;
+
+    PipelineControl* control = nullptr;
+    int width = 0, height = 0;      // full picture size, for the trace
+    std::mutex lock;
+};
+
+// Builds the ladder from the configured (best) quality and frame rate and
+// applies its top level to control. fps <= 0 ladders from 30 fps.
+void rate_control_init(RateControl& rc, PipelineControl& control, int quality, double fps, bool passthrough,
+                       int width, int height);
+
+// Called by the send path for every frame.
+void rate_control_on_sent(RateControl& rc, size_t bytes, uint64_t now_ms);
+
+// Called for every receiver report; prints a trace line when the level changes.
+void rate_control_on_report(RateControl& rc, const UdpReport& report, uint64_t now_ms);
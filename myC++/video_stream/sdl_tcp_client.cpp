@@ -5,9 +5,11 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
-#include <jpeglib.h>
 #include <SDL2/SDL.h>
 
+#include "latency.h"
+#include "sdl_view.h"
+
 bool recv_all(int sock, void* buf, size_t len) {
     size_t received = 0;
     while (received < len) {
@@ -18,31 +20,6 @@ bool recv_all(int sock, void* buf, size_t len) {
     return true;
 }
 
-unsigned char* decode_jpeg(const unsigned char* jpeg_data, unsigned long jpeg_size, int& width, int& height) {
-    jpeg_decompress_struct cinfo;
-    jpeg_error_mgr jerr;
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
-    jpeg_mem_src(&cinfo, jpeg_data, jpeg_size);
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
-
-    width = cinfo.output_width;
-    height = cinfo.output_height;
-    int row_stride = width * cinfo.output_components;
-
-    unsigned char* buffer = new unsigned char[width * height * 3];
-    while (cinfo.output_scanline < cinfo.output_height) {
-        unsigned char* row = buffer + cinfo.output_scanline * row_stride;
-        jpeg_read_scanlines(&cinfo, &row, 1);
-    }
-
-    jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
-    return buffer;
-}
-
 int main() {
     const char* host = "127.0.0.1";
     const int port = 8080;
@@ -61,39 +38,50 @@ int main() {
 
     std::cout << "Connected to server\n";
 
+    // Stamped frames (v4l2_tcp_stream -t) are timed from capture to display;
+    // the clock exchange runs over UDP to the same port.
+    int clock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (clock_fd >= 0 && connect(clock_fd, (sockaddr*)&server, sizeof(server)) < 0) {
+        close(clock_fd);
+        clock_fd = -1;
+    }
+    ClockSync clock;
+    LatencyStats latency;
+    bool timed = false;  // a stamped frame came in; keep the clocks in sync
+
     // SDL Init
     SDL_Init(SDL_INIT_VIDEO);
     SDL_Window* window = SDL_CreateWindow("Video Stream", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 480, 0);
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    SDL_Texture* texture = nullptr;
+
+    // JPEGs, or keyframes and tile deltas (v4l2_tcp_stream -T); the server
+    // only sends a delta when every frame before it got here.
+    SdlView view;
+    view.renderer = renderer;
 
     while (true) {
+        // Clock replies are handled while idle until the next frame, never ahead of it
+        if (timed && clock_fd >= 0) clock_sync_wait(clock, clock_fd, sock);
         uint32_t jpeg_size_net;
         if (!recv_all(sock, &jpeg_size_net, 4)) break;
         uint32_t jpeg_size = ntohl(jpeg_size_net);
+        bool stamped = jpeg_size & LATENCY_STAMP_FLAG;
+        jpeg_size &= ~LATENCY_STAMP_FLAG;
+        unsigned char stamp[LATENCY_STAMP_SIZE];
+        if (stamped && !recv_all(sock, stamp, sizeof(stamp))) break;
 
         std::vector<unsigned char> jpeg_data(jpeg_size);
         if (!recv_all(sock, jpeg_data.data(), jpeg_size)) break;
 
-        int width = 0, height = 0;
-        unsigned char* rgb = decode_jpeg(jpeg_data.data(), jpeg_size, width, height);
-        if (!rgb) {
-            std::cerr << "Failed to decode JPEG\n";
-            continue;
+        view_show(view, jpeg_data.data(), jpeg_size);
+        if (stamped) {
+            uint32_t seq;
+            uint64_t capture_us;
+            latency_read_stamp(stamp, seq, capture_us);
+            latency_on_frame(latency, clock, seq, capture_us, latency_now_us());
+            timed = true;
         }
 
-        if (!texture || width != 640 || height != 480) {
-            if (texture) SDL_DestroyTexture(texture);
-            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, width, height);
-        }
-
-        SDL_UpdateTexture(texture, nullptr, rgb, width * 3);
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-        SDL_RenderPresent(renderer);
-
-        delete[] rgb;
-
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) goto cleanup;
@@ -101,11 +89,13 @@ int main() {
     }
 
 cleanup:
-    if (texture) SDL_DestroyTexture(texture);
+    latency_summary(latency, clock);
+    view_destroy(view);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     close(sock);
+    if (clock_fd >= 0) close(clock_fd);
     return 0;
 }
 
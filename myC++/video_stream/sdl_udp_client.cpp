@@ -1,39 +1,78 @@
 #include <iostream>
 #include <vector>
-#include <unordered_map>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
-#include <jpeglib.h>
 #include <SDL2/SDL.h>
 
+#include "latency.h"
+#include "sdl_view.h"
+#include "udp_feedback.h"
+#include "udp_reassembly.h"
+
 
 #define PORT 8080
 #define PACKET_SIZE 1400
 #define FRAME_TIMEOUT_MS 200
+#define POLL_INTERVAL_MS 5
+#define KEYFRAME_REQUEST_MS 200
+#define STAMP_SLOTS 64
+
+uint64_t current_time_us() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
 
-struct PacketHeader {
+// Capture times of stamped frames (v4l2_udp_stream -t), kept by frame_id
+// until the frame is shown.
+struct Stamp {
     uint32_t frame_id;
-    uint16_t total_parts;
-    uint16_t part_index;
+    uint64_t capture_us;
+    bool valid;
 };
 
-struct FrameBuffer {
-    std::vector<std::vector<uint8_t>> parts;
-    uint16_t total_parts;
-    uint32_t received_parts;
-    uint64_t last_update_time;
+struct FrameTiming {
+    Stamp stamps[STAMP_SLOTS] = {};
+    bool stamped = false;  // the sender stamps its frames
+    ClockSync clock;
+    LatencyStats stats;
 };
 
-uint64_t current_time_ms() {
-    timeval tv;
-    gettimeofday(&tv, nullptr);
-    return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+// Frames come out of the reassembler in order, but some never do. A gap
+// means a tile delta may be missing, so deltas stop applying until a
+// keyframe arrives. Returns false when the frame could not be applied.
+static bool show_frame(SdlView& view, const std::vector<uint8_t>& data, uint32_t frame_id, bool& have_id,
+                       uint32_t& last_id, FrameTiming& timing) {
+    if (have_id && frame_id != last_id + 1) view_lost(view);
+    have_id = true;
+    last_id = frame_id;
+    if (!view_show(view, data.data(), data.size())) return false;
+
+    const Stamp& stamp = timing.stamps[frame_id % STAMP_SLOTS];
+    if (stamp.valid && stamp.frame_id == frame_id) {
+        latency_on_frame(timing.stats, timing.clock, frame_id, stamp.capture_us, latency_now_us());
+    }
+    return true;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // -R ms: ask the streamer (v4l2_udp_stream -R) to resend lost chunks, and
+    // hold newer frames back for up to ms while a frame is repaired.
+    uint32_t repair_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "R:")) != -1) {
+        if (opt != 'R') {
+            std::cerr << "Usage: " << argv[0] << " [-R repair_ms]\n";
+            return 1;
+        }
+        repair_ms = atoi(optarg);
+    }
+
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) { perror("socket"); return 1; }
 
@@ -47,6 +86,10 @@ int main() {
         return 1;
     }
 
+    // Wake up regularly to send NACKs, release held frames and poll SDL.
+    timeval tv{ 0, POLL_INTERVAL_MS * 1000 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         std::cerr << "SDL_Init failed: " << SDL_GetError() << "\n";
         return 1;
@@ -54,89 +97,93 @@ int main() {
 
     SDL_Window* window = SDL_CreateWindow("UDP Video Client", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 480, 0);
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
-    SDL_Texture* texture = nullptr;
 
-    std::unordered_map<uint32_t, FrameBuffer> frame_map;
-
-    char buffer[PACKET_SIZE];
-    while (true) {
-        ssize_t len = recvfrom(sockfd, buffer, sizeof(buffer), 0, nullptr, nullptr);
-        if (len < 8) continue;
-
-        PacketHeader header;
-        memcpy(&header.frame_id, buffer, 4);
-        memcpy(&header.total_parts, buffer + 4, 2);
-        memcpy(&header.part_index, buffer + 6, 2);
+    // JPEGs, keyframes and tile deltas (v4l2_udp_stream -T), or H.264 (-c
+    // h264). A delta or P-frame that cannot be applied makes the client ask
+    // the sender for a keyframe. So does an abbreviated frame
+    // (v4l2_udp_stream -a) whose tables are missing, which makes the sender
+    // send them again.
+    SdlView view;
+    view.renderer = renderer;
+    bool have_id = false;
+    uint32_t last_id = 0;
+    bool want_key = false;
+    uint64_t key_request_ms = 0;
+    uint8_t key_request[UDP_KEYFRAME_REQUEST_SIZE];
+
+    // Chunks are collected per frame; lost chunks are rebuilt from parity
+    // packets when the sender adds them (-F), without waiting for the timeout.
+    Reassembler reassembler;
+    reassembler.timeout_ms = FRAME_TIMEOUT_MS;
+    reassembler.repair_ms = repair_ms;
+    std::vector<uint8_t> jpeg_data;
+    uint32_t frame_id;
+    std::vector<std::vector<uint8_t>> nacks;
 
-        header.frame_id = ntohl(header.frame_id);
-        header.total_parts = ntohs(header.total_parts);
-        header.part_index = ntohs(header.part_index);
+    // Loss, jitter and goodput go back to the sender twice a second; a
+    // streamer running with -A adapts its bitrate to them.
+    ReportBuilder reports;
+    uint8_t report[UDP_REPORT_SIZE];
 
-        auto& frame = frame_map[header.frame_id];
-        frame.last_update_time = current_time_ms();
+    // Stamped frames are timed from capture to display; the sender answers
+    // clock requests on the socket it sends from.
+    FrameTiming timing;
+    uint8_t clock_request[UDP_CLOCK_REQUEST_SIZE];
 
-        if (frame.parts.empty()) {
-            frame.parts.resize(header.total_parts);
-            frame.total_parts = header.total_parts;
-            frame.received_parts = 0;
+    sockaddr_in sender_addr{};
+    socklen_t sender_len = 0;
+    uint8_t buffer[PACKET_SIZE];
+    while (true) {
+        sockaddr_in from{};
+        socklen_t fromlen = sizeof(from);
+        ssize_t len = recvfrom(sockfd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromlen);
+        uint64_t now_us = current_time_us();
+        uint64_t now = now_us / 1000;
+
+        uint32_t stamp_id;
+        uint64_t capture_us;
+        uint16_t generation;
+        const uint8_t* tables;
+        size_t tables_size;
+        if (len >= 8 && udp_read_timestamp(buffer, len, stamp_id, capture_us)) {
+            timing.stamps[stamp_id % STAMP_SLOTS] = Stamp{ stamp_id, capture_us, true };
+            timing.stamped = true;
+        } else if (len >= 8 && udp_read_tables(buffer, len, generation, tables, tables_size)) {
+            if (generation != view.tables) view_load_tables(view, tables, tables_size, generation);
+        } else if (len >= 8 && !clock_sync_on_packet(timing.clock, buffer, len, latency_now_us())) {
+            sender_addr = from;
+            sender_len = fromlen;
+            report_on_packet(reports, buffer, len, now_us);
+            if (reassembler_add(reassembler, buffer, len, now, jpeg_data, &frame_id) &&
+                !show_frame(view, jpeg_data, frame_id, have_id, last_id, timing)) {
+                want_key = true;
+            }
         }
-
-        if (header.part_index < header.total_parts && frame.parts[header.part_index].empty()) {
-            frame.parts[header.part_index].assign(buffer + 8, buffer + len);
-            frame.received_parts++;
+        while (reassembler_poll(reassembler, now, jpeg_data, &frame_id)) {
+            if (!show_frame(view, jpeg_data, frame_id, have_id, last_id, timing)) want_key = true;
+        }
+        if (timing.stamped && sender_len && clock_sync_request(timing.clock, latency_now_us(), clock_request)) {
+            sendto(sockfd, clock_request, sizeof(clock_request), 0, (sockaddr*)&sender_addr, sender_len);
+        }
+        if (view.complete) want_key = false;
+        if (want_key && sender_len && now - key_request_ms >= KEYFRAME_REQUEST_MS) {
+            udp_write_keyframe_request(key_request, last_id);
+            sendto(sockfd, key_request, sizeof(key_request), 0, (sockaddr*)&sender_addr, sender_len);
+            key_request_ms = now;
         }
 
-        // Frame complete
-        if (frame.received_parts == frame.total_parts) {
-            std::vector<uint8_t> jpeg_data;
-            for (const auto& part : frame.parts) {
-                jpeg_data.insert(jpeg_data.end(), part.begin(), part.end());
-            }
-
-            // Decompress JPEG
-            jpeg_decompress_struct cinfo;
-            jpeg_error_mgr jerr;
-            cinfo.err = jpeg_std_error(&jerr);
-            jpeg_create_decompress(&cinfo);
-
-            jpeg_mem_src(&cinfo, jpeg_data.data(), jpeg_data.size());
-            jpeg_read_header(&cinfo, TRUE);
-            jpeg_start_decompress(&cinfo);
-
-            int width = cinfo.output_width;
-            int height = cinfo.output_height;
-            int channels = cinfo.output_components;
-
-            std::vector<uint8_t> rgb_buf(width * height * channels);
-            while (cinfo.output_scanline < cinfo.output_height) {
-                uint8_t* rowptr = &rgb_buf[cinfo.output_scanline * width * channels];
-                jpeg_read_scanlines(&cinfo, &rowptr, 1);
-            }
-            jpeg_finish_decompress(&cinfo);
-            jpeg_destroy_decompress(&cinfo);
-
-            // Display via SDL
-            if (!texture) {
-                texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, width, height);
-            }
-
-            SDL_UpdateTexture(texture, nullptr, rgb_buf.data(), width * channels);
-            SDL_RenderClear(renderer);
-            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-            SDL_RenderPresent(renderer);
-
-            frame_map.erase(header.frame_id);
+        // Ask for lost chunks
+        nacks.clear();
+        reassembler_nacks(reassembler, now, nacks);
+        for (const auto& nack : nacks) {
+            if (sender_len) sendto(sockfd, nack.data(), nack.size(), 0, (sockaddr*)&sender_addr, sender_len);
+        }
+        if (sender_len && report_build(reports, now_us, report)) {
+            sendto(sockfd, report, sizeof(report), 0, (sockaddr*)&sender_addr, sender_len);
         }
 
         // Cleanup stale frames
-        uint64_t now = current_time_ms();
-        for (auto it = frame_map.begin(); it != frame_map.end();) {
-            if (now - it->second.last_update_time > FRAME_TIMEOUT_MS) {
-                it = frame_map.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        reassembler_expire(reassembler, now);
 
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
@@ -145,11 +192,28 @@ int main() {
     }
 
 quit:
-    if (texture) SDL_DestroyTexture(texture);
+    const ReassemblyStats& st = reassembler.stats;
+    printf("%lu frames shown, %lu rebuilt from parity, %lu repaired by retransmission (%lu of %lu chunks asked for), "
+           "%lu abandoned, %lu expired, %lu sender restarts\n",
+           (unsigned long)st.completed, (unsigned long)st.recovered_frames, (unsigned long)st.repaired_frames,
+           (unsigned long)st.repaired_parts, (unsigned long)st.requested_parts, (unsigned long)st.abandoned,
+           (unsigned long)st.expired, (unsigned long)st.restarts);
+    if (view.stats.predicted) {
+        printf("%lu H.264 IDR frames, %lu P-frames, %lu frames waiting for an IDR frame\n",
+               (unsigned long)view.stats.keyframes, (unsigned long)view.stats.predicted,
+               (unsigned long)view.stats.ignored);
+    } else if (view.stats.deltas || view.stats.ignored) {
+        printf("%lu keyframes, %lu tile deltas (%lu tiles), %lu deltas waiting for a keyframe\n",
+               (unsigned long)view.stats.keyframes, (unsigned long)view.stats.deltas, (unsigned long)view.stats.tiles,
+               (unsigned long)view.stats.ignored);
+    }
+    if (view.stats.no_tables) printf("%lu abbreviated frames skipped for missing tables\n",
+                                     (unsigned long)view.stats.no_tables);
+    latency_summary(timing.stats, timing.clock);
+    view_destroy(view);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     close(sockfd);
     return 0;
 }
-
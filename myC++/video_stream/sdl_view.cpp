@@ -0,0 +1,159 @@
+#include "sdl_view.h"
+
+#include <cstdio>
+
+#include "jpeg_tables.h"
+
+static void init_decoder(SdlView& view) {
+    if (view.decoder) return;
+    view.cinfo.err = jpeg_std_error(&view.jerr);
+    jpeg_create_decompress(&view.cinfo);
+    view.decoder = true;
+}
+
+// Decodes into view.rgb. Mosaics are decoded without fancy upsampling, which
+// would blend each tile's chroma edges with its neighbour in the mosaic.
+// Returns false for an abbreviated frame whose tables are not loaded.
+static bool decode(SdlView& view, const uint8_t* jpeg, size_t size, bool mosaic, int& width, int& height) {
+    uint16_t tag = jpeg_tables_tag(jpeg, size);
+    if (tag && tag != view.tables) {
+        view.stats.no_tables++;
+        return false;
+    }
+    // Untagged frames bring their own tables, which replace the loaded ones
+    // (on TCP the order of the stream keeps them right instead).
+    if (!tag) view.tables = 0;
+
+    init_decoder(view);
+    jpeg_decompress_struct& cinfo = view.cinfo;
+    jpeg_mem_src(&cinfo, jpeg, size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    if (mosaic) cinfo.do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(&cinfo);
+
+    width = cinfo.output_width;
+    height = cinfo.output_height;
+    view.rgb.resize((size_t)width * height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        uint8_t* row = &view.rgb[(size_t)cinfo.output_scanline * width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    return true;
+}
+
+void view_load_tables(SdlView& view, const uint8_t* data, size_t size, uint16_t generation) {
+    init_decoder(view);
+    jpeg_mem_src(&view.cinfo, data, size);
+    if (jpeg_read_header(&view.cinfo, FALSE) == JPEG_HEADER_TABLES_ONLY) view.tables = generation;
+    else jpeg_abort_decompress(&view.cinfo);
+}
+
+static void present(SdlView& view) {
+    SDL_RenderClear(view.renderer);
+    SDL_RenderCopy(view.renderer, view.texture, nullptr, nullptr);
+    SDL_RenderPresent(view.renderer);
+}
+
+// Replaces the texture unless it already has this format and size.
+static void fit_texture(SdlView& view, uint32_t format, int width, int height) {
+    if (view.texture && format == view.format && width == view.width && height == view.height) return;
+    if (view.texture) SDL_DestroyTexture(view.texture);
+    view.texture = SDL_CreateTexture(view.renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+    view.format = format;
+    view.width = width;
+    view.height = height;
+}
+
+static bool show_delta(SdlView& view, const uint8_t* data, size_t size) {
+    TileDeltaHeader delta;
+    if (!tile_delta_read(data, size, delta) || !view.complete || view.format != SDL_PIXELFORMAT_RGB24 ||
+        delta.width != view.width || delta.height != view.height) {
+        view.stats.ignored++;
+        view.complete = false;
+        return false;
+    }
+    view.stats.deltas++;
+    if (!delta.changed) return true;
+
+    int width, height;
+    if (!decode(view, delta.jpeg, delta.jpeg_size, true, width, height) || width != view.width) {
+        view.stats.ignored++;
+        view.complete = false;
+        return false;
+    }
+    tile_delta_runs(delta, view.runs);
+    for (const TileRun& run : view.runs) {
+        SDL_Rect rect{ run.x, run.y, run.width, TILE_SIZE };
+        const uint8_t* pixels = &view.rgb[((size_t)run.mosaic_y * width + run.mosaic_x) * 3];
+        SDL_UpdateTexture(view.texture, &rect, pixels, width * 3);
+    }
+    view.stats.tiles += delta.changed;
+    present(view);
+    return true;
+}
+
+static bool show_h264(SdlView& view, const uint8_t* data, size_t size) {
+    bool idr = h264_is_idr(data, size);
+    if (!view.complete && !idr) {
+        view.stats.ignored++;
+        return false;
+    }
+    if (!view.h264_tried) {
+        h264_decoder_init(view.h264);
+        view.h264_tried = true;
+    }
+
+    H264Picture picture;
+    bool have_picture;
+    if (!view.h264.svc || !h264_decode(view.h264, data, size, picture, have_picture)) {
+        view.stats.ignored++;
+        view.complete = false;
+        return false;
+    }
+    view.complete = true;
+    if (idr) view.stats.keyframes++;
+    else view.stats.predicted++;
+    if (!have_picture) return true;
+
+    fit_texture(view, SDL_PIXELFORMAT_IYUV, picture.width, picture.height);
+    SDL_UpdateYUVTexture(view.texture, nullptr, picture.planes[0], picture.strides[0], picture.planes[1],
+                         picture.strides[1], picture.planes[2], picture.strides[2]);
+    present(view);
+    return true;
+}
+
+bool view_show(SdlView& view, const uint8_t* data, size_t size) {
+    if (tile_delta_is_delta(data, size)) return show_delta(view, data, size);
+    if (h264_is_access_unit(data, size)) return show_h264(view, data, size);
+    if (jpeg_is_tables_only(data, size)) {
+        view_load_tables(view, data, size, 0);
+        return true;
+    }
+
+    int width, height;
+    if (!decode(view, data, size, false, width, height)) {
+        view.complete = false;
+        return false;
+    }
+    fit_texture(view, SDL_PIXELFORMAT_RGB24, width, height);
+    SDL_UpdateTexture(view.texture, nullptr, view.rgb.data(), width * 3);
+    view.complete = true;
+    view.stats.keyframes++;
+    present(view);
+    return true;
+}
+
+void view_lost(SdlView& view) {
+    view.complete = false;
+}
+
+void view_destroy(SdlView& view) {
+    if (view.texture) SDL_DestroyTexture(view.texture);
+    view.texture = nullptr;
+    if (view.decoder) jpeg_destroy_decompress(&view.cinfo);
+    view.decoder = false;
+    h264_decoder_destroy(view.h264);
+    view.h264_tried = false;
+}
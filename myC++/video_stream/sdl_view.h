@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <jpeglib.h>
+
+#include "h264_decoder.h"
+#include "tile_delta.h"
+
+// Picture shown by the SDL clients. A JPEG replaces the whole texture; a
+// tile delta (tile_delta.h) only updates the tiles it carries, so the
+// texture persists between frames and holds the composite. Deltas need the
+// frame before them: after view_lost(), or before the first keyframe, they
+// are ignored until a keyframe arrives.
+//
+// One decompressor serves the whole session, so frames may come without
+// their tables (jpeg_tables.h): a tables-only JPEG, received as a frame or
+// through view_load_tables(), loads the tables the frames after it use.
+//
+// H.264 access units (h264_decoder.h) go to a decoder kept for the session
+// and are shown through a YUV texture. Like deltas, P-frames are skipped
+// after view_lost() or a decoding error until an IDR frame arrives.
+
+struct ViewStats {
+    uint64_t keyframes;   // whole JPEGs and H.264 IDR frames
+    uint64_t deltas;
+    uint64_t predicted;   // H.264 P-frames
+    uint64_t tiles;       // tiles updated by deltas
+    uint64_t ignored;     // deltas and P-frames that did not fit the picture on screen
+    uint64_t no_tables;   // abbreviated frames whose tables were not loaded
+};
+
+struct SdlView {
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    uint32_t format = 0;         // of the texture: RGB24, or IYUV for H.264
+    int width = 0;
+    int height = 0;
+    bool complete = false;       // every delta since the last keyframe applied
+    std::vector<uint8_t> rgb;    // decoded frame or mosaic
+    std::vector<TileRun> runs;
+
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    bool decoder = false;        // cinfo created
+    uint16_t tables = 0;         // generation loaded; 0 after a frame brought its own
+
+    H264Decoder h264;
+    bool h264_tried = false;     // h264_decoder_init() called; h264.svc is set if it worked
+
+    ViewStats stats{};
+};
+
+// Decodes and shows one received frame. Returns false when it could not be
+// applied and the view is waiting for a keyframe (an IDR frame for H.264),
+// or for the tables of an abbreviated frame.
+bool view_show(SdlView& view, const uint8_t* data, size_t size);
+
+// Loads a tables-only JPEG of the given generation (0 when the frames are
+// not tagged, as on TCP).
+void view_load_tables(SdlView& view, const uint8_t* data, size_t size, uint16_t generation);
+
+// A frame went missing; deltas no longer apply until the next keyframe.
+void view_lost(SdlView& view);
+
+void view_destroy(SdlView& view);
@@ -0,0 +1,162 @@
+#include "slice_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "perf_counters.h"
+
+static void encode_band(SliceEncoder& enc, SliceBand& band) {
+    const unsigned char* src = enc.frame + (size_t)band.first_row * enc.width * 2;
+    band.out_size = jpeg_encode_yuyv(*band.enc, src, band.out.data(), band.out.size());
+}
+
+// Helpers count their work with the thread that created the encoder.
+static void helper_loop(SliceEncoder& enc, int index, PerfMonitor* perf) {
+    perf_thread_start(perf);
+    uint32_t seen = 0;
+    for (;;) {
+        enc.generation.wait(seen);
+        seen = enc.generation.load();
+        if (enc.quit.load()) break;
+
+        PerfStage outer = perf_enter(PERF_ENCODE);
+        encode_band(enc, enc.bands[index]);
+        perf_enter(outer);
+        if (enc.remaining.fetch_sub(1) == 1) enc.remaining.notify_one();
+    }
+    perf_thread_stop();
+}
+
+bool slice_encoder_init(SliceEncoder& enc, int width, int height, int quality, JpegInput input,
+                        int slices, FramePool* pool, JpegBackend backend) {
+    // The encoder may be reused after slice_encoder_destroy().
+    enc.quit = false;
+    enc.generation = 0;
+    enc.remaining = 0;
+    enc.width = width;
+    enc.height = height;
+
+    // Bands must start on an MCU row: 16 lines for 4:2:0, 8 for 4:2:2.
+    int mcu_h = input == JpegInput::Yuv422 ? 8 : 16;
+    int mcu_rows = (height + mcu_h - 1) / mcu_h;
+    if (slices > mcu_rows) slices = mcu_rows;
+    int band_rows = (mcu_rows + slices - 1) / slices;
+    slices = (mcu_rows + band_rows - 1) / band_rows;
+
+    enc.mcus_per_band = (width + 15) / 16 * band_rows;
+    if (slices > 1 && enc.mcus_per_band > 65535) {
+        std::cerr << "slice_encoder_init: " << slices << " bands are too tall for a restart interval\n";
+        return false;
+    }
+
+    enc.bands.resize(slices);
+    for (int i = 0; i < slices; ++i) {
+        SliceBand& band = enc.bands[i];
+        band.first_row = i * band_rows * mcu_h;
+        int rows = std::min(band_rows * mcu_h, height - band.first_row);
+        band.enc.reset(new JpegEncoder);
+        if (!jpeg_encoder_init(*band.enc, width, rows, quality, input, pool, backend)) return false;
+        band.out.resize(jpeg_encoder_bound(*band.enc));
+    }
+
+    for (int i = 1; i < slices; ++i) enc.helpers.emplace_back(helper_loop, std::ref(enc), i, perf_current());
+    return true;
+}
+
+size_t slice_encoder_bound(const SliceEncoder& enc) {
+    size_t bound = 0;
+    for (const auto& band : enc.bands) bound += band.out.size();
+    return bound + 6;  // DRI segment
+}
+
+void slice_encoder_set_quality(SliceEncoder& enc, int quality) {
+    for (auto& band : enc.bands) jpeg_encoder_set_quality(*band.enc, quality);
+}
+
+// Offset just past the marker segment starting at pos (FF xx len_hi len_lo ...).
+static size_t segment_end(const unsigned char* p, size_t pos) {
+    return pos + 2 + ((p[pos + 2] << 8) | p[pos + 3]);
+}
+
+size_t slice_encode_yuyv(SliceEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity) {
+    if (enc.bands.size() == 1) {
+        return jpeg_encode_yuyv(*enc.bands[0].enc, yuyv, out, capacity);
+    }
+
+    enc.frame = yuyv;
+    enc.remaining = enc.bands.size() - 1;
+    enc.generation.fetch_add(1);
+    enc.generation.notify_all();
+
+    encode_band(enc, enc.bands[0]);
+    for (int left = enc.remaining.load(); left != 0; left = enc.remaining.load()) enc.remaining.wait(left);
+
+    // A band that failed to encode leaves nothing to stitch; drop the frame.
+    for (const auto& band : enc.bands) {
+        if (band.out_size == 0) return 0;
+    }
+
+    // Headers come from band 0: everything up to and including SOS, with
+    // the frame height patched and a DRI inserted in front of the SOS.
+    const unsigned char* head = enc.bands[0].out.data();
+    size_t pos = 2;  // past SOI
+    size_t sof = 0, sos = 0;
+    while (!sos) {
+        unsigned char marker = head[pos + 1];
+        if (marker == 0xC0) sof = pos;
+        if (marker == 0xDA) sos = pos;
+        else pos = segment_end(head, pos);
+    }
+    size_t sos_end = segment_end(head, sos);
+
+    // Anything that does not fit fails the whole stitch.
+    size_t n = 0;
+    bool overflow = false;
+    auto put = [&](const void* src, size_t len) {
+        if (overflow || n + len > capacity) {
+            overflow = true;
+            return;
+        }
+        memcpy(out + n, src, len);
+        n += len;
+    };
+
+    put(head, sos);
+    if (overflow) return 0;
+    out[sof + 5] = enc.height >> 8;
+    out[sof + 6] = enc.height & 0xFF;
+    unsigned char dri[6] = { 0xFF, 0xDD, 0x00, 0x04,
+                             (unsigned char)(enc.mcus_per_band >> 8), (unsigned char)(enc.mcus_per_band & 0xFF) };
+    put(dri, sizeof(dri));
+    put(head + sos, sos_end - sos);
+
+    // Each band's entropy-coded data runs from the end of its SOS to EOI.
+    for (size_t i = 0; i < enc.bands.size(); ++i) {
+        const SliceBand& band = enc.bands[i];
+        const unsigned char* p = band.out.data();
+        size_t start = 2;
+        while (p[start + 1] != 0xDA) start = segment_end(p, start);
+        start = segment_end(p, start);
+        if (band.out_size <= start + 2) return 0;  // no entropy-coded data before EOI
+        put(p + start, band.out_size - 2 - start);
+
+        if (i + 1 < enc.bands.size()) {
+            unsigned char rst[2] = { 0xFF, (unsigned char)(0xD0 + i % 8) };
+            put(rst, sizeof(rst));
+        }
+    }
+    unsigned char eoi[2] = { 0xFF, 0xD9 };
+    put(eoi, sizeof(eoi));
+    return overflow ? 0 : n;
+}
+
+void slice_encoder_destroy(SliceEncoder& enc) {
+    enc.quit = true;
+    enc.generation.fetch_add(1);
+    enc.generation.notify_all();
+    for (auto& t : enc.helpers) t.join();
+    enc.helpers.clear();
+    for (auto& band : enc.bands) jpeg_encoder_destroy(*band.enc);
+    enc.bands.clear();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+// Splits each frame into horizontal bands, encodes them on separate threads
+// and stitches the results into one baseline JPEG.
+//
+// Every band is an MCU-row-aligned JPEG with the same tables. The stitched
+// stream keeps band 0's headers (with the SOF height patched to the full
+// frame), adds a DRI whose interval is one band's worth of MCUs, and joins
+// the bands' entropy-coded segments with RST0..RST7 markers. The restart
+// resets the DC predictors exactly as a fresh band encode does, so any
+// decoder sees the same coefficients as for an unsliced encode.
+
+struct SliceBand {
+    std::unique_ptr<JpegEncoder> enc;
+    int first_row = 0;
+    std::vector<unsigned char> out;
+    size_t out_size = 0;
+};
+
+struct SliceEncoder {
+    int width = 0;
+    int height = 0;
+    int mcus_per_band = 0;
+    std::vector<SliceBand> bands;
+
+    // Bands 1..n-1 run on helper threads; band 0 runs on the caller.
+    std::vector<std::thread> helpers;
+    const unsigned char* frame = nullptr;
+    std::atomic<uint32_t> generation{0};
+    std::atomic<int> remaining{0};
+    std::atomic<bool> quit{false};
+};
+
+bool slice_encoder_init(SliceEncoder& enc, int width, int height, int quality, JpegInput input,
+                        int slices, FramePool* pool = nullptr, JpegBackend backend = JpegBackend::Libjpeg);
+size_t slice_encoder_bound(const SliceEncoder& enc);
+void slice_encoder_set_quality(SliceEncoder& enc, int quality);
+
+// Same contract as jpeg_encode_yuyv().
+size_t slice_encode_yuyv(SliceEncoder& enc, const unsigned char* yuyv, unsigned char* out, size_t capacity);
+
+void slice_encoder_destroy(SliceEncoder& enc);
@@ -0,0 +1,60 @@
+#include "stream_options.h"
+
+#include <cstdlib>
+#include <iostream>
+
+bool parse_stream_option(int opt, const char* arg, StreamOptions& options) {
+    switch (opt) {
+    case 'd': options.device = arg; return true;
+    case 'n': options.nbuffers = atoi(arg); return true;
+    case 'f': return parse_capture_format(arg, options.format);
+    case 'b': return parse_capture_memory(arg, options.memory);
+    case 'r':
+        options.pipeline.fps = atof(arg);
+        return options.pipeline.fps >= 0;
+    case 'e': return parse_jpeg_input(arg, options.pipeline.input);
+    case 'J':
+        return parse_jpeg_backend(arg, options.pipeline.backend) && jpeg_backend_available(options.pipeline.backend);
+    case 'c':
+        if (!parse_video_codec(arg, options.pipeline.codec)) return false;
+        if (!video_codec_available(options.pipeline.codec)) {
+            std::cerr << "Built without openh264; rebuild with make OPENH264=1\n";
+            return false;
+        }
+        // The camera's MJPEG would only be passed through.
+        if (options.pipeline.codec == VideoCodec::H264 && options.format == CaptureFormat::Auto) {
+            options.format = CaptureFormat::Yuyv;
+        }
+        return true;
+    case 'g':
+        options.pipeline.gop = atoi(arg);
+        return options.pipeline.gop >= 0;
+    case 'B':
+        options.pipeline.bitrate_kbps = atoi(arg);
+        return options.pipeline.bitrate_kbps > 0;
+    case 'w':
+        options.pipeline.workers = atoi(arg);
+        return options.pipeline.workers > 0;
+    case 's':
+        options.pipeline.slices = atoi(arg);
+        return options.pipeline.slices > 0;
+    case 'H': options.pipeline.huge_pages = true; return true;
+    case 'T':
+        options.pipeline.tile_deltas = true;
+        options.pipeline.keyframe_interval = atoi(arg);
+        return options.pipeline.keyframe_interval >= 0;
+    case 'D':
+        options.pipeline.tile_threshold = atoi(arg);
+        return true;
+    case 'G':
+        options.pipeline.gate_threshold = atoi(arg);
+        return options.pipeline.gate_threshold >= 0;
+    case 'K':
+        options.pipeline.heartbeat_ms = atoi(arg);
+        return options.pipeline.heartbeat_ms > 0;
+    case 't': options.timestamps = true; return true;
+    case 'a': options.abbreviated = true; return true;
+    case 'P': options.pipeline.perf_json = arg; return true;
+    default: return false;
+    }
+}
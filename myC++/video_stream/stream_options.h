@@ -0,0 +1,46 @@
+#pragma once
+
+#include "pipeline.h"
+
+// Command-line options shared by v4l2_tcp_stream and v4l2_udp_stream. Each
+// streamer runs getopt() with STREAM_OPTSTRING plus its own letters and
+// passes anything it does not handle itself to parse_stream_option().
+
+#define STREAM_OPTSTRING "d:n:f:r:e:w:s:HT:D:G:K:b:tP:J:ac:g:B:"
+
+#define STREAM_USAGE \
+    "  -d source            capture device, recorded clip or pattern[:WIDTHxHEIGHT] (default /dev/video0)\n" \
+    "  -n buffers           capture ring size (default 4)\n" \
+    "  -f auto|yuyv|mjpeg   capture format; MJPEG frames are sent as-is (default auto)\n" \
+    "  -b auto|mmap|userptr capture buffers: driver-mapped, or our pool (default auto: userptr, else mmap)\n" \
+    "  -r fps               target frame rate, 0 for every captured frame (default 30)\n" \
+    "  -e rgb|yuv|yuv422    JPEG input path (default yuv)\n" \
+    "  -J libjpeg|turbo     JPEG encoder; turbo needs a make TURBOJPEG=1 build (default libjpeg)\n" \
+    "  -c jpeg|h264         codec; h264 needs a make OPENH264=1 build and YUYV capture (default jpeg)\n" \
+    "  -g frames            h264: frames between IDR frames (0: only on request, default 60)\n" \
+    "  -B kbps              h264: target bitrate (default 2000)\n" \
+    "  -w workers           encode threads (default 2)\n" \
+    "  -s slices            bands per frame, encoded in parallel (default 1)\n" \
+    "  -H                   back the frame pool with huge pages\n" \
+    "  -T frames            send changed 16x16 tiles, with a keyframe every frames (0: only on request)\n" \
+    "  -D sad               tile change threshold, summed absolute YUYV difference (default 1024)\n" \
+    "  -G level             skip frames whose 8x8 block mean luma changed by at most level (0: off)\n" \
+    "  -K ms                with -G, send a frame at least this often (default 1000)\n" \
+    "  -a                   send the JPEG tables once per session and frames without them\n" \
+    "  -t                   stamp frames with a sequence number and capture time for viewer latency stats\n" \
+    "  -P file              append per-stage cycles, instructions and cache misses as JSON lines (-: stdout)\n"
+
+struct StreamOptions {
+    const char* device = "/dev/video0";
+    int nbuffers = 4;
+    CaptureFormat format = CaptureFormat::Auto;
+    CaptureMemory memory = CaptureMemory::Auto;
+    PipelineConfig pipeline;
+    bool timestamps = false;   // latency.h
+    bool abbreviated = false;  // jpeg_tables.h
+
+    StreamOptions() { pipeline.fps = 30; }
+};
+
+// Returns false for an unknown option or a bad argument.
+bool parse_stream_option(int opt, const char* arg, StreamOptions& options);
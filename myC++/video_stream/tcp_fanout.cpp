@@ -0,0 +1,627 @@
+#include "tcp_fanout.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "pacer.h"
+
+static const uint64_t RATE_WINDOW_NS = 200000000;      // drain rate sample
+static const uint64_t QUALITY_WINDOW_NS = 1000000000;  // between quality decisions
+static const uint64_t RAISE_HOLD_NS = 3000000000;      // no raise this soon after lowering
+static const double SKIP_LOWER = 0.10;                 // best viewer's skip share that lowers quality
+static const int QUALITY_DOWN = 10;
+static const int QUALITY_UP = 5;
+static const uint64_t METRICS_EVERY_NS = 1000000000;
+
+static FanoutFrame* take_frame(FanoutServer& server) {
+    {
+        std::lock_guard<std::mutex> guard(server.free_lock);
+        if (!server.free_frames.empty()) {
+            FanoutFrame* f = server.free_frames.back();
+            server.free_frames.pop_back();
+            return f;
+        }
+    }
+
+    // Every frame is still queued somewhere (e.g. a slow client mid-send);
+    // grow rather than stall the other clients.
+    unsigned char* data = frame_pool_acquire(server.pool);
+    if (!data) return nullptr;
+    FanoutFrame* f = new FanoutFrame{};
+    f->data = data;
+    std::lock_guard<std::mutex> guard(server.free_lock);
+    server.all_frames.push_back(f);
+    return f;
+}
+
+static void put_frame(FanoutServer& server, FanoutFrame* f) {
+    std::lock_guard<std::mutex> guard(server.free_lock);
+    server.free_frames.push_back(f);
+}
+
+static void unref(FanoutServer& server, FanoutFrame* f) {
+    if (--f->refs == 0) put_frame(server, f);
+}
+
+static void watch(FanoutServer& server, FanoutClient& c, bool write) {
+    if (c.want_write == write) return;
+    c.want_write = write;
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (write ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.fd = c.fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+static void drop_client(FanoutServer& server, FanoutClient& c) {
+    printf("fanout: %s left after %lu frames (%lu dropped, %lu skipped)\n", c.addr,
+           (unsigned long)c.stats.sent, (unsigned long)c.stats.dropped, (unsigned long)c.stats.skipped);
+    fflush(stdout);
+    for (FanoutFrame* f : c.queue) unref(server, f);
+    // Once the socket is closed no completions will arrive; anything still
+    // in flight is going to a peer that has gone.
+    for (auto& [id, f] : c.zc_pending) unref(server, f);
+    int fd = c.fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    server.clients.erase(fd);
+    server.client_count--;
+}
+
+static void request_keyframe(FanoutServer& server) {
+    if (server.config.control) server.config.control->keyframe = true;
+}
+
+// Tile deltas: the client's picture no longer matches what the next delta
+// applies to. Frames it has not started on are dropped (they would apply
+// to the wrong picture too) and it waits for a keyframe. Tables stay.
+static void missed_frame(FanoutServer& server, FanoutClient& c) {
+    auto first = c.queue.begin() + (c.offset ? 1 : 0);
+    auto kept = first;
+    for (auto it = first; it != c.queue.end(); ++it) {
+        if ((*it)->tables_only) {
+            *kept++ = *it;
+            continue;
+        }
+        unref(server, *it);
+        c.stats.dropped++;
+    }
+    c.queue.erase(kept, c.queue.end());
+    c.need_key = true;
+    request_keyframe(server);
+}
+
+// Publisher side: the frame never reached the server thread. With tile
+// deltas every client has missed it; deliver() catches them up.
+static void drop_published(FanoutServer& server) {
+    server.inbox_drops++;
+    if (!server.config.tile_deltas) return;
+    server.publish_missed = true;
+    request_keyframe(server);
+}
+
+static void accept_clients(FanoutServer& server) {
+    for (;;) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        int fd = accept4(server.listen_fd, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+            return;
+        }
+
+        FanoutClient& c = server.clients[fd];
+        c.fd = fd;
+        c.mode = server.config.send_mode;
+        if (c.mode == TcpSendMode::ZeroCopy && !tcp_enable_zerocopy(fd)) c.mode = TcpSendMode::Gather;
+        if (server.config.latency_ms > 0) {
+            // Keep the unsent backlog in our queue, where frames can still be skipped.
+            int lowat = server.config.notsent_lowat;
+            if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0) {
+                perror("setsockopt TCP_NOTSENT_LOWAT");
+            }
+            c.rate_start_ns = monotonic_ns();
+        }
+        if (server.config.tile_deltas) c.need_key = true;
+        if (server.config.tile_deltas || server.config.frame_gate) request_keyframe(server);
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        snprintf(c.addr, sizeof(c.addr), "%s:%u", ip, ntohs(addr.sin_port));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            server.clients.erase(fd);
+            continue;
+        }
+        server.client_count++;
+        printf("fanout: %s connected (%d clients)\n", c.addr, server.client_count.load());
+        fflush(stdout);
+    }
+}
+
+// Sends as much of the client's queue as the socket takes. Returns false if
+// the client is gone.
+static bool flush_client(FanoutServer& server, FanoutClient& c) {
+    while (!c.queue.empty()) {
+        FanoutFrame* f = c.queue.front();
+        size_t total = f->header_len + f->size;
+        while (c.offset < total) {
+            bool zerocopy;
+            ssize_t n = tcp_send_frame(c.fd, c.mode, f->header, f->header_len, f->data, f->size, c.offset,
+                                       &zerocopy);
+            if (n < 0) return false;
+            if (n == 0) {
+                watch(server, c, true);
+                return true;
+            }
+            if (zerocopy) {
+                f->refs++;
+                c.zc_pending.push_back({c.zc_next++, f});
+                c.stats.zc_calls++;
+            }
+            c.offset += n;
+            c.stats.bytes += n;
+        }
+
+        if (!f->tables_only) {
+            uint64_t lag = monotonic_ns() - f->captured_ns;
+            if (lag > c.stats.max_lag_ns) c.stats.max_lag_ns = lag;
+            c.stats.sent++;
+        }
+        c.offset = 0;
+        c.queue.pop_front();
+        unref(server, f);
+    }
+    watch(server, c, false);
+    return true;
+}
+
+// Releases the frames of completed zero-copy sends. Returns false if the
+// socket has a real error.
+static bool reap_completions(FanoutServer& server, FanoutClient& c) {
+    uint32_t lo, hi;
+    bool copied;
+    int r;
+    while ((r = tcp_reap_zerocopy(c.fd, &lo, &hi, &copied)) > 0) {
+        if (copied) c.stats.zc_copied++;
+        for (auto it = c.zc_pending.begin(); it != c.zc_pending.end();) {
+            if (it->first - lo <= hi - lo) {
+                unref(server, it->second);
+                it = c.zc_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (r < 0) return false;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err == 0;
+}
+
+static void enqueue(FanoutServer& server, FanoutClient& c, FanoutFrame* f) {
+    if (c.queue.size() >= server.config.client_queue && server.config.tile_deltas) {
+        missed_frame(server, c);
+        if (!f->keyframe) return;
+    } else if (c.queue.size() >= server.config.client_queue) {
+        // Drop the oldest frame not already partly on the wire.
+        auto stale = c.queue.begin() + (c.offset ? 1 : 0);
+        while (stale != c.queue.end() && (*stale)->tables_only) ++stale;
+        if (stale != c.queue.end()) {
+            unref(server, *stale);
+            c.queue.erase(stale);
+            c.stats.dropped++;
+        }
+    }
+    if (f->keyframe) c.need_key = false;
+    if (f->tables && f->tables != c.tables && server.tables) {
+        server.tables->refs++;
+        c.queue.push_back(server.tables);
+        c.tables = server.tables->tables;
+    }
+    f->refs++;
+    c.queue.push_back(f);
+}
+
+// Backlog ahead of a new frame: what the socket still holds (unacknowledged
+// or unsent) plus our queue, and how long the viewer takes to drain it.
+static void measure_backlog(FanoutClient& c, uint64_t now) {
+    int outq = 0;
+    if (ioctl(c.fd, SIOCOUTQ, &outq) < 0) outq = 0;
+    size_t queued = 0;
+    for (FanoutFrame* f : c.queue) queued += f->header_len + f->size;
+    c.backlog_bytes = outq + queued - c.offset;
+
+    // Everything written minus what the socket still holds has been acknowledged.
+    // Only windows that start and end with data outstanding measure the link
+    // rather than the frame rate.
+    uint64_t acked = c.stats.bytes - outq;
+    uint64_t elapsed = now - c.rate_start_ns;
+    if (elapsed >= RATE_WINDOW_NS) {
+        if (c.rate_busy && outq > 0) {
+            double rate = (acked - c.rate_acked) * 1e9 / elapsed;
+            c.drain_rate = c.drain_rate > 0 ? 0.75 * c.drain_rate + 0.25 * rate : rate;
+        }
+        c.rate_start_ns = now;
+        c.rate_acked = acked;
+        c.rate_busy = outq > 0;
+    }
+
+    c.backlog_ms = c.drain_rate > 0 ? c.backlog_bytes * 1000.0 / c.drain_rate : 0;
+    if (c.backlog_ms > c.stats.max_backlog_ms) c.stats.max_backlog_ms = c.backlog_ms;
+}
+
+// Whether the client takes the new frame under the latency target.
+static bool within_target(FanoutServer& server, FanoutClient& c, uint64_t now) {
+    measure_backlog(c, now);
+    c.window_frames++;
+    if (c.backlog_ms <= server.config.latency_ms) return true;
+    c.stats.skipped++;
+    c.window_skipped++;
+    return false;
+}
+
+// Moves the shared JPEG quality once a window, following the viewer that
+// skipped the least: one slow viewer skips frames rather than lowering the
+// picture for everyone.
+static void adapt_quality(FanoutServer& server, uint64_t now) {
+    if (!server.window_start_ns) server.window_start_ns = now;
+    if (now - server.window_start_ns < QUALITY_WINDOW_NS) return;
+    server.window_start_ns = now;
+
+    FanoutClient* best = nullptr;
+    double best_skip = 0;
+    for (auto& [fd, c] : server.clients) {
+        if (!c.window_frames) continue;
+        double skip = (double)c.window_skipped / c.window_frames;
+        if (!best || skip < best_skip || (skip == best_skip && c.backlog_ms < best->backlog_ms)) {
+            best = &c;
+            best_skip = skip;
+        }
+    }
+    for (auto& [fd, c] : server.clients) {
+        if (c.window_skipped) {
+            printf("fanout: %s skipped %lu/%lu frames, backlog %.0f ms (%.1f KB at %.1f KB/s, target %d ms)\n",
+                   c.addr, (unsigned long)c.window_skipped, (unsigned long)c.window_frames, c.backlog_ms,
+                   c.backlog_bytes / 1024.0, c.drain_rate / 1024.0, server.config.latency_ms);
+        }
+        c.window_frames = c.window_skipped = 0;
+    }
+    fflush(stdout);
+
+    const FanoutConfig& config = server.config;
+    if (!best || !config.control) return;
+    int quality = config.control->quality.load();
+    int next = quality;
+    if (best_skip > SKIP_LOWER && quality > config.min_quality) {
+        next = std::max(config.min_quality, quality - QUALITY_DOWN);
+        server.raise_after_ns = now + RAISE_HOLD_NS;
+    } else if (best_skip == 0 && best->backlog_ms < config.latency_ms / 2.0 && quality < config.max_quality &&
+               now >= server.raise_after_ns) {
+        next = std::min(config.max_quality, quality + QUALITY_UP);
+    }
+    if (next == quality) return;
+
+    config.control->quality = next;
+    if (next < quality) server.quality_down++;
+    else server.quality_up++;
+    printf("fanout: quality %d -> %d: best viewer %s skipped %.0f%%, backlog %.0f ms (target %d ms)\n", quality,
+           next, best->addr, best_skip * 100, best->backlog_ms, config.latency_ms);
+    fflush(stdout);
+}
+
+bool fanout_write_metrics(FanoutServer& server, const char* path) {
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) { perror(tmp.c_str()); return false; }
+
+    fprintf(f, "# TYPE video_tcp_clients gauge\nvideo_tcp_clients %zu\n", server.clients.size());
+    fprintf(f, "# TYPE video_tcp_latency_target_ms gauge\nvideo_tcp_latency_target_ms %d\n",
+            server.config.latency_ms);
+    if (server.config.control) {
+        fprintf(f, "# TYPE video_tcp_jpeg_quality gauge\nvideo_tcp_jpeg_quality %d\n",
+                server.config.control->quality.load());
+    }
+    fprintf(f, "# TYPE video_tcp_quality_changes_total counter\n");
+    fprintf(f, "video_tcp_quality_changes_total{direction=\"down\"} %lu\n", (unsigned long)server.quality_down);
+    fprintf(f, "video_tcp_quality_changes_total{direction=\"up\"} %lu\n", (unsigned long)server.quality_up);
+
+    struct Metric { const char* name; const char* type; };
+    static const Metric metrics[] = {
+        { "video_tcp_backlog_bytes", "gauge" },
+        { "video_tcp_backlog_ms", "gauge" },
+        { "video_tcp_drain_bytes_per_second", "gauge" },
+        { "video_tcp_frames_sent_total", "counter" },
+        { "video_tcp_frames_dropped_total", "counter" },
+        { "video_tcp_frames_skipped_total", "counter" },
+    };
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); ++m) {
+        fprintf(f, "# TYPE %s %s\n", metrics[m].name, metrics[m].type);
+        for (auto& [fd, c] : server.clients) {
+            double values[] = { (double)c.backlog_bytes, c.backlog_ms, c.drain_rate, (double)c.stats.sent,
+                                (double)c.stats.dropped, (double)c.stats.skipped };
+            fprintf(f, "%s{client=\"%s\"} %.0f\n", metrics[m].name, c.addr, values[m]);
+        }
+    }
+
+    bool ok = fclose(f) == 0;
+    if (ok && rename(tmp.c_str(), path) < 0) { perror("rename"); ok = false; }
+    return ok;
+}
+
+static void report(FanoutServer& server) {
+    size_t frames;
+    {
+        std::lock_guard<std::mutex> guard(server.free_lock);
+        frames = server.all_frames.size();
+    }
+    printf("fanout: %zu clients, idle drops %lu, inbox drops %lu, frame buffers %zu\n", server.clients.size(),
+           (unsigned long)server.idle_drops.load(), (unsigned long)server.inbox_drops.load(), frames);
+    for (auto& [fd, c] : server.clients) {
+        printf("  %s: sent %lu dropped %lu queued %zu max lag %.1f ms, %.1f KB", c.addr,
+               (unsigned long)c.stats.sent, (unsigned long)c.stats.dropped, c.queue.size(),
+               c.stats.max_lag_ns / 1e6, c.stats.bytes / 1024.0);
+        if (server.config.latency_ms > 0) {
+            printf(", skipped %lu, backlog %.0f ms (max %.0f)", (unsigned long)c.stats.skipped, c.backlog_ms,
+                   c.stats.max_backlog_ms);
+            c.stats.max_backlog_ms = 0;
+        }
+        if (c.mode == TcpSendMode::ZeroCopy) {
+            printf(", zerocopy calls %lu copied %lu pending %zu", (unsigned long)c.stats.zc_calls,
+                   (unsigned long)c.stats.zc_copied, c.zc_pending.size());
+        }
+        printf("\n");
+        c.stats.max_lag_ns = 0;
+    }
+    fflush(stdout);
+}
+
+static void deliver(FanoutServer& server) {
+    FanoutFrame* f;
+    while (server.inbox.try_pop(f)) {
+        f->refs = 1;  // held by this loop until every client has it
+        if (f->tables_only) {
+            // Held by the server until newer tables arrive
+            if (server.tables) unref(server, server.tables);
+            server.tables = f;
+            continue;
+        }
+        if (server.publish_missed.exchange(false)) {
+            for (auto& [fd, c] : server.clients) missed_frame(server, c);
+        }
+        uint64_t now = monotonic_ns();
+        bool limited = server.config.latency_ms > 0;
+        std::vector<int> gone;
+        for (auto& [fd, c] : server.clients) {
+            if (c.need_key && !f->keyframe) continue;
+            if (limited && !within_target(server, c, now)) {
+                if (server.config.tile_deltas) missed_frame(server, c);
+                continue;
+            }
+            enqueue(server, c, f);
+            if (!flush_client(server, c)) gone.push_back(fd);
+        }
+        for (int fd : gone) drop_client(server, server.clients[fd]);
+        unref(server, f);
+
+        if (limited) adapt_quality(server, now);
+        if (server.config.metrics_path && now - server.metrics_ns >= METRICS_EVERY_NS) {
+            server.metrics_ns = now;
+            fanout_write_metrics(server, server.config.metrics_path);
+        }
+        if (server.config.report_every && ++server.published % server.config.report_every == 0) report(server);
+    }
+}
+
+static void server_loop(FanoutServer& server) {
+    epoll_event events[64];
+    while (!server.quit.load()) {
+        int n = epoll_wait(server.epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t ev = events[i].events;
+            if (fd == server.listen_fd) {
+                accept_clients(server);
+            } else if (fd == server.wake_fd) {
+                uint64_t count;
+                if (read(server.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read eventfd");
+                deliver(server);
+            } else {
+                auto it = server.clients.find(fd);
+                if (it == server.clients.end()) continue;
+                FanoutClient& c = it->second;
+
+                // Zero-copy completions are signalled as EPOLLERR.
+                bool alive = !(ev & (EPOLLHUP | EPOLLRDHUP));
+                if (alive && (ev & EPOLLERR)) alive = reap_completions(server, c);
+                if (alive && (ev & EPOLLIN)) {
+                    // Viewers send nothing; anything read is discarded.
+                    char buf[256];
+                    ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+                    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) alive = false;
+                }
+                if (alive && (ev & EPOLLOUT)) alive = flush_client(server, c);
+                if (!alive) drop_client(server, c);
+            }
+        }
+    }
+}
+
+bool fanout_start(FanoutServer& server, const FanoutConfig& config, size_t frame_capacity) {
+    server.config = config;
+    if (server.config.client_queue < 1) server.config.client_queue = 1;
+
+    // Every client queue holds the most recent frames, so a few more than
+    // one queue's worth covers the steady state however many clients there are.
+    if (!frame_pool_init(server.pool, frame_capacity, server.config.client_queue + server.inbox.capacity() + 2, false)) {
+        return false;
+    }
+
+    server.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server.listen_fd < 0) { perror("socket"); return false; }
+
+    int reuse = 1;
+    setsockopt(server.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(server.listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return false; }
+    if (listen(server.listen_fd, 64) < 0) { perror("listen"); return false; }
+
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.epoll_fd < 0) { perror("epoll_create1"); return false; }
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.wake_fd < 0) { perror("eventfd"); return false; }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = server.listen_fd;
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev) < 0) { perror("epoll_ctl"); return false; }
+    ev.data.fd = server.wake_fd;
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &ev) < 0) { perror("epoll_ctl"); return false; }
+
+    server.thread = std::thread(server_loop, std::ref(server));
+    return true;
+}
+
+static void wake(FanoutServer& server) {
+    uint64_t one = 1;
+    if (write(server.wake_fd, &one, sizeof(one)) < 0) perror("write eventfd");
+}
+
+// Sets the frame's 4-byte length word as its whole header.
+static void plain_header(FanoutFrame* f) {
+    uint32_t size_net = htonl(f->size);
+    memcpy(f->header, &size_net, sizeof(size_net));
+    f->header_len = sizeof(size_net);
+}
+
+// Hands the session's current tables to the server thread ahead of the
+// first frame that needs them. Returns false if they could not be queued.
+static bool publish_tables(FanoutServer& server, uint16_t generation) {
+    if (server.published_tables == generation) return true;
+    FanoutFrame* t = take_frame(server);
+    if (!t) return false;
+    const std::vector<unsigned char>& tables = server.session.data;
+    memcpy(t->data, tables.data(), tables.size());
+    t->size = tables.size();
+    plain_header(t);
+    t->seq = 0;
+    t->captured_ns = monotonic_ns();
+    t->keyframe = false;
+    t->tables = generation;
+    t->tables_only = true;
+    t->refs = 0;
+    if (!server.inbox.try_push(t)) {
+        put_frame(server, t);
+        return false;
+    }
+    server.published_tables = generation;
+    server.session.stats.sent++;
+    server.session.stats.sent_bytes += t->size;
+    return true;
+}
+
+void fanout_publish(FanoutServer& server, const PipelineFrame& frame) {
+    // Nobody to send to: don't bother copying.
+    if (server.client_count.load() == 0) {
+        server.idle_drops++;
+        return;
+    }
+    if (frame.jpeg_size > server.pool.buffer_size) {
+        std::cerr << "fanout_publish: " << frame.jpeg_size << "-byte frame exceeds the buffer size\n";
+        return;
+    }
+
+    FanoutFrame* f = take_frame(server);
+    if (!f) {
+        drop_published(server);
+        return;
+    }
+    f->tables = 0;
+    f->tables_only = false;
+    if (server.config.abbreviated) {
+        f->size = jpeg_tables_abbreviate(server.session, frame.jpeg, frame.jpeg_size, f->data, f->tables);
+        if (server.config.report_every && (frame.seq + 1) % server.config.report_every == 0) {
+            jpeg_tables_report(server.session);
+        }
+        if (f->tables && !publish_tables(server, f->tables)) {
+            drop_published(server);
+            put_frame(server, f);
+            return;
+        }
+    } else {
+        memcpy(f->data, frame.jpeg, frame.jpeg_size);
+        f->size = frame.jpeg_size;
+    }
+    plain_header(f);
+    if (server.config.timestamps) {
+        uint32_t size_net = htonl(f->size | LATENCY_STAMP_FLAG);
+        memcpy(f->header, &size_net, sizeof(size_net));
+        latency_write_stamp(f->header + f->header_len, (uint32_t)frame.seq,
+                            capture_timestamp_ns(frame.capture) / 1000);
+        f->header_len += LATENCY_STAMP_SIZE;
+    }
+    f->seq = frame.seq;
+    f->captured_ns = frame.captured_ns;
+    f->keyframe = !frame.delta;
+    f->refs = 0;
+
+    if (!server.inbox.try_push(f)) {
+        drop_published(server);
+        put_frame(server, f);
+        return;
+    }
+    wake(server);
+}
+
+void fanout_stop(FanoutServer& server) {
+    if (server.thread.joinable()) {
+        server.quit = true;
+        wake(server);
+        server.thread.join();
+    }
+
+    FanoutFrame* f;
+    while (server.inbox.try_pop(f)) put_frame(server, f);
+    while (!server.clients.empty()) drop_client(server, server.clients.begin()->second);
+    server.tables = nullptr;
+
+    for (FanoutFrame* frame : server.all_frames) delete frame;
+    server.all_frames.clear();
+    server.free_frames.clear();
+    frame_pool_destroy(server.pool);
+
+    if (server.wake_fd >= 0) close(server.wake_fd);
+    if (server.epoll_fd >= 0) close(server.epoll_fd);
+    if (server.listen_fd >= 0) close(server.listen_fd);
+    server.wake_fd = server.epoll_fd = server.listen_fd = -1;
+}
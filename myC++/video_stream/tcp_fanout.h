@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "frame_pool.h"
+#include "jpeg_tables.h"
+#include "latency.h"
+#include "pipeline.h"
+#include "tcp_send.h"
+
+// Encode-once, send-to-many TCP server for v4l2_tcp_stream.
+//
+// The pipeline's sender publishes each encoded frame once: it is copied into
+// a reference-counted FanoutFrame (the pipeline's buffer, or the capture
+// buffer for MJPEG passthrough, must go back right away) and handed to the
+// server thread. That thread runs an epoll loop that keeps accepting
+// clients and gives every client a reference to the same frame. Sockets are
+// non-blocking; each client drains its own bounded queue as fast as it can.
+// When a client's queue is full the oldest frame it has not started sending
+// is dropped, so a slow viewer skips frames without holding back the rest.
+// The wire format is unchanged: a 4-byte big-endian length, then the JPEG,
+// written with one gathered sendmsg() per frame (or per partial send); with
+// FanoutConfig::timestamps the length is flagged and followed by the
+// frame's sequence number and capture time (latency.h). With
+// TcpSendMode::ZeroCopy each send also pins its frame until the kernel
+// reports the MSG_ZEROCOPY call complete on the socket's error queue.
+//
+// With a latency target (FanoutConfig::latency_ms) the server bounds how
+// much video waits for each viewer. TCP_NOTSENT_LOWAT keeps unsent data in
+// the kernel to a small amount, so the backlog stays where it can be
+// measured and dropped. Before each frame the backlog is read: the socket
+// queue (SIOCOUTQ, sent but unacknowledged plus unsent) plus the client's
+// own queue. It is turned into time with the rate the viewer has been
+// acknowledging bytes while the link was busy. A viewer whose backlog
+// exceeds the target skips the frame. Once a second the JPEG quality
+// follows the best-placed viewer: down 10 when even it skipped over 10% of
+// its frames, up 5 when it skipped none and its backlog is under half the
+// target. Skips (per viewer and second) and quality changes are logged, and
+// the backlog and decision counters can be written out as metrics
+// (fanout_write_metrics).
+//
+// With tile deltas (FanoutConfig::tile_deltas, tile_delta.h) a delta only
+// applies on top of every frame before it, as does an H.264 P-frame. A
+// client that joins, or misses a frame because its queue overflowed or it
+// was over the latency target, has its unsent frames dropped and gets
+// nothing until the next keyframe, which the server asks the pipeline for
+// (PipelineControl::keyframe). A frame dropped before it reaches the server
+// thread (inbox full, no buffer) counts as missed by every client.
+// Behind the frame gate (FanoutConfig::frame_gate) a joining client also
+// asks for a frame, or it would see nothing until the next heartbeat.
+//
+// In an abbreviated session (FanoutConfig::abbreviated, jpeg_tables.h) the
+// publisher takes the tables out of each frame and publishes them as a
+// frame of their own whenever they change. The server keeps the newest
+// tables and queues them to a client ahead of the first frame that needs
+// tables it has not been given: on joining, and after every change. Tables
+// are never dropped from a client's queue.
+
+struct FanoutFrame {
+    int refs;               // client queues and zero-copy sends holding it; server thread only
+    unsigned char* data;    // from the server's FramePool
+    size_t size;
+    unsigned char header[4 + LATENCY_STAMP_SIZE];
+    size_t header_len;
+    uint64_t seq;
+    uint64_t captured_ns;
+    bool keyframe;          // a whole JPEG rather than a tile delta
+    uint16_t tables;        // abbreviated: generation of the tables it needs (0: none)
+    bool tables_only;       // the session's tables rather than a frame
+};
+
+struct FanoutClientStats {
+    uint64_t sent;
+    uint64_t dropped;       // frames skipped because the queue was full
+    uint64_t bytes;
+    uint64_t max_lag_ns;    // oldest frame age when a send completed
+    uint64_t zc_calls;      // MSG_ZEROCOPY sends
+    uint64_t zc_copied;     // completions where the kernel copied anyway
+    uint64_t skipped;       // frames skipped to hold the latency target
+    double max_backlog_ms;  // since the last report
+};
+
+struct FanoutClient {
+    int fd = -1;
+    char addr[64] = {};
+    std::deque<FanoutFrame*> queue;
+    size_t offset = 0;      // bytes of queue.front() (header included) sent
+    bool want_write = false;
+    TcpSendMode mode = TcpSendMode::Gather;
+    bool need_key = false;  // tile deltas: missed a frame, waiting for a keyframe
+    uint16_t tables = 0;    // abbreviated: generation last queued
+
+    // Zero-copy sends not yet completed, oldest first: call number and the
+    // frame whose pages the kernel may still be reading.
+    std::deque<std::pair<uint32_t, FanoutFrame*>> zc_pending;
+    uint32_t zc_next = 0;
+
+    // Backlog, measured before each frame (latency target only)
+    size_t backlog_bytes = 0;     // socket queue plus our queue
+    double backlog_ms = 0;
+    double drain_rate = 0;        // bytes/s acknowledged while the link was busy
+    uint64_t rate_start_ns = 0;
+    uint64_t rate_acked = 0;
+    bool rate_busy = false;       // backlog at the start of the rate window
+    uint64_t window_frames = 0;   // frames offered since the last quality decision
+    uint64_t window_skipped = 0;
+
+    FanoutClientStats stats{};
+};
+
+struct FanoutConfig {
+    int port = 8080;
+    size_t client_queue = 3;  // frames queued per client before dropping
+    int report_every = 300;   // frames between per-client reports (0: never)
+    TcpSendMode send_mode = TcpSendMode::Gather;
+
+    int latency_ms = 0;                // backlog target per viewer (0: off)
+    int notsent_lowat = 64 * 1024;     // TCP_NOTSENT_LOWAT with a latency target
+    PipelineControl* control = nullptr;  // quality to adapt, keyframes to request
+    int max_quality = 75;
+    int min_quality = 20;
+    const char* metrics_path = nullptr;  // rewritten every second when set
+    bool tile_deltas = false;  // frames may depend on the one before (tile deltas, H.264)
+    bool frame_gate = false;
+    bool timestamps = false;   // stamp frames for the viewers' latency stats
+    bool abbreviated = false;  // send the JPEG tables once, frames without them
+};
+
+struct FanoutServer {
+    FanoutConfig config;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;         // eventfd: frames published or stop requested
+    std::thread thread;
+    std::atomic<bool> quit{false};
+
+    BoundedQueue<FanoutFrame*> inbox{8};
+    std::unordered_map<int, FanoutClient> clients;  // by fd; server thread only
+    std::atomic<int> client_count{0};
+
+    FramePool pool;
+    std::mutex free_lock;
+    std::vector<FanoutFrame*> free_frames;
+    std::vector<FanoutFrame*> all_frames;
+
+    uint64_t published = 0;
+    std::atomic<uint64_t> idle_drops{0};   // no client connected
+    std::atomic<uint64_t> inbox_drops{0};  // server thread behind
+    std::atomic<bool> publish_missed{false};  // tile deltas: a frame never reached the clients
+
+    // Abbreviated session
+    JpegTables session;               // publisher only
+    uint16_t published_tables = 0;    // generation in the inbox; publisher only
+    FanoutFrame* tables = nullptr;    // newest tables; server thread only
+
+    // Quality decisions (latency target with a control)
+    uint64_t window_start_ns = 0;
+    uint64_t raise_after_ns = 0;
+    uint64_t quality_down = 0;
+    uint64_t quality_up = 0;
+    uint64_t metrics_ns = 0;
+};
+
+// Listens on config.port and starts the server thread. frame_capacity is
+// the largest frame that will be published.
+bool fanout_start(FanoutServer& server, const FanoutConfig& config, size_t frame_capacity);
+
+// Called from the pipeline's send_frame. Copies the frame once and queues it
+// for every connected client. Never blocks on a client.
+void fanout_publish(FanoutServer& server, const PipelineFrame& frame);
+
+void fanout_stop(FanoutServer& server);
+
+// Writes the per-viewer backlog and the adaptation counters to path in the
+// Prometheus text format (via a temporary file and rename). Server thread.
+bool fanout_write_metrics(FanoutServer& server, const char* path);
@@ -0,0 +1,126 @@
+#include "tcp_send.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+bool parse_tcp_send_mode(const char* name, TcpSendMode& mode) {
+    if (strcmp(name, "split") == 0) mode = TcpSendMode::Split;
+    else if (strcmp(name, "gather") == 0) mode = TcpSendMode::Gather;
+    else if (strcmp(name, "zerocopy") == 0) mode = TcpSendMode::ZeroCopy;
+    else return false;
+    return true;
+}
+
+const char* tcp_send_mode_name(TcpSendMode mode) {
+    switch (mode) {
+    case TcpSendMode::Split: return "split";
+    case TcpSendMode::Gather: return "gather";
+    case TcpSendMode::ZeroCopy: return "zerocopy";
+    }
+    return "?";
+}
+
+bool tcp_enable_zerocopy(int fd) {
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        perror("SO_ZEROCOPY");
+        return false;
+    }
+    return true;
+}
+
+static ssize_t result(ssize_t n) {
+    if (n >= 0) return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    return -1;
+}
+
+ssize_t tcp_send_frame(int fd, TcpSendMode mode, const unsigned char* header, size_t header_len,
+                       const unsigned char* payload, size_t payload_len, size_t offset, bool* zerocopy) {
+    *zerocopy = false;
+
+    if (mode == TcpSendMode::Split) {
+        ssize_t n;
+        do {
+            if (offset < header_len) n = send(fd, header + offset, header_len - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            else n = send(fd, payload + (offset - header_len), payload_len - (offset - header_len),
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        return result(n);
+    }
+
+    iovec iov[2];
+    int iovcnt = 0;
+    if (offset < header_len) {
+        iov[iovcnt].iov_base = const_cast<unsigned char*>(header + offset);
+        iov[iovcnt].iov_len = header_len - offset;
+        iovcnt++;
+        offset = header_len;
+    }
+    iov[iovcnt].iov_base = const_cast<unsigned char*>(payload + (offset - header_len));
+    iov[iovcnt].iov_len = payload_len - (offset - header_len);
+    iovcnt++;
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    int flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+    if (mode == TcpSendMode::ZeroCopy) flags |= MSG_ZEROCOPY;
+
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, flags);
+    } while (n < 0 && errno == EINTR);
+
+    // Out of optmem for pinning pages: send this part by copying.
+    if (n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+        flags &= ~MSG_ZEROCOPY;
+        do {
+            n = sendmsg(fd, &msg, flags);
+        } while (n < 0 && errno == EINTR);
+    }
+
+    if (n > 0 && (flags & MSG_ZEROCOPY)) *zerocopy = true;
+    return result(n);
+}
+
+int tcp_reap_zerocopy(int fd, uint32_t* lo, uint32_t* hi, bool* copied) {
+    char control[128];
+    msghdr msg{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        perror("recvmsg MSG_ERRQUEUE");
+        return -1;
+    }
+
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        sock_extended_err err;
+        memcpy(&err, CMSG_DATA(cm), sizeof(err));
+        if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            errno = err.ee_errno;
+            perror("socket error queue");
+            return -1;
+        }
+        *lo = err.ee_info;
+        *hi = err.ee_data;
+        *copied = err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+        return 1;
+    }
+    return 0;
+}
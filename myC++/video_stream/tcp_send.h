@@ -0,0 +1,40 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Ways of writing one length-prefixed frame to a TCP socket.
+//
+//   Split     send() the header, then send() the payload (the original path)
+//   Gather    one sendmsg() with the header and payload as two iovecs
+//   ZeroCopy  Gather plus MSG_ZEROCOPY: the kernel sends from our pages
+//             instead of copying them, so the buffer must stay untouched
+//             until tcp_reap_zerocopy() reports the call complete
+//
+// Zero-copy calls are numbered per socket from 0 in the order they
+// succeed; completions arrive on the socket's error queue as ranges of
+// those numbers.
+
+enum class TcpSendMode { Split, Gather, ZeroCopy };
+
+// Accepts "split", "gather" or "zerocopy".
+bool parse_tcp_send_mode(const char* name, TcpSendMode& mode);
+const char* tcp_send_mode_name(TcpSendMode mode);
+
+// Sets SO_ZEROCOPY. Returns false if the kernel does not support it.
+bool tcp_enable_zerocopy(int fd);
+
+// Sends as much as the socket takes of header+payload starting at offset
+// (counted from the start of the header). Returns the bytes sent, 0 if the
+// socket would block, or -1 on error. *zerocopy is set when the call was
+// a zero-copy send that will be reported by tcp_reap_zerocopy().
+ssize_t tcp_send_frame(int fd, TcpSendMode mode, const unsigned char* header, size_t header_len,
+                       const unsigned char* payload, size_t payload_len, size_t offset, bool* zerocopy);
+
+// Reads one completion from the error queue into [*lo, *hi] (inclusive
+// range of zero-copy call numbers). *copied is set when the kernel fell back
+// to copying, which is always the case over loopback. Returns 1 for a
+// completion, 0 when the queue is empty, -1 on a real socket error.
+int tcp_reap_zerocopy(int fd, uint32_t* lo, uint32_t* hi, bool* copied);
@@ -5,6 +5,8 @@
 #include <unistd.h>
 #include <opencv2/opencv.hpp>
 
+#include "latency.h"
+
 int main() {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
@@ -24,14 +26,32 @@ int main() {
 
     std::cout << "Connected to server\n";
 
+    // Stamped frames (v4l2_tcp_stream -t) are timed from capture to display;
+    // the clock exchange runs over UDP to the same port.
+    int clock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (clock_fd >= 0 && connect(clock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(clock_fd);
+        clock_fd = -1;
+    }
+    ClockSync clock;
+    LatencyStats latency;
+    bool timed = false;  // a stamped frame came in; keep the clocks in sync
+
     while (true) {
+        // Clock replies are handled while idle until the next frame, never ahead of it
+        if (timed && clock_fd >= 0) clock_sync_wait(clock, clock_fd, sockfd);
         uint32_t size_net;
         ssize_t ret = recv(sockfd, &size_net, sizeof(size_net), MSG_WAITALL);
         if (ret <= 0) break;
 
         uint32_t size = ntohl(size_net);
+        bool stamped = size & LATENCY_STAMP_FLAG;
+        size &= ~LATENCY_STAMP_FLAG;
         if (size == 0) break;
 
+        unsigned char stamp[LATENCY_STAMP_SIZE];
+        if (stamped && recv(sockfd, stamp, sizeof(stamp), MSG_WAITALL) != (ssize_t)sizeof(stamp)) break;
+
         std::vector<uchar> buffer(size);
         size_t received = 0;
         while (received < size) {
@@ -48,11 +68,21 @@ int main() {
         }
 
         cv::imshow("Video Stream", frame);
-        if (cv::waitKey(1) == 27) // ESC to quit
+        int key = cv::waitKey(1);
+        if (stamped) {
+            uint32_t seq;
+            uint64_t capture_us;
+            latency_read_stamp(stamp, seq, capture_us);
+            latency_on_frame(latency, clock, seq, capture_us, latency_now_us());
+            timed = true;
+        }
+        if (key == 27) // ESC to quit
             break;
     }
 
+    latency_summary(latency, clock);
     close(sockfd);
+    if (clock_fd >= 0) close(clock_fd);
     return 0;
 }
 
@@ -0,0 +1,16 @@
+#include "test_pattern.h"
+
+#include <cmath>
+#include <cstdlib>
+
+void test_pattern_frame(unsigned char* p, int width, int height, int f) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += 2, p += 4) {
+            bool box = std::abs(x - f * 8 % width) < 64 && std::abs(y - height / 2) < 64;
+            p[0] = box ? 235 : 16 + (x * 219 / width);
+            p[1] = 128 + (int)(100 * std::sin((x + f) * 0.01));
+            p[2] = box ? 235 : 16 + ((x + 1) * 219 / width);
+            p[3] = 128 + (int)(100 * std::cos((y + f) * 0.01));
+        }
+    }
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Synthetic YUYV frames for running without a camera: a bright box moving
+// 8 pixels per frame over a luma ramp, with slowly varying chroma.
+
+void test_pattern_frame(unsigned char* yuyv, int width, int height, int frame);
@@ -0,0 +1,244 @@
+#include "tile_delta.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TILE_X86 1
+#include <immintrin.h>
+#endif
+
+static const size_t TILE_BYTES = TILE_SIZE * 2;  // one tile row of YUYV
+
+static void put16(uint8_t* p, int v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static int get16(const uint8_t* p) {
+    return p[0] << 8 | p[1];
+}
+
+bool tile_delta_is_delta(const uint8_t* data, size_t size) {
+    return size >= 10 && data[0] == 'V' && data[1] == 'T';
+}
+
+void tile_delta_write_header(uint8_t* out, int width, int height, const uint8_t* map, int changed) {
+    out[0] = 'V';
+    out[1] = 'T';
+    out[2] = TILE_DELTA_VERSION;
+    out[3] = 0;
+    put16(out + 4, width);
+    put16(out + 6, height);
+    put16(out + 8, changed);
+    memcpy(out + 10, map, tile_map_bytes(width, height));
+}
+
+bool tile_delta_read(const uint8_t* data, size_t size, TileDeltaHeader& header) {
+    if (!tile_delta_is_delta(data, size) || data[2] != TILE_DELTA_VERSION) return false;
+    header.width = get16(data + 4);
+    header.height = get16(data + 6);
+    header.changed = get16(data + 8);
+    size_t header_size = tile_delta_header_size(header.width, header.height);
+    if (header.width == 0 || header.height == 0 || size < header_size) return false;
+    header.map = data + 10;
+    header.jpeg = header.changed ? data + header_size : nullptr;
+    header.jpeg_size = size - header_size;
+    return !header.changed || header.jpeg_size > 0;
+}
+
+void tile_delta_runs(const TileDeltaHeader& header, std::vector<TileRun>& runs) {
+    runs.clear();
+    int tiles_x = tile_count_x(header.width);
+    int tiles = tiles_x * tile_count_y(header.height);
+    int placed = 0;
+    for (int t = 0; t < tiles; ++t) {
+        if (!tile_is_set(header.map, t)) continue;
+        int x = t % tiles_x * TILE_SIZE, y = t / tiles_x * TILE_SIZE;
+        int mx = placed % tiles_x * TILE_SIZE, my = placed / tiles_x * TILE_SIZE;
+        placed++;
+
+        TileRun* last = runs.empty() ? nullptr : &runs.back();
+        if (last && last->y == y && last->x + last->width == x && last->mosaic_y == my &&
+            last->mosaic_x + last->width == mx) {
+            last->width += TILE_SIZE;
+        } else {
+            runs.push_back(TileRun{ x, y, mx, my, TILE_SIZE });
+        }
+    }
+}
+
+uint32_t tile_sad_scalar(const uint8_t* a, const uint8_t* b, size_t stride) {
+    uint32_t sad = 0;
+    for (int y = 0; y < TILE_SIZE; ++y, a += stride, b += stride) {
+        for (size_t x = 0; x < TILE_BYTES; ++x) sad += abs(a[x] - b[x]);
+    }
+    return sad;
+}
+
+#ifdef TILE_X86
+
+// psadbw sums the absolute differences of 8 byte pairs into each 64-bit
+// lane, so a 32-byte tile row is two SSE2 or one AVX2 instruction.
+
+__attribute__((target("sse2")))
+uint32_t tile_sad_sse2(const uint8_t* a, const uint8_t* b, size_t stride) {
+    __m128i sum = _mm_setzero_si128();
+    for (int y = 0; y < TILE_SIZE; ++y, a += stride, b += stride) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)a);
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(a + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)b);
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(b + 16));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_sad_epu8(a0, b0), _mm_sad_epu8(a1, b1)));
+    }
+    return (uint32_t)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+__attribute__((target("avx2")))
+uint32_t tile_sad_avx2(const uint8_t* a, const uint8_t* b, size_t stride) {
+    __m256i sum = _mm256_setzero_si256();
+    for (int y = 0; y < TILE_SIZE; ++y, a += stride, b += stride) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)a);
+        __m256i vb = _mm256_loadu_si256((const __m256i*)b);
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return (uint32_t)(_mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8)));
+}
+
+#else
+
+uint32_t tile_sad_sse2(const uint8_t* a, const uint8_t* b, size_t stride) {
+    return tile_sad_scalar(a, b, stride);
+}
+
+uint32_t tile_sad_avx2(const uint8_t* a, const uint8_t* b, size_t stride) {
+    return tile_sad_scalar(a, b, stride);
+}
+
+#endif
+
+struct SadPath {
+    const char* name;
+    tile_sad_fn fn;
+};
+
+static bool sad_path_supported(const char* name) {
+    if (strcmp(name, "scalar") == 0) return true;
+#ifdef TILE_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+static SadPath resolve_sad_path() {
+    static const SadPath paths[] = {
+        { "avx2", tile_sad_avx2 },
+        { "sse2", tile_sad_sse2 },
+        { "scalar", tile_sad_scalar },
+    };
+
+    const char* forced = getenv("TILE_SAD");
+    if (forced) {
+        for (const auto& p : paths) {
+            if (strcmp(forced, p.name) == 0 && sad_path_supported(p.name)) return p;
+        }
+    }
+    for (const auto& p : paths) {
+        if (sad_path_supported(p.name)) return p;
+    }
+    return paths[2];
+}
+
+static const SadPath& selected_sad_path() {
+    static const SadPath path = resolve_sad_path();
+    return path;
+}
+
+uint32_t tile_sad(const uint8_t* a, const uint8_t* b, size_t stride) {
+    return selected_sad_path().fn(a, b, stride);
+}
+
+const char* tile_sad_path() {
+    return selected_sad_path().name;
+}
+
+bool tile_diff_init(TileDiff& diff, int width, int height, uint32_t threshold) {
+    if (width % TILE_SIZE || height % TILE_SIZE) return false;
+    diff.width = width;
+    diff.height = height;
+    diff.threshold = threshold;
+    diff.reference.assign((size_t)width * height * 2, 0);
+    diff.have_reference = false;
+    return true;
+}
+
+int tile_diff_compare(const TileDiff& diff, const uint8_t* yuyv, uint8_t* map) {
+    tile_sad_fn sad = selected_sad_path().fn;
+    size_t stride = (size_t)diff.width * 2;
+    int tiles_x = tile_count_x(diff.width);
+    int tiles_y = tile_count_y(diff.height);
+    memset(map, 0, tile_map_bytes(diff.width, diff.height));
+
+    int changed = 0;
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        size_t row = (size_t)ty * TILE_SIZE * stride;
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            size_t off = row + tx * TILE_BYTES;
+            if (sad(yuyv + off, &diff.reference[off], stride) > diff.threshold) {
+                int t = ty * tiles_x + tx;
+                map[t / 8] |= 0x80 >> (t % 8);
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+void tile_diff_commit(TileDiff& diff, const uint8_t* yuyv, const uint8_t* map) {
+    if (!map) {
+        memcpy(diff.reference.data(), yuyv, diff.reference.size());
+        diff.have_reference = true;
+        return;
+    }
+
+    size_t stride = (size_t)diff.width * 2;
+    int tiles_x = tile_count_x(diff.width);
+    int tiles = tiles_x * tile_count_y(diff.height);
+    for (int t = 0; t < tiles; ++t) {
+        if (!tile_is_set(map, t)) continue;
+        size_t off = (size_t)(t / tiles_x) * TILE_SIZE * stride + t % tiles_x * TILE_BYTES;
+        for (int y = 0; y < TILE_SIZE; ++y, off += stride) memcpy(&diff.reference[off], yuyv + off, TILE_BYTES);
+    }
+}
+
+void tile_diff_reset(TileDiff& diff) {
+    diff.have_reference = false;
+}
+
+void tile_delta_gather(const uint8_t* yuyv, int width, int height, const uint8_t* map, uint8_t* mosaic) {
+    size_t stride = (size_t)width * 2;
+    int tiles_x = tile_count_x(width);
+    int tiles = tiles_x * tile_count_y(height);
+    int placed = 0;
+    for (int t = 0; t < tiles; ++t) {
+        if (!tile_is_set(map, t)) continue;
+        const uint8_t* src = yuyv + (size_t)(t / tiles_x) * TILE_SIZE * stride + t % tiles_x * TILE_BYTES;
+        uint8_t* dst = mosaic + (size_t)(placed / tiles_x) * TILE_SIZE * stride + placed % tiles_x * TILE_BYTES;
+        for (int y = 0; y < TILE_SIZE; ++y, src += stride, dst += stride) memcpy(dst, src, TILE_BYTES);
+        placed++;
+    }
+
+    // Blank the rest of the last mosaic row; it is encoded but never shown.
+    if (placed % tiles_x) {
+        uint8_t* row = mosaic + (size_t)(placed / tiles_x) * TILE_SIZE * stride;
+        for (int y = 0; y < TILE_SIZE; ++y, row += stride) {
+            uint8_t* p = row + placed % tiles_x * TILE_BYTES;
+            for (uint8_t* end = row + stride; p < end; p += 4) {
+                p[0] = 16; p[1] = 128; p[2] = 16; p[3] = 128;
+            }
+        }
+    }
+}
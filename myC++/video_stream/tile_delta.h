@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tile-diff delta frames for mostly static scenes.
+//
+// The sender compares each YUYV frame with a reference, the picture as the
+// viewers have it, in 16x16 tiles (sum of absolute differences over the
+// tile's 512 YUYV bytes). Tiles over a threshold are copied, in raster
+// order, into a mosaic as wide as the frame, and only the mosaic is
+// JPEG-encoded. Tiles are MCU-aligned for every sampling the encoder uses,
+// so no DCT block mixes two tiles. The reference is updated with the tiles
+// that went out, so slow drift adds up until a tile is resent rather than
+// being lost between consecutive frames.
+//
+// On the wire a keyframe is an ordinary JPEG. A delta frame starts with a
+// header that cannot be mistaken for one (a JPEG starts with FF D8):
+//
+//   ['V' 'T'] [version (1)] [reserved (1)] [width (2)] [height (2)]
+//   [changed tiles (2)] [tile map: one bit per tile, raster order, MSB first]
+//   [JPEG of the mosaic, absent when no tile changed]
+//
+// Viewers decode the mosaic and copy each tile to its place in the picture
+// they keep. A delta only applies on top of the frame before it, so a viewer
+// that missed one waits for (or asks for) the next keyframe.
+
+static const int TILE_SIZE = 16;
+static const uint8_t TILE_DELTA_VERSION = 1;
+
+struct TileDeltaHeader {
+    int width = 0;
+    int height = 0;
+    int changed = 0;
+    const uint8_t* map = nullptr;     // tiles_x * tiles_y bits
+    const uint8_t* jpeg = nullptr;    // mosaic, nullptr when changed is 0
+    size_t jpeg_size = 0;
+};
+
+inline int tile_count_x(int width) { return (width + TILE_SIZE - 1) / TILE_SIZE; }
+inline int tile_count_y(int height) { return (height + TILE_SIZE - 1) / TILE_SIZE; }
+inline size_t tile_map_bytes(int width, int height) { return (tile_count_x(width) * tile_count_y(height) + 7) / 8; }
+
+inline bool tile_is_set(const uint8_t* map, int tile) { return map[tile / 8] & (0x80 >> (tile % 8)); }
+
+// Height of the mosaic holding `changed` tiles of a frame `width` wide.
+inline int tile_mosaic_height(int width, int changed) {
+    int per_row = tile_count_x(width);
+    return (changed + per_row - 1) / per_row * TILE_SIZE;
+}
+
+// Size of the header and tile map in front of the mosaic JPEG.
+inline size_t tile_delta_header_size(int width, int height) { return 10 + tile_map_bytes(width, height); }
+
+// Whether a received frame is a delta (otherwise it is a plain JPEG).
+bool tile_delta_is_delta(const uint8_t* data, size_t size);
+
+// Writes tile_delta_header_size() bytes.
+void tile_delta_write_header(uint8_t* out, int width, int height, const uint8_t* map, int changed);
+
+// Parses a delta frame; the pointers refer into data.
+bool tile_delta_read(const uint8_t* data, size_t size, TileDeltaHeader& header);
+
+// A run of changed tiles that are neighbours both in the picture and in the
+// mosaic, so a viewer can copy it as one rectangle.
+struct TileRun {
+    int x, y;                 // picture position in pixels
+    int mosaic_x, mosaic_y;   // mosaic position in pixels
+    int width;                // pixels; the height is always TILE_SIZE
+};
+
+void tile_delta_runs(const TileDeltaHeader& header, std::vector<TileRun>& runs);
+
+// Sender side.
+
+// SAD of one 16x16 tile (32 bytes by 16 rows of YUYV).
+typedef uint32_t (*tile_sad_fn)(const uint8_t* a, const uint8_t* b, size_t stride);
+
+uint32_t tile_sad_scalar(const uint8_t* a, const uint8_t* b, size_t stride);
+uint32_t tile_sad_sse2(const uint8_t* a, const uint8_t* b, size_t stride);
+uint32_t tile_sad_avx2(const uint8_t* a, const uint8_t* b, size_t stride);
+
+// Picks the fastest path the CPU supports on first use, like yuyv_to_rgb24().
+// Setting TILE_SAD=scalar|sse2|avx2 in the environment forces a path.
+uint32_t tile_sad(const uint8_t* a, const uint8_t* b, size_t stride);
+const char* tile_sad_path();
+
+struct TileDiff {
+    int width = 0;
+    int height = 0;
+    uint32_t threshold = 0;           // per tile SAD that counts as a change
+    std::vector<uint8_t> reference;   // YUYV, as last sent
+    bool have_reference = false;
+};
+
+// Frames must be whole tiles in both directions.
+bool tile_diff_init(TileDiff& diff, int width, int height, uint32_t threshold);
+
+// Fills map (tile_map_bytes()) with the tiles of yuyv that differ from the
+// reference and returns how many there are. Does not change the reference.
+int tile_diff_compare(const TileDiff& diff, const uint8_t* yuyv, uint8_t* map);
+
+// Records that the tiles in map (or the whole frame, when map is nullptr)
+// were sent.
+void tile_diff_commit(TileDiff& diff, const uint8_t* yuyv, const uint8_t* map);
+
+// Forgets the reference; the next frame has to be a keyframe.
+void tile_diff_reset(TileDiff& diff);
+
+// Copies the tiles in map into mosaic, a YUYV image width pixels wide and
+// tile_mosaic_height() rows high.
+void tile_delta_gather(const uint8_t* yuyv, int width, int height, const uint8_t* map, uint8_t* mosaic);
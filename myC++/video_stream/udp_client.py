@@ -38,6 +38,11 @@ def main():
             part_index = struct.unpack('!H', packet[6:8])[0]
             payload = packet[8:]
 
+            # Parity packets (sender -F) carry indices past total_parts; this
+            # client does not use them for recovery.
+            if part_index >= total_parts:
+                continue
+
             # Store chunk
             frame_buffer[frame_id][part_index] = payload
             expected_parts[frame_id] = total_parts
@@ -0,0 +1,60 @@
+#include "udp_feedback.h"
+
+#include <cmath>
+
+static bool older(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// Closes the books on the frame being received.
+static void finish_frame(ReportBuilder& rb) {
+    rb.expected += rb.total_parts;
+    rb.received += rb.parts < rb.total_parts ? rb.parts : rb.total_parts;
+}
+
+void report_on_packet(ReportBuilder& rb, const unsigned char* packet, size_t len, uint64_t now_us) {
+    UdpHeader h;
+    if (!udp_read_header(packet, len, h) || h.part_index == UDP_CONTROL_INDEX) return;
+    rb.bytes += len;
+    if (!rb.last_report_us) rb.last_report_us = now_us;
+
+    if (rb.have_frame && !older(rb.frame_id, h.frame_id)) {
+        // Same frame, or a late or resent chunk of an older one.
+        if (h.frame_id == rb.frame_id && h.part_index < h.total_parts) rb.parts++;
+        return;
+    }
+
+    // First packet of a newer frame.
+    uint32_t gap = 1;
+    if (rb.have_frame) {
+        finish_frame(rb);
+        gap = h.frame_id - rb.frame_id;
+        rb.expected += (uint64_t)(gap - 1) * rb.total_parts;  // frames lost outright
+
+        double spacing = (double)(now_us - rb.last_arrival_us) / gap;
+        if (rb.spacing_us == 0) rb.spacing_us = spacing;
+        double d = std::fabs((double)(now_us - rb.last_arrival_us) - rb.spacing_us * gap);
+        rb.jitter_us += (d - rb.jitter_us) / 16;
+        rb.spacing_us += (spacing - rb.spacing_us) / 16;
+    }
+    rb.have_frame = true;
+    rb.frame_id = h.frame_id;
+    rb.total_parts = h.total_parts;
+    rb.parts = h.part_index < h.total_parts ? 1 : 0;
+    rb.last_arrival_us = now_us;
+}
+
+bool report_build(ReportBuilder& rb, uint64_t now_us, unsigned char* out) {
+    if (!rb.have_frame || now_us - rb.last_report_us < rb.interval_ms * 1000ULL) return false;
+
+    UdpReport report;
+    report.frame_id = rb.frame_id;
+    report.loss = rb.expected ? 1.0 - (double)rb.received / rb.expected : 0.0;
+    report.goodput = (uint32_t)(rb.bytes * 1e6 / (now_us - rb.last_report_us));
+    report.jitter_us = (uint32_t)rb.jitter_us;
+    udp_write_report(out, report);
+
+    rb.expected = rb.received = rb.bytes = 0;
+    rb.last_report_us = now_us;
+    return true;
+}
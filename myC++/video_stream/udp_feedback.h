@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "udp_protocol.h"
+
+// Receiver reports for UDP rate control (rate_control.h). ReportBuilder
+// watches every datagram and produces a report (udp_protocol.h) every
+// interval_ms:
+//   loss     data chunks missing when a frame is overtaken by the next one,
+//            counting frames that never arrived at the previous frame's
+//            size; retransmitted chunks arrive later and do not hide it
+//   goodput  bytes received per second
+//   jitter   RFC 3550 style smoothed deviation of frame arrival times from
+//            the average frame spacing; it grows as a queue builds up on
+//            the path, before anything is dropped
+
+struct ReportBuilder {
+    uint32_t interval_ms = 500;
+    uint64_t last_report_us = 0;
+
+    // Current interval
+    uint64_t expected = 0;
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+
+    // Frame being received
+    bool have_frame = false;
+    uint32_t frame_id = 0;
+    uint16_t total_parts = 0;
+    uint32_t parts = 0;
+
+    // Frame arrival jitter
+    uint64_t last_arrival_us = 0;
+    double spacing_us = 0;   // smoothed arrival spacing per frame
+    double jitter_us = 0;
+};
+
+void report_on_packet(ReportBuilder& rb, const unsigned char* packet, size_t len, uint64_t now_us);
+
+// Fills UDP_REPORT_SIZE bytes into out and starts a new interval when a
+// report is due.
+bool report_build(ReportBuilder& rb, uint64_t now_us, unsigned char* out);
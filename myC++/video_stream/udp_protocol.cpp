@@ -0,0 +1,165 @@
+#include "udp_protocol.h"
+
+#include <arpa/inet.h>
+
+#include <cstring>
+
+static void write_u64(unsigned char* p, uint64_t v) {
+    for (int i = 7; i >= 0; --i, v >>= 8) p[i] = (unsigned char)v;
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = v << 8 | p[i];
+    return v;
+}
+
+// Control packet of the given extension type: returns false unless p holds
+// at least len_min bytes starting with one.
+static bool read_control(const unsigned char* p, size_t len, size_t len_min, uint8_t type, UdpHeader& h,
+                         UdpExtHeader& ext) {
+    if (len < len_min || !udp_read_header(p, len, h) || h.part_index != UDP_CONTROL_INDEX) return false;
+    udp_read_ext(p + UDP_HEADER_SIZE, len - UDP_HEADER_SIZE, ext);
+    return ext.version == UDP_EXT_VERSION && ext.type == type;
+}
+
+void udp_write_header(unsigned char* p, const UdpHeader& h) {
+    uint32_t fid = htonl(h.frame_id);
+    uint16_t parts = htons(h.total_parts);
+    uint16_t index = htons(h.part_index);
+    memcpy(p, &fid, 4);
+    memcpy(p + 4, &parts, 2);
+    memcpy(p + 6, &index, 2);
+}
+
+bool udp_read_header(const unsigned char* p, size_t len, UdpHeader& h) {
+    if (len < UDP_HEADER_SIZE) return false;
+    memcpy(&h.frame_id, p, 4);
+    memcpy(&h.total_parts, p + 4, 2);
+    memcpy(&h.part_index, p + 6, 2);
+    h.frame_id = ntohl(h.frame_id);
+    h.total_parts = ntohs(h.total_parts);
+    h.part_index = ntohs(h.part_index);
+    return h.total_parts > 0;
+}
+
+void udp_write_ext(unsigned char* p, const UdpExtHeader& ext) {
+    uint16_t arg16 = htons(ext.arg16);
+    uint32_t arg32 = htonl(ext.arg32);
+    p[0] = ext.version;
+    p[1] = ext.type;
+    memcpy(p + 2, &arg16, 2);
+    memcpy(p + 4, &arg32, 4);
+}
+
+bool udp_read_ext(const unsigned char* p, size_t len, UdpExtHeader& ext) {
+    if (len < UDP_EXT_SIZE) return false;
+    ext.version = p[0];
+    ext.type = p[1];
+    memcpy(&ext.arg16, p + 2, 2);
+    memcpy(&ext.arg32, p + 4, 4);
+    ext.arg16 = ntohs(ext.arg16);
+    ext.arg32 = ntohl(ext.arg32);
+    return true;
+}
+
+void udp_write_report(unsigned char* p, const UdpReport& report) {
+    double loss = report.loss < 0 ? 0 : (report.loss > 1 ? 1 : report.loss);
+    udp_write_header(p, UdpHeader{ report.frame_id, 1, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE,
+                  UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_REPORT, (uint16_t)(loss * 65535 + 0.5), report.goodput });
+    uint32_t jitter = htonl(report.jitter_us);
+    memcpy(p + UDP_HEADER_SIZE + UDP_EXT_SIZE, &jitter, 4);
+}
+
+bool udp_read_report(const unsigned char* p, size_t len, UdpReport& report) {
+    UdpHeader h;
+    UdpExtHeader ext;
+    if (!read_control(p, len, UDP_REPORT_SIZE, UDP_EXT_REPORT, h, ext)) return false;
+
+    report.frame_id = h.frame_id;
+    report.loss = ext.arg16 / 65535.0;
+    report.goodput = ext.arg32;
+    memcpy(&report.jitter_us, p + UDP_HEADER_SIZE + UDP_EXT_SIZE, 4);
+    report.jitter_us = ntohl(report.jitter_us);
+    return true;
+}
+
+void udp_write_keyframe_request(unsigned char* p, uint32_t frame_id) {
+    udp_write_header(p, UdpHeader{ frame_id, 1, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE, UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_KEYFRAME, 0, 0 });
+}
+
+bool udp_is_keyframe_request(const unsigned char* p, size_t len) {
+    UdpHeader h;
+    UdpExtHeader ext;
+    return read_control(p, len, UDP_KEYFRAME_REQUEST_SIZE, UDP_EXT_KEYFRAME, h, ext);
+}
+
+void udp_write_clock_request(unsigned char* p, uint64_t t0) {
+    udp_write_header(p, UdpHeader{ 0, 1, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE, UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_CLOCK, 0, 0 });
+    write_u64(p + UDP_HEADER_SIZE + UDP_EXT_SIZE, t0);
+}
+
+void udp_write_clock_reply(unsigned char* p, uint64_t t0, uint64_t t1, uint64_t t2) {
+    udp_write_header(p, UdpHeader{ 0, 1, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE, UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_CLOCK, 1, 0 });
+    unsigned char* t = p + UDP_HEADER_SIZE + UDP_EXT_SIZE;
+    write_u64(t, t0);
+    write_u64(t + 8, t1);
+    write_u64(t + 16, t2);
+}
+
+bool udp_read_clock(const unsigned char* p, size_t len, UdpClock& clock) {
+    UdpHeader h;
+    UdpExtHeader ext;
+    if (!read_control(p, len, UDP_CLOCK_REQUEST_SIZE, UDP_EXT_CLOCK, h, ext)) return false;
+    if (ext.arg16 == 1 && len < UDP_CLOCK_REPLY_SIZE) return false;
+
+    const unsigned char* t = p + UDP_HEADER_SIZE + UDP_EXT_SIZE;
+    clock.reply = ext.arg16 == 1;
+    clock.t0 = read_u64(t);
+    clock.t1 = clock.reply ? read_u64(t + 8) : 0;
+    clock.t2 = clock.reply ? read_u64(t + 16) : 0;
+    return true;
+}
+
+void udp_write_timestamp(unsigned char* p, uint32_t frame_id, uint16_t total_parts, uint64_t capture_us) {
+    udp_write_header(p, UdpHeader{ frame_id, total_parts, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE, UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_TIMESTAMP, 0, 0 });
+    write_u64(p + UDP_HEADER_SIZE + UDP_EXT_SIZE, capture_us);
+}
+
+bool udp_read_timestamp(const unsigned char* p, size_t len, uint32_t& frame_id, uint64_t& capture_us) {
+    UdpHeader h;
+    UdpExtHeader ext;
+    if (!read_control(p, len, UDP_TIMESTAMP_SIZE, UDP_EXT_TIMESTAMP, h, ext)) return false;
+    frame_id = h.frame_id;
+    capture_us = read_u64(p + UDP_HEADER_SIZE + UDP_EXT_SIZE);
+    return true;
+}
+
+void udp_write_tables_header(unsigned char* p, uint32_t frame_id, uint16_t total_parts, uint16_t generation,
+                             size_t size) {
+    udp_write_header(p, UdpHeader{ frame_id, total_parts, UDP_CONTROL_INDEX });
+    udp_write_ext(p + UDP_HEADER_SIZE, UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_TABLES, generation, (uint32_t)size });
+}
+
+bool udp_read_tables(const unsigned char* p, size_t len, uint16_t& generation, const unsigned char*& tables,
+                     size_t& size) {
+    UdpHeader h;
+    UdpExtHeader ext;
+    if (!read_control(p, len, UDP_TABLES_HEADER_SIZE, UDP_EXT_TABLES, h, ext)) return false;
+    if (ext.arg16 == 0 || ext.arg32 != len - UDP_TABLES_HEADER_SIZE) return false;
+    generation = ext.arg16;
+    tables = p + UDP_TABLES_HEADER_SIZE;
+    size = ext.arg32;
+    return true;
+}
+
+int udp_fec_groups(int total_parts, int fec_percent) {
+    if (fec_percent <= 0) return 0;
+    int groups = (total_parts * fec_percent + 99) / 100;
+    return groups < total_parts ? groups : total_parts;
+}
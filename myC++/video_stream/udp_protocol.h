@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Wire format of the UDP video stream.
+//
+// Every datagram starts with the original 8-byte header, big-endian:
+//
+//   [frame_id (4)] [total_parts (2)] [part_index (2)]
+//
+// part_index < total_parts: a chunk of the JPEG. Chunks are concatenated in
+// index order; every chunk but the last has the same length.
+//
+// part_index >= total_parts: an extension packet. Receivers that predate
+// extensions drop these because the index is out of range. The base header
+// is followed by an 8-byte versioned extension header:
+//
+//   [version (1)] [type (1)] [arg16 (2)] [arg32 (4)]
+//
+// Type UDP_EXT_XOR_PARITY (version 1): part_index = total_parts + g is the
+// XOR of every chunk i with i % arg16 == g, chunks shorter than the parity
+// payload counted as zero-padded. arg16 is the number of parity groups and
+// arg32 the JPEG size, which gives the length of a rebuilt last chunk.
+// Interleaving the groups means a burst of up to arg16 consecutive losses
+// costs at most one chunk per group, and each group can rebuild one chunk.
+//
+// Type UDP_EXT_NACK (version 1) travels back from receiver to sender: the
+// base header names the frame, part_index is UDP_CONTROL_INDEX, and one or
+// more extension headers follow, each asking for chunk arg16 + k for every
+// bit k set in the mask arg32.
+//
+// Type UDP_EXT_REPORT (version 1) is a receiver report, also sent back to
+// the sender every half second or so: frame_id is the newest frame seen,
+// part_index is UDP_CONTROL_INDEX, arg16 the fraction of data chunks lost
+// (of 65535) and arg32 the goodput in bytes per second, followed by the
+// frame inter-arrival jitter in microseconds (4 bytes).
+//
+// Type UDP_EXT_KEYFRAME (version 1) asks the sender for a whole frame when
+// a receiver of tile deltas (tile_delta.h) missed one: frame_id is the
+// newest frame shown, part_index is UDP_CONTROL_INDEX, and the arguments
+// are zero.
+//
+// Type UDP_EXT_CLOCK (version 1) measures the offset between the receiver's
+// clock and the sender's (latency.h). The receiver sends arg16 = 0 followed
+// by its send time t0; the sender answers with arg16 = 1 followed by t0, its
+// receive time t1 and its send time t2. Times are CLOCK_MONOTONIC in
+// microseconds (8 bytes each), frame_id is zero and part_index is
+// UDP_CONTROL_INDEX.
+//
+// Type UDP_EXT_TIMESTAMP (version 1) goes out ahead of a frame's chunks when
+// the streamer stamps frames (-t): frame_id and total_parts are the frame's,
+// part_index is UDP_CONTROL_INDEX, the arguments are zero, and the capture
+// time follows (8 bytes, microseconds of the sender's CLOCK_MONOTONIC).
+// frame_id doubles as the sequence number.
+//
+// Type UDP_EXT_TABLES (version 1) carries the JPEG tables of an abbreviated
+// session (jpeg_tables.h) ahead of a frame's chunks: frame_id and
+// total_parts are the frame's, part_index is UDP_CONTROL_INDEX, arg16 is the
+// tables' generation and arg32 their size, and the tables-only JPEG follows.
+
+static const size_t UDP_HEADER_SIZE = 8;
+static const size_t UDP_EXT_SIZE = 8;
+static const uint8_t UDP_EXT_VERSION = 1;
+static const uint16_t UDP_CONTROL_INDEX = 0xFFFF;
+static const size_t UDP_NACK_MAX_RANGES = 16;  // extension headers per NACK
+static const size_t UDP_REPORT_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE + 4;
+static const size_t UDP_KEYFRAME_REQUEST_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE;
+static const size_t UDP_CLOCK_REQUEST_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE + 8;
+static const size_t UDP_CLOCK_REPLY_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE + 24;
+static const size_t UDP_TIMESTAMP_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE + 8;
+static const size_t UDP_TABLES_HEADER_SIZE = UDP_HEADER_SIZE + UDP_EXT_SIZE;
+
+enum UdpExtType : uint8_t {
+    UDP_EXT_XOR_PARITY = 1,
+    UDP_EXT_NACK = 2,
+    UDP_EXT_REPORT = 3,
+    UDP_EXT_KEYFRAME = 4,
+    UDP_EXT_CLOCK = 5,
+    UDP_EXT_TIMESTAMP = 6,
+    UDP_EXT_TABLES = 7,
+};
+
+struct UdpHeader {
+    uint32_t frame_id;
+    uint16_t total_parts;
+    uint16_t part_index;
+};
+
+struct UdpExtHeader {
+    uint8_t version;
+    uint8_t type;
+    uint16_t arg16;
+    uint32_t arg32;
+};
+
+struct UdpReport {
+    uint32_t frame_id;       // newest frame seen
+    double loss;             // 0..1
+    uint32_t goodput;        // bytes per second
+    uint32_t jitter_us;
+};
+
+struct UdpClock {
+    bool reply;
+    uint64_t t0;  // receiver's send time
+    uint64_t t1;  // sender's receive time (reply only)
+    uint64_t t2;  // sender's send time (reply only)
+};
+
+void udp_write_header(unsigned char* p, const UdpHeader& h);
+bool udp_read_header(const unsigned char* p, size_t len, UdpHeader& h);
+
+void udp_write_ext(unsigned char* p, const UdpExtHeader& ext);
+bool udp_read_ext(const unsigned char* p, size_t len, UdpExtHeader& ext);
+
+// Writes UDP_REPORT_SIZE bytes.
+void udp_write_report(unsigned char* p, const UdpReport& report);
+bool udp_read_report(const unsigned char* p, size_t len, UdpReport& report);
+
+// Writes UDP_KEYFRAME_REQUEST_SIZE bytes.
+void udp_write_keyframe_request(unsigned char* p, uint32_t frame_id);
+bool udp_is_keyframe_request(const unsigned char* p, size_t len);
+
+// Write UDP_CLOCK_REQUEST_SIZE and UDP_CLOCK_REPLY_SIZE bytes.
+void udp_write_clock_request(unsigned char* p, uint64_t t0);
+void udp_write_clock_reply(unsigned char* p, uint64_t t0, uint64_t t1, uint64_t t2);
+bool udp_read_clock(const unsigned char* p, size_t len, UdpClock& clock);
+
+// Writes UDP_TIMESTAMP_SIZE bytes.
+void udp_write_timestamp(unsigned char* p, uint32_t frame_id, uint16_t total_parts, uint64_t capture_us);
+bool udp_read_timestamp(const unsigned char* p, size_t len, uint32_t& frame_id, uint64_t& capture_us);
+
+// Writes UDP_TABLES_HEADER_SIZE bytes; the tables follow.
+void udp_write_tables_header(unsigned char* p, uint32_t frame_id, uint16_t total_parts, uint16_t generation,
+                             size_t size);
+// tables points into p.
+bool udp_read_tables(const unsigned char* p, size_t len, uint16_t& generation, const unsigned char*& tables,
+                     size_t& size);
+
+// Parity groups for a frame of total_parts chunks at fec_percent overhead.
+int udp_fec_groups(int total_parts, int fec_percent);
@@ -0,0 +1,189 @@
+#include "udp_reassembly.h"
+
+#include <algorithm>
+
+// Rebuilds the one missing chunk of group g, if it is the only one missing.
+static void try_recover(Reassembler& r, ReassemblyFrame& f, int g) {
+    if (f.parity[g].empty()) return;
+
+    int missing = -1;
+    for (int i = g; i < f.total_parts; i += f.groups) {
+        if (!f.parts[i].empty()) continue;
+        if (missing >= 0) return;  // two or more lost: XOR cannot help
+        missing = i;
+    }
+    if (missing < 0) return;
+
+    size_t chunk = f.parity[g].size();
+    size_t len = missing < f.total_parts - 1 ? chunk : f.frame_size - (size_t)missing * chunk;
+    if (len > chunk) return;  // inconsistent sizes; give up on this group
+
+    std::vector<uint8_t> rebuilt = f.parity[g];
+    for (int i = g; i < f.total_parts; i += f.groups) {
+        if (i == missing) continue;
+        const std::vector<uint8_t>& part = f.parts[i];
+        for (size_t k = 0; k < part.size() && k < chunk; ++k) rebuilt[k] ^= part[k];
+    }
+    rebuilt.resize(len);
+    f.parts[missing] = std::move(rebuilt);
+    f.received_parts++;
+    f.recovered++;
+    r.stats.recovered_parts++;
+}
+
+static bool older(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+bool reassembler_add(Reassembler& r, const uint8_t* packet, size_t len, uint64_t now_ms,
+                     std::vector<uint8_t>& jpeg, uint32_t* frame_id) {
+    UdpHeader h;
+    if (!udp_read_header(packet, len, h)) return false;
+    if (r.have_completed && !older(r.last_completed, h.frame_id)) {
+        bool restarted = r.last_completed - h.frame_id > r.restart_gap ||
+                         now_ms - r.last_completed_ms > r.session_ms;
+        if (!restarted) return false;  // late
+        r.stats.restarts++;
+        r.frames.clear();
+        r.have_completed = false;
+    }
+
+    ReassemblyFrame& f = r.frames[h.frame_id];
+    f.last_update_ms = now_ms;
+    if (f.parts.empty()) {
+        f.parts.resize(h.total_parts);
+        f.total_parts = h.total_parts;
+        f.first_ms = now_ms;
+    }
+    if (h.total_parts != f.total_parts || f.complete) return false;
+
+    if (h.part_index < h.total_parts) {
+        if (!f.parts[h.part_index].empty()) return false;
+        f.parts[h.part_index].assign(packet + UDP_HEADER_SIZE, packet + len);
+        f.received_parts++;
+        f.highest = std::max(f.highest, (int)h.part_index);
+        if (!f.requested.empty() && f.requested[h.part_index]) {
+            f.repaired++;
+            r.stats.repaired_parts++;
+        }
+        if (f.groups) try_recover(r, f, h.part_index % f.groups);
+    } else {
+        UdpExtHeader ext;
+        if (!udp_read_ext(packet + UDP_HEADER_SIZE, len - UDP_HEADER_SIZE, ext)) return false;
+        if (ext.version != UDP_EXT_VERSION || ext.type != UDP_EXT_XOR_PARITY) return false;  // unknown: ignore
+        int g = h.part_index - h.total_parts;
+        if (ext.arg16 == 0 || g >= ext.arg16) return false;
+        if (!f.groups) {
+            f.groups = ext.arg16;
+            f.frame_size = ext.arg32;
+            f.parity.resize(f.groups);
+        }
+        if (ext.arg16 != f.groups || !f.parity[g].empty()) return false;
+        f.parity[g].assign(packet + UDP_HEADER_SIZE + UDP_EXT_SIZE, packet + len);
+        try_recover(r, f, g);
+    }
+
+    if (f.received_parts < f.total_parts) return false;
+    f.complete = true;
+    return reassembler_poll(r, now_ms, jpeg, frame_id);
+}
+
+bool reassembler_poll(Reassembler& r, uint64_t now_ms, std::vector<uint8_t>& jpeg, uint32_t* frame_id) {
+    for (;;) {
+        auto oldest = r.frames.end();
+        bool any_complete = false;
+        for (auto it = r.frames.begin(); it != r.frames.end(); ++it) {
+            if (oldest == r.frames.end() || older(it->first, oldest->first)) oldest = it;
+            any_complete |= it->second.complete;
+        }
+        if (!any_complete) return false;
+
+        ReassemblyFrame& f = oldest->second;
+        if (!f.complete) {
+            // A newer frame is ready; wait while this one may still be repaired.
+            if (now_ms - f.first_ms < r.repair_ms) return false;
+            r.stats.abandoned++;
+            r.frames.erase(oldest);
+            continue;
+        }
+
+        jpeg.clear();
+        for (const auto& part : f.parts) jpeg.insert(jpeg.end(), part.begin(), part.end());
+        r.stats.completed++;
+        if (f.recovered) r.stats.recovered_frames++;
+        if (f.repaired) r.stats.repaired_frames++;
+        if (frame_id) *frame_id = oldest->first;
+
+        // Anything older than this frame will never be shown.
+        r.have_completed = true;
+        r.last_completed = oldest->first;
+        r.last_completed_ms = now_ms;
+        r.frames.erase(oldest);
+        return true;
+    }
+}
+
+// Packs the chunk indices (ascending) into NACK datagrams of up to
+// UDP_NACK_MAX_RANGES 32-chunk ranges each.
+static void build_nacks(uint32_t frame_id, uint16_t total_parts, const std::vector<int>& missing,
+                        std::vector<std::vector<uint8_t>>& out) {
+    std::vector<uint8_t>* dgram = nullptr;
+    UdpExtHeader range{ UDP_EXT_VERSION, UDP_EXT_NACK, 0, 0 };
+    auto flush = [&] {
+        if (!range.arg32) return;
+        if (!dgram || dgram->size() == UDP_HEADER_SIZE + UDP_NACK_MAX_RANGES * UDP_EXT_SIZE) {
+            out.emplace_back(UDP_HEADER_SIZE);
+            dgram = &out.back();
+            udp_write_header(dgram->data(), UdpHeader{ frame_id, total_parts, UDP_CONTROL_INDEX });
+        }
+        size_t at = dgram->size();
+        dgram->resize(at + UDP_EXT_SIZE);
+        udp_write_ext(dgram->data() + at, range);
+        range.arg32 = 0;
+    };
+
+    for (int i : missing) {
+        if (range.arg32 && i - range.arg16 >= 32) flush();
+        if (!range.arg32) range.arg16 = i;
+        range.arg32 |= 1u << (i - range.arg16);
+    }
+    flush();
+}
+
+void reassembler_nacks(Reassembler& r, uint64_t now_ms, std::vector<std::vector<uint8_t>>& out) {
+    if (!r.repair_ms) return;
+
+    std::vector<int> missing;
+    for (auto& [id, f] : r.frames) {
+        if (f.complete || now_ms - f.first_ms >= r.repair_ms) continue;
+
+        bool quiet = now_ms - f.last_update_ms >= r.nack_delay_ms;
+        bool retry = f.last_nack_ms && now_ms - f.last_nack_ms >= r.nack_retry_ms;
+        int limit = quiet ? f.total_parts : f.highest;
+        if (f.requested.empty()) f.requested.resize(f.total_parts);
+
+        missing.clear();
+        for (int i = 0; i < limit; ++i) {
+            if (f.parts[i].empty() && (!f.requested[i] || retry)) missing.push_back(i);
+        }
+        if (missing.empty()) continue;
+
+        for (int i : missing) f.requested[i] = true;
+        f.last_nack_ms = now_ms;
+        size_t before = out.size();
+        build_nacks(id, f.total_parts, missing, out);
+        r.stats.nacks += out.size() - before;
+        r.stats.requested_parts += missing.size();
+    }
+}
+
+void reassembler_expire(Reassembler& r, uint64_t now_ms) {
+    for (auto it = r.frames.begin(); it != r.frames.end();) {
+        if (now_ms - it->second.last_update_ms > r.timeout_ms) {
+            r.stats.expired++;
+            it = r.frames.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
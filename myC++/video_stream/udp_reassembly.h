@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "udp_protocol.h"
+
+// Receiver side of udp_protocol.h: collects chunks per frame, rebuilds a
+// missing chunk from XOR parity as soon as its group has everything else,
+// and hands back each frame once it is complete.
+//
+// Frames are delivered in order: once a frame is complete, older frames
+// still being collected are abandoned and their late packets ignored, so a
+// recovered frame is never shown after a newer one. A packet far behind the
+// last completed frame (restart_gap frames), or late after nothing completed
+// for session_ms, means the sender started over with new frame ids: the
+// receiver drops what it holds and starts a new session from that packet.
+//
+// With repair_ms > 0 the receiver also asks for lost chunks again
+// (udp_retransmit.h). reassembler_nacks() builds the NACKs: gaps below the
+// highest chunk seen are requested at once, a missing tail once the frame
+// has been quiet for nack_delay_ms. An incomplete frame then holds back
+// newer complete ones for up to repair_ms after its first packet, and is
+// no longer requested after that.
+
+struct ReassemblyFrame {
+    std::vector<std::vector<uint8_t>> parts;
+    std::vector<std::vector<uint8_t>> parity;  // by group, empty until received
+    uint16_t total_parts = 0;
+    uint32_t received_parts = 0;
+    uint16_t groups = 0;         // from the first parity packet
+    uint32_t frame_size = 0;     // from the first parity packet
+    uint16_t recovered = 0;      // chunks rebuilt from parity
+    uint64_t first_ms = 0;
+    uint64_t last_update_ms = 0;
+    bool complete = false;
+
+    // Retransmission requests
+    int highest = -1;            // highest chunk index received
+    std::vector<bool> requested;
+    uint64_t last_nack_ms = 0;
+    uint16_t repaired = 0;       // requested chunks that arrived
+};
+
+struct ReassemblyStats {
+    uint64_t completed;
+    uint64_t recovered_parts;    // chunks rebuilt from parity
+    uint64_t recovered_frames;   // completed frames that needed parity
+    uint64_t expired;            // frames that timed out incomplete
+    uint64_t abandoned;          // incomplete frames overtaken by a newer one
+    uint64_t restarts;           // sender restarted its frame ids
+    uint64_t nacks;              // NACK datagrams built
+    uint64_t requested_parts;
+    uint64_t repaired_parts;     // requested chunks that arrived
+    uint64_t repaired_frames;    // completed frames that needed a retransmission
+};
+
+struct Reassembler {
+    uint32_t timeout_ms = 200;
+    uint32_t repair_ms = 0;      // 0: no NACKs, newest complete frame wins at once
+    uint32_t nack_delay_ms = 3;
+    uint32_t nack_retry_ms = 20; // before asking again for the same chunks
+    uint32_t restart_gap = 64;   // frames behind the last completed one
+    uint32_t session_ms = 1000;  // without a completed frame
+    std::unordered_map<uint32_t, ReassemblyFrame> frames;
+    bool have_completed = false;
+    uint32_t last_completed = 0;
+    uint64_t last_completed_ms = 0;
+    ReassemblyStats stats{};
+};
+
+// Feeds one datagram. Returns true and fills jpeg when a frame is ready.
+bool reassembler_add(Reassembler& r, const uint8_t* packet, size_t len, uint64_t now_ms,
+                     std::vector<uint8_t>& jpeg, uint32_t* frame_id = nullptr);
+
+// Hands over the next frame that is ready, if any. With repair_ms > 0 more
+// than one frame can become ready at a time, and a frame can become ready
+// without a packet arriving (its predecessor's repair time ran out), so call
+// this in a loop after reassembler_add() and whenever the socket is idle.
+bool reassembler_poll(Reassembler& r, uint64_t now_ms, std::vector<uint8_t>& jpeg, uint32_t* frame_id = nullptr);
+
+// Appends the NACK datagrams due at now_ms, to be sent to the stream's source.
+void reassembler_nacks(Reassembler& r, uint64_t now_ms, std::vector<std::vector<uint8_t>>& out);
+
+// Drops frames that have not seen a packet for timeout_ms.
+void reassembler_expire(Reassembler& r, uint64_t now_ms);
@@ -0,0 +1,60 @@
+#include "udp_retransmit.h"
+
+#include <algorithm>
+
+void retransmit_init(RetransmitRing& ring, const UdpSender& sender, size_t frames, size_t max_frame_size,
+                     uint32_t deadline_ms) {
+    ring.frames.resize(frames);
+    for (auto& f : ring.frames) f.data.reserve(max_frame_size);
+    ring.chunk_size = udp_chunk_size(sender);
+    ring.deadline_ms = deadline_ms;
+}
+
+void retransmit_store(RetransmitRing& ring, uint32_t frame_id, const unsigned char* data, size_t size,
+                      uint64_t now_ms) {
+    std::lock_guard<std::mutex> guard(ring.lock);
+    RetransmitFrame& f = ring.frames[frame_id % ring.frames.size()];
+    f.valid = true;
+    f.frame_id = frame_id;
+    f.sent_ms = now_ms;
+    f.data.assign(data, data + size);
+}
+
+size_t retransmit_collect(RetransmitRing& ring, const unsigned char* nack, size_t len, uint64_t now_ms,
+                          std::vector<std::vector<unsigned char>>& packets) {
+    UdpHeader h;
+    if (!udp_read_header(nack, len, h) || h.part_index != UDP_CONTROL_INDEX) return 0;
+
+    std::lock_guard<std::mutex> guard(ring.lock);
+    ring.stats.nacks++;
+    const RetransmitFrame& f = ring.frames[h.frame_id % ring.frames.size()];
+    size_t total_parts = f.valid ? (f.data.size() + ring.chunk_size - 1) / ring.chunk_size : 0;
+    bool known = f.valid && f.frame_id == h.frame_id && total_parts == h.total_parts;
+    bool late = known && now_ms - f.sent_ms > ring.deadline_ms;
+
+    size_t added = 0;
+    for (size_t off = UDP_HEADER_SIZE; off + UDP_EXT_SIZE <= len; off += UDP_EXT_SIZE) {
+        UdpExtHeader ext;
+        udp_read_ext(nack + off, len - off, ext);
+        if (ext.version != UDP_EXT_VERSION || ext.type != UDP_EXT_NACK) continue;
+
+        for (int k = 0; k < 32; ++k) {
+            if (!(ext.arg32 & (1u << k))) continue;
+            size_t index = ext.arg16 + k;
+            ring.stats.requested++;
+            if (!known) { ring.stats.missing++; continue; }
+            if (late) { ring.stats.too_late++; continue; }
+            if (index >= total_parts) continue;
+
+            size_t offset = index * ring.chunk_size;
+            size_t chunk = index + 1 < total_parts ? ring.chunk_size : f.data.size() - offset;
+            std::vector<unsigned char> packet(UDP_HEADER_SIZE + chunk);
+            udp_write_header(packet.data(), UdpHeader{ h.frame_id, h.total_parts, (uint16_t)index });
+            std::copy(f.data.begin() + offset, f.data.begin() + offset + chunk, packet.begin() + UDP_HEADER_SIZE);
+            packets.push_back(std::move(packet));
+            added++;
+        }
+    }
+    ring.stats.resent += added;
+    return added;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "udp_send.h"
+
+// Sender side of selective retransmission. The last few frames are kept in
+// a ring indexed by frame_id; a NACK (udp_protocol.h) names a frame and a
+// bitmap of its chunks, and the chunks still in the ring are sent again,
+// byte for byte as the first time. Chunks of a frame sent more than
+// deadline_ms ago are not resent: the receiver has given up on it by then.
+//
+// The send path stores frames while the feedback thread (udp_feedback.h)
+// answers NACKs, so the ring is guarded by a mutex.
+
+struct RetransmitFrame {
+    bool valid = false;
+    uint32_t frame_id = 0;
+    uint64_t sent_ms = 0;
+    std::vector<unsigned char> data;  // reserved for the largest frame
+};
+
+struct RetransmitStats {
+    uint64_t nacks;
+    uint64_t requested;  // chunks asked for
+    uint64_t resent;
+    uint64_t too_late;   // past the deadline
+    uint64_t missing;    // frame no longer in the ring
+};
+
+struct RetransmitRing {
+    std::vector<RetransmitFrame> frames;
+    size_t chunk_size = 0;
+    uint32_t deadline_ms = 0;
+    std::mutex lock;
+    RetransmitStats stats{};
+};
+
+// Keeps `frames` frames of up to max_frame_size bytes, chunked as sender does.
+void retransmit_init(RetransmitRing& ring, const UdpSender& sender, size_t frames, size_t max_frame_size,
+                     uint32_t deadline_ms);
+
+void retransmit_store(RetransmitRing& ring, uint32_t frame_id, const unsigned char* data, size_t size,
+                      uint64_t now_ms);
+
+// Turns one NACK datagram into the data packets it asks for, appended to
+// packets. Returns the number of packets added.
+size_t retransmit_collect(RetransmitRing& ring, const unsigned char* nack, size_t len, uint64_t now_ms,
+                          std::vector<std::vector<unsigned char>>& packets);
@@ -0,0 +1,273 @@
+#include "udp_send.h"
+
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+static const size_t GSO_MAX_BYTES = 65000;  // under the 64 KB datagram limit
+static const size_t GSO_MAX_SEGMENTS = 64;  // UDP_MAX_SEGMENTS
+
+bool parse_udp_send_mode(const char* name, UdpSendMode& mode) {
+    if (strcmp(name, "sendto") == 0) mode = UdpSendMode::Sendto;
+    else if (strcmp(name, "mmsg") == 0) mode = UdpSendMode::Mmsg;
+    else if (strcmp(name, "gso") == 0) mode = UdpSendMode::Gso;
+    else return false;
+    return true;
+}
+
+const char* udp_send_mode_name(UdpSendMode mode) {
+    switch (mode) {
+    case UdpSendMode::Sendto: return "sendto";
+    case UdpSendMode::Mmsg: return "mmsg";
+    case UdpSendMode::Gso: return "gso";
+    }
+    return "?";
+}
+
+// With parity on, chunks leave room for the extension header so parity
+// packets are no larger than data packets.
+size_t udp_chunk_size(const UdpSender& s) {
+    return s.packet_size - UDP_HEADER_SIZE - (s.fec_percent > 0 ? UDP_EXT_SIZE : 0);
+}
+
+bool udp_sender_init(UdpSender& sender, int fd, const sockaddr_in& dest, UdpSendMode mode, size_t packet_size,
+                     size_t max_frame_size, int fec_percent) {
+    sender.fd = fd;
+    sender.dest = dest;
+    sender.mode = mode;
+    sender.packet_size = packet_size;
+    sender.fec_percent = fec_percent;
+
+    size_t max_data = udp_chunk_size(sender);
+    size_t max_parts = (max_frame_size + max_data - 1) / max_data;
+    size_t max_groups = udp_fec_groups(max_parts, fec_percent);
+    if (max_parts + max_groups > 0xFFFF) {
+        std::cerr << "udp_sender_init: " << max_frame_size << "-byte frames need more than 65535 packets\n";
+        return false;
+    }
+
+    size_t max_packets = max_parts + max_groups;
+    sender.packets.resize(max_packets);
+    sender.parity.resize(max_groups * max_data);
+    sender.iov.resize(max_packets * 2);
+    sender.msgs.resize(max_packets);
+    sender.gso_buf.resize(mode == UdpSendMode::Gso ? max_packets * packet_size : packet_size);
+    return true;
+}
+
+void udp_build_packets(UdpSender& s, uint32_t frame_id, const unsigned char* data, size_t size) {
+    size_t max_data = udp_chunk_size(s);
+    int total_parts = (size + max_data - 1) / max_data;
+    int groups = udp_fec_groups(total_parts, s.fec_percent);
+
+    for (int i = 0; i < total_parts; ++i) {
+        UdpPacket& p = s.packets[i];
+        udp_write_header(p.header, UdpHeader{ frame_id, (uint16_t)total_parts, (uint16_t)i });
+        p.header_len = UDP_HEADER_SIZE;
+        p.payload = data + i * max_data;
+        p.payload_len = (i < total_parts - 1) ? max_data : (size - i * max_data);
+    }
+
+    if (groups) {
+        memset(s.parity.data(), 0, groups * max_data);
+        for (int i = 0; i < total_parts; ++i) {
+            unsigned char* dst = &s.parity[(i % groups) * max_data];
+            const unsigned char* src = s.packets[i].payload;
+            for (size_t k = 0; k < s.packets[i].payload_len; ++k) dst[k] ^= src[k];
+        }
+    }
+    for (int g = 0; g < groups; ++g) {
+        UdpPacket& p = s.packets[total_parts + g];
+        udp_write_header(p.header, UdpHeader{ frame_id, (uint16_t)total_parts, (uint16_t)(total_parts + g) });
+        udp_write_ext(p.header + UDP_HEADER_SIZE,
+                      UdpExtHeader{ UDP_EXT_VERSION, UDP_EXT_XOR_PARITY, (uint16_t)groups, (uint32_t)size });
+        p.header_len = UDP_HEADER_SIZE + UDP_EXT_SIZE;
+        p.payload = &s.parity[g * max_data];
+        p.payload_len = max_data;
+    }
+    s.npackets = total_parts + groups;
+}
+
+static bool send_each(UdpSender& s) {
+    unsigned char* packet = s.gso_buf.data();
+    for (size_t i = 0; i < s.npackets; ++i) {
+        const UdpPacket& p = s.packets[i];
+        memcpy(packet, p.header, p.header_len);
+        memcpy(packet + p.header_len, p.payload, p.payload_len);
+
+        s.stats.syscalls++;
+        if (sendto(s.fd, packet, p.header_len + p.payload_len, 0, (sockaddr*)&s.dest, sizeof(s.dest)) < 0) {
+            s.stats.errors++;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool send_mmsg(UdpSender& s) {
+    for (size_t i = 0; i < s.npackets; ++i) {
+        UdpPacket& p = s.packets[i];
+        iovec* iov = &s.iov[i * 2];
+        iov[0].iov_base = p.header;
+        iov[0].iov_len = p.header_len;
+        iov[1].iov_base = const_cast<unsigned char*>(p.payload);
+        iov[1].iov_len = p.payload_len;
+
+        msghdr& msg = s.msgs[i].msg_hdr;
+        msg = msghdr{};
+        msg.msg_name = &s.dest;
+        msg.msg_namelen = sizeof(s.dest);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+    }
+
+    // sendmmsg() may stop early (e.g. interrupted); carry on from there.
+    size_t sent = 0;
+    while (sent < s.npackets) {
+        s.stats.syscalls++;
+        int n = sendmmsg(s.fd, &s.msgs[sent], s.npackets - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            s.stats.errors++;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+static bool send_gso(UdpSender& s) {
+    // A GSO send cuts its buffer into segments of one size, the last one
+    // possibly shorter: the data chunks form one run, the parity packets
+    // another.
+    size_t first = 0;
+    while (first < s.npackets) {
+        size_t segment = s.packets[first].header_len + s.packets[first].payload_len;
+        size_t max_run = std::min(GSO_MAX_BYTES / segment, GSO_MAX_SEGMENTS);
+
+        unsigned char* p = s.gso_buf.data();
+        size_t last = first;
+        while (last < s.npackets && last - first < max_run) {
+            const UdpPacket& pk = s.packets[last];
+            size_t len = pk.header_len + pk.payload_len;
+            if (len > segment) break;
+            memcpy(p, pk.header, pk.header_len);
+            memcpy(p + pk.header_len, pk.payload, pk.payload_len);
+            p += len;
+            last++;
+            if (len < segment) break;  // a short packet ends the run
+        }
+        size_t total = p - s.gso_buf.data();
+
+        iovec iov{ s.gso_buf.data(), total };
+        msghdr msg{};
+        msg.msg_name = &s.dest;
+        msg.msg_namelen = sizeof(s.dest);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        // A run of one packet goes out without the cmsg.
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        if (last - first > 1) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = segment;
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        }
+
+        s.stats.syscalls++;
+        ssize_t n;
+        do {
+            n = sendmsg(s.fd, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            if (first == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                perror("UDP_SEGMENT unavailable, using sendmmsg");
+                s.mode = UdpSendMode::Mmsg;
+                return send_mmsg(s);
+            }
+            s.stats.errors++;
+            return false;
+        }
+        first = last;
+    }
+    return true;
+}
+
+bool udp_send_frame(UdpSender& sender, uint32_t frame_id, const unsigned char* data, size_t size) {
+    size_t max_data = udp_chunk_size(sender);
+    size_t total_parts = (size + max_data - 1) / max_data;
+    if (total_parts + udp_fec_groups(total_parts, sender.fec_percent) > sender.packets.size()) {
+        std::cerr << "udp_send_frame: " << size << "-byte frame exceeds the sender's capacity\n";
+        return false;
+    }
+
+    udp_build_packets(sender, frame_id, data, size);
+
+    bool ok = false;
+    switch (sender.mode) {
+    case UdpSendMode::Sendto: ok = send_each(sender); break;
+    case UdpSendMode::Mmsg: ok = send_mmsg(sender); break;
+    case UdpSendMode::Gso: ok = send_gso(sender); break;
+    }
+
+    sender.stats.frames++;
+    if (ok) {
+        sender.stats.packets += sender.npackets;
+        sender.stats.parity_packets += sender.npackets - total_parts;
+        for (size_t i = 0; i < sender.npackets; ++i) {
+            sender.stats.bytes += sender.packets[i].header_len + sender.packets[i].payload_len;
+        }
+    }
+    return ok;
+}
+
+bool udp_send_timestamp(UdpSender& sender, uint32_t frame_id, size_t size, uint64_t capture_us) {
+    size_t max_data = udp_chunk_size(sender);
+    unsigned char packet[UDP_TIMESTAMP_SIZE];
+    udp_write_timestamp(packet, frame_id, (uint16_t)((size + max_data - 1) / max_data), capture_us);
+
+    sender.stats.syscalls++;
+    if (sendto(sender.fd, packet, sizeof(packet), 0, (sockaddr*)&sender.dest, sizeof(sender.dest)) < 0) {
+        sender.stats.errors++;
+        return false;
+    }
+    sender.stats.bytes += sizeof(packet);
+    return true;
+}
+
+bool udp_send_tables(UdpSender& sender, uint32_t frame_id, size_t size, uint16_t generation,
+                     const unsigned char* tables, size_t tables_size) {
+    size_t max_data = udp_chunk_size(sender);
+    unsigned char header[UDP_TABLES_HEADER_SIZE];
+    udp_write_tables_header(header, frame_id, (uint16_t)((size + max_data - 1) / max_data), generation, tables_size);
+
+    iovec iov[2] = { { header, sizeof(header) }, { (void*)tables, tables_size } };
+    msghdr msg{};
+    msg.msg_name = &sender.dest;
+    msg.msg_namelen = sizeof(sender.dest);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    sender.stats.syscalls++;
+    if (sendmsg(sender.fd, &msg, 0) < 0) {
+        sender.stats.errors++;
+        return false;
+    }
+    sender.stats.bytes += sizeof(header) + tables_size;
+    return true;
+}
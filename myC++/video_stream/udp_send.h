@@ -0,0 +1,88 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "udp_protocol.h"
+
+// Sends one frame as UDP chunks of at most packet_size bytes, each starting
+// with the 8-byte header of udp_protocol.h, optionally followed by XOR
+// parity packets (fec_percent > 0).
+//
+// Modes:
+//   Sendto  one sendto() per packet (the original path)
+//   Mmsg    one sendmmsg() per frame; each message gathers its header and a
+//           slice of the frame with two iovecs, so the payload is not copied
+//   Gso     equal-sized packets are laid out back to back in one buffer and
+//           handed to the kernel with UDP_SEGMENT, which cuts it into
+//           datagrams; one send per 64 KB instead of one per packet
+//
+// Gso falls back to Mmsg if the kernel rejects UDP_SEGMENT.
+
+enum class UdpSendMode { Sendto, Mmsg, Gso };
+
+// Accepts "sendto", "mmsg" or "gso".
+bool parse_udp_send_mode(const char* name, UdpSendMode& mode);
+const char* udp_send_mode_name(UdpSendMode mode);
+
+struct UdpSendStats {
+    uint64_t frames;
+    uint64_t packets;
+    uint64_t parity_packets;
+    uint64_t bytes;
+    uint64_t syscalls;
+    uint64_t errors;
+};
+
+// One datagram: a header (base, plus the extension for parity) and a payload.
+struct UdpPacket {
+    unsigned char header[UDP_HEADER_SIZE + UDP_EXT_SIZE];
+    size_t header_len;
+    const unsigned char* payload;
+    size_t payload_len;
+};
+
+struct UdpSender {
+    int fd = -1;
+    sockaddr_in dest{};
+    UdpSendMode mode = UdpSendMode::Gso;
+    size_t packet_size = 1400;
+    int fec_percent = 0;
+
+    // Scratch reused for every frame, sized for the largest frame.
+    std::vector<UdpPacket> packets;
+    size_t npackets = 0;
+    std::vector<unsigned char> parity;   // XOR of each group's chunks
+    std::vector<iovec> iov;
+    std::vector<mmsghdr> msgs;
+    std::vector<unsigned char> gso_buf;  // Gso: a run of packets; Sendto: one packet
+
+    UdpSendStats stats{};
+};
+
+bool udp_sender_init(UdpSender& sender, int fd, const sockaddr_in& dest, UdpSendMode mode, size_t packet_size,
+                     size_t max_frame_size, int fec_percent = 0);
+
+// Payload bytes per data chunk.
+size_t udp_chunk_size(const UdpSender& sender);
+
+// Fills sender.packets[0..npackets) for the frame without sending anything.
+// The payloads point into data and sender.parity.
+void udp_build_packets(UdpSender& sender, uint32_t frame_id, const unsigned char* data, size_t size);
+
+// Builds and sends the frame's packets. Returns false if a send failed.
+bool udp_send_frame(UdpSender& sender, uint32_t frame_id, const unsigned char* data, size_t size);
+
+// Sends the frame's capture time (UDP_EXT_TIMESTAMP); call it right before
+// udp_send_frame() with the same frame_id and size.
+bool udp_send_timestamp(UdpSender& sender, uint32_t frame_id, size_t size, uint64_t capture_us);
+
+// Sends an abbreviated session's tables (UDP_EXT_TABLES, jpeg_tables.h) in
+// one datagram; call it right before udp_send_frame() with the same frame_id
+// and size. The tables must fit in packet_size.
+bool udp_send_tables(UdpSender& sender, uint32_t frame_id, size_t size, uint16_t generation,
+                     const unsigned char* tables, size_t tables_size);
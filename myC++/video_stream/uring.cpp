@@ -0,0 +1,157 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static unsigned* ring_field(void* ring, unsigned offset) {
+    return (unsigned*)((char*)ring + offset);
+}
+
+bool uring_init(Uring& ring, unsigned entries) {
+    io_uring_params params{};
+    ring.fd = io_uring_setup(entries, &params);
+    if (ring.fd < 0) {
+        perror("io_uring_setup");
+        return false;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring.cq_ring_size > ring.sq_ring_size) ring.sq_ring_size = ring.cq_ring_size;
+
+    ring.sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                        IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        perror("mmap io_uring SQ");
+        ring.sq_ring = nullptr;
+        uring_destroy(ring);
+        return false;
+    }
+    if (single) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                            IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            perror("mmap io_uring CQ");
+            ring.cq_ring = nullptr;
+            uring_destroy(ring);
+            return false;
+        }
+    }
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        perror("mmap io_uring SQEs");
+        uring_destroy(ring);
+        return false;
+    }
+    ring.sqes = (io_uring_sqe*)sqes;
+
+    ring.sq_head = ring_field(ring.sq_ring, params.sq_off.head);
+    ring.sq_tail = ring_field(ring.sq_ring, params.sq_off.tail);
+    ring.sq_mask = *ring_field(ring.sq_ring, params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sq_array = ring_field(ring.sq_ring, params.sq_off.array);
+    ring.sq_local_tail = *ring.sq_tail;
+
+    ring.cq_head = ring_field(ring.cq_ring, params.cq_off.head);
+    ring.cq_tail = ring_field(ring.cq_ring, params.cq_off.tail);
+    ring.cq_mask = *ring_field(ring.cq_ring, params.cq_off.ring_mask);
+    ring.cqes = (io_uring_cqe*)((char*)ring.cq_ring + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* uring_get_sqe(Uring& ring) {
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    if (ring.sq_local_tail - head >= ring.sq_entries) return nullptr;
+    unsigned index = ring.sq_local_tail & ring.sq_mask;
+    io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    ring.sq_local_tail++;
+    ring.pending++;
+    return sqe;
+}
+
+int uring_submit(Uring& ring, unsigned wait_nr) {
+    // Publish the filled SQEs before the kernel reads the tail
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring.pending;
+    if (to_submit == 0 && wait_nr == 0) return 0;
+    int n = io_uring_enter(ring.fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    ring.stats.enters++;
+    if (n < 0) return -1;
+    ring.pending -= n;
+    ring.stats.submitted += n;
+    return n;
+}
+
+io_uring_cqe* uring_peek(Uring& ring, unsigned index) {
+    unsigned head = *ring.cq_head;
+    if (__atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) - head <= index) return nullptr;
+    return &ring.cqes[(head + index) & ring.cq_mask];
+}
+
+void uring_advance(Uring& ring, unsigned count) {
+    if (count == 0) return;
+    __atomic_store_n(ring.cq_head, *ring.cq_head + count, __ATOMIC_RELEASE);
+    ring.stats.completions += count;
+    ring.stats.batches++;
+}
+
+void uring_destroy(Uring& ring) {
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring) munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0) close(ring.fd);
+    ring.sqes = nullptr;
+    ring.sq_ring = ring.cq_ring = nullptr;
+    ring.fd = -1;
+}
+
+void uring_prep_poll(io_uring_sqe* sqe, int fd, unsigned events, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_sendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, unsigned flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_accept(io_uring_sqe* sqe, int fd, unsigned flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = flags;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_timeout(io_uring_sqe* sqe, const __kernel_timespec* ts, unsigned flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->timeout_flags = flags;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// A minimal io_uring, driven with the raw syscalls (no liburing).
+//
+// uring_init() sets up a ring and maps its submission queue, completion
+// queue and SQE array. Callers take SQEs with uring_get_sqe(), fill them
+// with the uring_prep_*() helpers, and hand everything queued so far to the
+// kernel with one uring_submit() call, which can also wait for completions.
+// Completions are then reaped in a batch straight from the mapped ring with
+// uring_peek() and uring_advance(), without another syscall.
+
+struct UringStats {
+    uint64_t enters;       // io_uring_enter() calls
+    uint64_t submitted;    // SQEs handed to the kernel
+    uint64_t completions;  // CQEs reaped
+    uint64_t batches;      // uring_advance() calls that reaped something
+};
+
+struct Uring {
+    int fd = -1;
+
+    // Submission queue
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned* sq_array = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned sq_local_tail = 0;  // SQEs filled, not yet published
+    unsigned pending = 0;        // published, not yet submitted
+
+    // Completion queue
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void* cq_ring = nullptr;  // the SQ mapping when the kernel shares it
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+
+    UringStats stats{};
+};
+
+// Fails (with errno from the kernel) where io_uring is missing or disabled.
+bool uring_init(Uring& ring, unsigned entries);
+
+// A zeroed SQE, or nullptr when the submission queue is full; submit and
+// retry.
+io_uring_sqe* uring_get_sqe(Uring& ring);
+
+// Submits the SQEs taken since the last call and waits until at least
+// wait_nr completions are ready. Returns the number submitted, or -1
+// (errno set; EINTR when a signal interrupted the wait).
+int uring_submit(Uring& ring, unsigned wait_nr);
+
+// The index-th unreaped completion (0: the oldest), or nullptr when fewer are
+// ready. Reap a batch with one uring_advance() once it is handled.
+io_uring_cqe* uring_peek(Uring& ring, unsigned index);
+void uring_advance(Uring& ring, unsigned count);
+
+void uring_destroy(Uring& ring);
+
+// One-shot poll for events (POLLIN...) on fd.
+void uring_prep_poll(io_uring_sqe* sqe, int fd, unsigned events, uint64_t user_data);
+
+// sendmsg(fd, msg, flags); msg and its iovecs must stay valid until the
+// completion arrives.
+void uring_prep_sendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, unsigned flags, uint64_t user_data);
+
+// accept4(fd, nullptr, nullptr, flags); the completion's res is the new fd.
+void uring_prep_accept(io_uring_sqe* sqe, int fd, unsigned flags, uint64_t user_data);
+
+// Completes with -ETIME after ts, or at ts (CLOCK_MONOTONIC) with flags
+// IORING_TIMEOUT_ABS; ts must stay valid until then.
+void uring_prep_timeout(io_uring_sqe* sqe, const __kernel_timespec* ts, unsigned flags, uint64_t user_data);
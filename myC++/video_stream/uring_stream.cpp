@@ -0,0 +1,396 @@
+#include "uring_stream.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "mjpeg.h"
+
+// user_data: what completed, the camera, and the client slot
+enum class UringOp : uint64_t { Source = 1, Accept = 2, Send = 3 };
+
+static uint64_t op_data(UringOp op, size_t camera, size_t client = 0) {
+    return (uint64_t)op << 56 | (uint64_t)camera << 32 | client;
+}
+
+static double process_cpu_seconds() {
+    // Includes the kernel's io-wq workers, which run sends that had to wait
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A free SQE, submitting what is queued first when the ring is full.
+static io_uring_sqe* get_sqe(UringStream& stream) {
+    io_uring_sqe* sqe = uring_get_sqe(stream.ring);
+    if (sqe) return sqe;
+    uring_submit(stream.ring, 0);
+    sqe = uring_get_sqe(stream.ring);
+    if (!sqe) fprintf(stderr, "io_uring submission queue full\n");
+    return sqe;
+}
+
+static bool arm_source(UringStream& stream, size_t index) {
+    UringCamera& cam = *stream.cameras[index];
+    io_uring_sqe* sqe = get_sqe(stream);
+    if (!sqe) return false;
+    if (!capture_is_replay(cam.cap)) {
+        uring_prep_poll(sqe, cam.cap.fd, POLLIN, op_data(UringOp::Source, index));
+        return true;
+    }
+    cam.slot.tv_sec = cam.next_ns / 1000000000ULL;
+    cam.slot.tv_nsec = cam.next_ns % 1000000000ULL;
+    uring_prep_timeout(sqe, &cam.slot, IORING_TIMEOUT_ABS, op_data(UringOp::Source, index));
+    return true;
+}
+
+static bool arm_accept(UringStream& stream, size_t index) {
+    io_uring_sqe* sqe = get_sqe(stream);
+    if (!sqe) return false;
+    uring_prep_accept(sqe, stream.cameras[index]->listen_fd, SOCK_CLOEXEC, op_data(UringOp::Accept, index));
+    return true;
+}
+
+static UringFrame* get_frame(UringStream& stream) {
+    if (!stream.free_frames.empty()) {
+        UringFrame* f = stream.free_frames.back();
+        stream.free_frames.pop_back();
+        return f;
+    }
+    UringFrame* f = new UringFrame{};
+    stream.all_frames.push_back(f);
+    return f;
+}
+
+static void unref(UringStream& stream, UringFrame* f) {
+    if (--f->refs > 0) return;
+    UringCamera& cam = *stream.cameras[f->camera];
+    if (f->captured) capture_requeue(cam.cap, f->capture);
+    else frame_pool_release(cam.pool, f->data);
+    stream.free_frames.push_back(f);
+}
+
+// Queues the rest of the client's frame, from c.offset on.
+static bool queue_send(UringStream& stream, size_t camera, size_t slot) {
+    UringClient& c = *stream.cameras[camera]->clients[slot];
+    UringFrame* f = c.frame;
+    size_t header = sizeof(f->header);
+    int n = 0;
+    if (c.offset < header) {
+        c.iov[n++] = iovec{ f->header + c.offset, header - c.offset };
+        c.iov[n++] = iovec{ f->data, f->size };
+    } else {
+        c.iov[n++] = iovec{ f->data + (c.offset - header), f->size - (c.offset - header) };
+    }
+    c.msg = msghdr{};
+    c.msg.msg_iov = c.iov;
+    c.msg.msg_iovlen = n;
+
+    io_uring_sqe* sqe = get_sqe(stream);
+    if (!sqe) return false;
+    uring_prep_sendmsg(sqe, c.fd, &c.msg, MSG_NOSIGNAL, op_data(UringOp::Send, camera, slot));
+    stream.stats.sends++;
+    return true;
+}
+
+static void drop_client(UringStream& stream, UringCamera& cam, UringClient& c) {
+    printf("uring: client on port %d left after %lu frames (%lu skipped)\n", cam.port,
+           (unsigned long)c.stats.sent, (unsigned long)c.stats.skipped);
+    fflush(stdout);
+    if (c.frame) unref(stream, c.frame);
+    c.frame = nullptr;
+    close(c.fd);
+    c.fd = -1;
+}
+
+// Turns a dequeued frame into a UringFrame: encoded, passed through from the
+// capture buffer, or copied with Huffman tables added. The capture buffer is
+// requeued unless the frame still points into it.
+static bool fill_frame(UringCamera& cam, const CaptureFrame& capture, UringFrame& f) {
+    f.capture = capture;
+    f.captured = false;
+    if (cam.cap.mjpeg && mjpeg_has_dht(capture.data, capture.bytesused)) {
+        f.data = (unsigned char*)capture.data;
+        f.size = capture.bytesused;
+        f.captured = true;
+    } else {
+        f.data = frame_pool_acquire(cam.pool);
+        if (!f.data) {
+            capture_requeue(cam.cap, capture);
+            return false;
+        }
+        if (cam.cap.mjpeg) {
+            f.size = mjpeg_insert_dht(capture.data, capture.bytesused, f.data, cam.pool.buffer_size);
+        } else {
+            f.size = jpeg_encode_yuyv(cam.enc, capture.data, f.data, cam.pool.buffer_size);
+        }
+        capture_requeue(cam.cap, capture);
+        if (f.size == 0) {
+            frame_pool_release(cam.pool, f.data);
+            return false;
+        }
+    }
+    uint32_t size_net = htonl(f.size);
+    memcpy(f.header, &size_net, sizeof(f.header));
+    return true;
+}
+
+// A replayed source has nothing to dequeue while sends still hold every slot.
+static bool replay_slots_held(const Capture& cap) {
+    for (bool busy : cap.replay_busy) {
+        if (!busy) return false;
+    }
+    return true;
+}
+
+// Leaves a failed camera unarmed; the others carry on. Ends the loop once
+// none is left.
+static bool stop_camera(UringStream& stream, size_t index) {
+    UringCamera& cam = *stream.cameras[index];
+    cam.stopped = true;
+    fprintf(stderr, "uring: camera on port %d stopped\n", cam.port);
+    for (const auto& other : stream.cameras) {
+        if (!other->stopped) return true;
+    }
+    return false;
+}
+
+static bool on_source(UringStream& stream, size_t index, int res) {
+    UringCamera& cam = *stream.cameras[index];
+    if (!capture_is_replay(cam.cap) && res < 0) {
+        fprintf(stderr, "poll on camera %zu: %s\n", index, strerror(-res));
+        return stop_camera(stream, index);
+    }
+    if (capture_is_replay(cam.cap) && replay_slots_held(cam.cap)) {
+        // Slow clients still have every buffer; try again next slot
+        cam.stats.held++;
+        cam.next_ns += cam.pacer.interval_ns;
+        uint64_t now = monotonic_ns();
+        if (cam.next_ns < now) cam.next_ns = now;
+        return arm_source(stream, index);
+    }
+    CaptureFrame capture;
+    if (!capture_dequeue(cam.cap, capture)) return stop_camera(stream, index);
+    cam.stats.frames++;
+    stream.stats.frames++;
+    if (stream.config.report_every && stream.stats.frames % stream.config.report_every == 0) {
+        uring_stream_report(stream);
+    }
+
+    bool has_client = false;
+    for (const auto& c : cam.clients) has_client |= c->fd >= 0;
+    if (capture_is_replay(cam.cap)) {
+        cam.next_ns += cam.pacer.interval_ns;
+        uint64_t now = monotonic_ns();
+        if (cam.next_ns < now) cam.next_ns = now;
+    } else if (!pacer_admit(cam.pacer, capture_timestamp_ns(capture))) {
+        capture_requeue(cam.cap, capture);
+        cam.stats.paced++;
+        return arm_source(stream, index);
+    }
+    if (!has_client) {
+        // Nobody to encode for
+        capture_requeue(cam.cap, capture);
+        cam.stats.idle++;
+        return arm_source(stream, index);
+    }
+
+    UringFrame* f = get_frame(stream);
+    f->camera = index;
+    f->refs = 1;  // ours, until every send is queued
+    if (!fill_frame(cam, capture, *f)) {
+        stream.free_frames.push_back(f);
+        return arm_source(stream, index);
+    }
+    cam.stats.sent++;
+    for (size_t slot = 0; slot < cam.clients.size(); ++slot) {
+        UringClient& c = *cam.clients[slot];
+        if (c.fd < 0) continue;
+        if (c.frame) {
+            c.stats.skipped++;
+            continue;
+        }
+        c.frame = f;
+        c.offset = 0;
+        f->refs++;
+        if (!queue_send(stream, index, slot)) return false;
+    }
+    unref(stream, f);
+    return arm_source(stream, index);
+}
+
+static bool on_accept(UringStream& stream, size_t index, int res) {
+    UringCamera& cam = *stream.cameras[index];
+    if (res < 0) {
+        // e.g. the peer reset before we got to it
+        fprintf(stderr, "accept on port %d: %s\n", cam.port, strerror(-res));
+        return arm_accept(stream, index);
+    }
+    int one = 1;
+    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    size_t slot = 0;
+    while (slot < cam.clients.size() && cam.clients[slot]->fd >= 0) ++slot;
+    if (slot == cam.clients.size()) cam.clients.push_back(std::make_unique<UringClient>());
+    UringClient& c = *cam.clients[slot];
+    c = UringClient{};
+    c.fd = res;
+    printf("uring: client joined port %d\n", cam.port);
+    fflush(stdout);
+    return arm_accept(stream, index);
+}
+
+static bool on_send(UringStream& stream, size_t index, size_t slot, int res) {
+    UringCamera& cam = *stream.cameras[index];
+    UringClient& c = *cam.clients[slot];
+    if (res <= 0) {
+        drop_client(stream, cam, c);
+        return true;
+    }
+    c.offset += res;
+    if (c.offset < sizeof(c.frame->header) + c.frame->size) {
+        stream.stats.short_sends++;
+        return queue_send(stream, index, slot);
+    }
+    c.stats.sent++;
+    unref(stream, c.frame);
+    c.frame = nullptr;
+    return true;
+}
+
+static bool on_completion(UringStream& stream, uint64_t data, int res) {
+    UringOp op = (UringOp)(data >> 56);
+    size_t camera = (data >> 32) & 0xffffff;
+    size_t client = data & 0xffffffff;
+    switch (op) {
+    case UringOp::Source: return on_source(stream, camera, res);
+    case UringOp::Accept: return on_accept(stream, camera, res);
+    case UringOp::Send: return on_send(stream, camera, client, res);
+    }
+    return true;
+}
+
+bool uring_stream_init(UringStream& stream, const UringStreamConfig& config) {
+    stream.config = config;
+    if (!uring_init(stream.ring, config.entries)) {
+        fprintf(stderr, "io_uring is not available; use v4l2_tcp_stream\n");
+        return false;
+    }
+    stream.reported_cpu = process_cpu_seconds();
+    return true;
+}
+
+bool uring_stream_add_camera(UringStream& stream, const char* device, int port, int nbuffers,
+                             CaptureFormat format, CaptureMemory memory) {
+    auto cam = std::make_unique<UringCamera>();
+    cam->port = port;
+    if (!capture_open(cam->cap, device, 640, 480, nbuffers, format, memory)) return false;
+
+    size_t capacity;
+    if (cam->cap.mjpeg) {
+        capacity = cam->cap.frame_size + mjpeg_dht_size();
+    } else {
+        if (!jpeg_encoder_init(cam->enc, cam->cap.width, cam->cap.height, stream.config.quality,
+                               stream.config.input)) {
+            return false;
+        }
+        cam->encoder = true;
+        capacity = jpeg_encoder_bound(cam->enc);
+    }
+    // A frame per client in flight plus the one being built; more are
+    // mapped if many clients fall behind at once.
+    if (!frame_pool_init(cam->pool, capacity, 4, false)) return false;
+    pacer_init(cam->pacer, stream.config.fps);
+    cam->next_ns = monotonic_ns();
+
+    cam->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (cam->listen_fd < 0) { perror("socket"); return false; }
+    int reuse = 1;
+    setsockopt(cam->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(cam->listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return false; }
+    if (listen(cam->listen_fd, 64) < 0) { perror("listen"); return false; }
+
+    printf("uring: %s (%dx%d %s) on port %d\n", device, cam->cap.width, cam->cap.height,
+           cam->cap.mjpeg ? "MJPEG" : "YUYV", port);
+    stream.cameras.push_back(std::move(cam));
+    return true;
+}
+
+bool uring_stream_run(UringStream& stream) {
+    for (size_t i = 0; i < stream.cameras.size(); ++i) {
+        if (!arm_source(stream, i) || !arm_accept(stream, i)) return false;
+    }
+    while (true) {
+        if (uring_submit(stream.ring, 1) < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter");
+            return false;
+        }
+        unsigned n = 0;
+        while (io_uring_cqe* cqe = uring_peek(stream.ring, n)) {
+            if (!on_completion(stream, cqe->user_data, cqe->res)) return false;
+            ++n;
+        }
+        uring_advance(stream.ring, n);
+    }
+}
+
+void uring_stream_report(UringStream& stream) {
+    const UringStats& ring = stream.ring.stats;
+    uint64_t frames = stream.stats.frames - stream.reported.frames;
+    uint64_t enters = ring.enters - stream.reported_ring.enters;
+    uint64_t completions = ring.completions - stream.reported_ring.completions;
+    uint64_t batches = ring.batches - stream.reported_ring.batches;
+    double cpu = process_cpu_seconds();
+    if (frames) {
+        printf("uring: %lu frames, %lu sends (%lu short), %lu io_uring_enter calls (%.2f per frame), "
+               "%.1f completions per batch, %.1f us CPU per frame\n",
+               (unsigned long)frames, (unsigned long)(stream.stats.sends - stream.reported.sends),
+               (unsigned long)(stream.stats.short_sends - stream.reported.short_sends), (unsigned long)enters,
+               (double)enters / frames, batches ? (double)completions / batches : 0.0,
+               (cpu - stream.reported_cpu) * 1e6 / frames);
+    }
+    for (const auto& cam : stream.cameras) {
+        size_t clients = 0;
+        for (const auto& c : cam->clients) clients += c->fd >= 0;
+        printf("uring: port %d: %lu frames, %lu sent to %zu clients, %lu with no client, %lu paced out", cam->port,
+               (unsigned long)cam->stats.frames, (unsigned long)cam->stats.sent, clients,
+               (unsigned long)cam->stats.idle, (unsigned long)cam->stats.paced);
+        if (cam->stats.held) printf(", %lu slots with every buffer held", (unsigned long)cam->stats.held);
+        printf(cam->stopped ? ", stopped\n" : "\n");
+        capture_report(cam->cap);
+    }
+    fflush(stdout);
+    stream.reported = stream.stats;
+    stream.reported_ring = ring;
+    stream.reported_cpu = cpu;
+}
+
+void uring_stream_close(UringStream& stream) {
+    // Closing the ring cancels whatever is still in flight
+    uring_destroy(stream.ring);
+    for (auto& cam : stream.cameras) {
+        for (auto& c : cam->clients) {
+            if (c->fd >= 0) close(c->fd);
+        }
+        if (cam->listen_fd >= 0) close(cam->listen_fd);
+        if (cam->encoder) jpeg_encoder_destroy(cam->enc);
+        frame_pool_destroy(cam->pool);
+        capture_close(cam->cap);
+    }
+    stream.cameras.clear();
+    for (UringFrame* f : stream.all_frames) delete f;
+    stream.all_frames.clear();
+    stream.free_frames.clear();
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "capture.h"
+#include "frame_pool.h"
+#include "jpeg_encoder.h"
+#include "pacer.h"
+#include "uring.h"
+
+// Single-threaded capture-and-send loop for v4l2_uring_stream, built on one
+// io_uring (uring.h) instead of a thread blocked in VIDIOC_DQBUF and another
+// blocked in send().
+//
+// The thread services any number of cameras, each with its own TCP port and
+// clients. Everything it waits for is an operation on the ring: a one-shot
+// poll on each camera's fd (replayed clips and the test pattern, which
+// never block, wait on an absolute timeout at the next frame slot instead),
+// an accept on each listening socket, and one sendmsg per client with a
+// frame in flight. Each turn of the loop makes a single io_uring_enter()
+// call that submits every operation queued since the last one and waits
+// for at least one completion; the completions are then handled as a
+// batch from the mapped ring.
+//
+// A ready camera is dequeued with VIDIOC_DQBUF, which no longer blocks. Its
+// frame is JPEG-encoded on this thread (YUYV), or passed through (MJPEG,
+// straight from the capture buffer when it carries its Huffman tables), and
+// a sendmsg of the 4-byte length and the JPEG is queued to every client of
+// that camera, all referencing the same reference-counted UringFrame. The
+// wire format is v4l2_tcp_stream's, so sdl_tcp_client connects unchanged.
+// A client whose previous frame is still in flight skips the new one; a
+// short send is resubmitted for the rest. A replayed source whose buffers
+// are all still held by sends skips the frame slot instead. The capture buffer (or the pool
+// buffer holding the encoded frame) goes back once the last send
+// referencing it completes.
+//
+// Encoding inline keeps the loop to one thread, so this suits MJPEG cameras
+// or modest YUYV resolutions; the pipeline streamers (pipeline.h) remain
+// the way to spread encoding over cores. Timestamps, tile deltas, the frame
+// gate, abbreviated JPEG and H.264 are left to them as well.
+
+struct UringFrame {
+    int refs;                  // sends in flight
+    int camera;
+    unsigned char* data;       // pool buffer, or the capture buffer (captured)
+    size_t size;
+    unsigned char header[4];
+    bool captured;             // data is frame's capture buffer
+    CaptureFrame capture;
+};
+
+struct UringClientStats {
+    uint64_t sent;
+    uint64_t skipped;  // frames that arrived with a send still in flight
+};
+
+struct UringClient {
+    int fd = -1;                    // -1: free slot
+    UringFrame* frame = nullptr;    // in flight
+    size_t offset = 0;              // bytes of header and frame already sent
+    iovec iov[2];
+    msghdr msg;
+    UringClientStats stats{};
+};
+
+struct UringCameraStats {
+    uint64_t frames;   // dequeued
+    uint64_t sent;     // frames queued to at least one client
+    uint64_t idle;     // frames with no client to send to
+    uint64_t paced;    // frames the pacer skipped
+    uint64_t held;     // replay: frame slots skipped with every buffer held by sends
+};
+
+struct UringCamera {
+    Capture cap;
+    int port = 0;
+    int listen_fd = -1;
+    JpegEncoder enc;
+    bool encoder = false;
+    FramePool pool;                  // encoded frames, or MJPEG with tables added
+    Pacer pacer;
+    uint64_t next_ns = 0;            // replay: next frame slot
+    __kernel_timespec slot{};        // replay: its timeout, in flight
+    bool stopped = false;            // capture failed; no longer armed
+    std::vector<std::unique_ptr<UringClient>> clients;  // stable for in-flight msghdrs
+    UringCameraStats stats{};
+};
+
+struct UringStreamConfig {
+    double fps = 30;          // <= 0: every frame
+    int quality = 75;
+    JpegInput input = JpegInput::Yuv;
+    unsigned entries = 256;   // submission queue size
+    int report_every = 300;   // frames, over all cameras; 0: never
+};
+
+struct UringStreamStats {
+    uint64_t frames;       // dequeued, all cameras
+    uint64_t sends;        // sendmsg operations submitted
+    uint64_t short_sends;  // of which resubmitted after a partial send
+};
+
+struct UringStream {
+    UringStreamConfig config;
+    Uring ring;
+    std::vector<std::unique_ptr<UringCamera>> cameras;
+    std::vector<UringFrame*> all_frames;
+    std::vector<UringFrame*> free_frames;
+    UringStreamStats stats{};
+
+    // Since the last report
+    UringStats reported_ring{};
+    UringStreamStats reported{};
+    double reported_cpu = 0;
+};
+
+bool uring_stream_init(UringStream& stream, const UringStreamConfig& config);
+
+// Opens a capture source (capture_open()) and listens for its viewers on port.
+bool uring_stream_add_camera(UringStream& stream, const char* device, int port, int nbuffers,
+                             CaptureFormat format, CaptureMemory memory);
+
+// Runs the loop until a ring error or until every camera has stopped on a
+// capture error; a camera that fails stops alone. Returns false on error.
+bool uring_stream_run(UringStream& stream);
+
+// Prints syscalls, completions per batch and CPU per frame since the last
+// report, and each camera's counters.
+void uring_stream_report(UringStream& stream);
+
+void uring_stream_close(UringStream& stream);
@@ -1,212 +1,154 @@
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/videodev2.h>
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <arpa/inet.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <iostream>
-#include <cstring>
 #include <cstdio>
 #include <cstdlib>
-
-#include <jpeglib.h>
-
-struct buffer {
-    void* start;
-    size_t length;
-};
-
-int main() {
-    const char* device = "/dev/video0";
-    int fd = open(device, O_RDWR);
-    if (fd < 0) {
-        perror("Cannot open device");
-        return 1;
-    }
-
-    // Set format
-    v4l2_format fmt{};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = 640;
-    fmt.fmt.pix.height = 480;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;  // common format, raw YUV
-    fmt.fmt.pix.field = V4L2_FIELD_NONE;
-
-    if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
-        perror("Setting Pixel Format");
-        return 1;
-    }
-
-    // Request buffers
-    v4l2_requestbuffers req{};
-    req.count = 1;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
-        perror("Requesting Buffer");
-        return 1;
-    }
-
-    // Map buffer
-    v4l2_buffer buf{};
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = 0;
-
-    if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
-        perror("Querying Buffer");
-        return 1;
-    }
-
-    buffer buffer_info;
-    buffer_info.length = buf.length;
-    buffer_info.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-
-    if (buffer_info.start == MAP_FAILED) {
-        perror("mmap");
-        return 1;
+#include <thread>
+
+#include "capture.h"
+#include "latency.h"
+#include "pipeline.h"
+#include "stream_options.h"
+#include "tcp_fanout.h"
+#include "udp_protocol.h"
+#include "yuyv_rgb.h"
+
+// Answers the viewers' clock requests (latency.h) on fd until stop is set.
+static void clock_serve(int fd, const std::atomic<bool>& stop) {
+    // Wake up now and then to notice stop.
+    timeval tv{ 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    unsigned char buf[UDP_CLOCK_REPLY_SIZE];
+    while (!stop.load()) {
+        sockaddr_in from{};
+        socklen_t fromlen = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvfrom clock");
+            continue;
+        }
+        clock_answer(fd, buf, n, from, fromlen, latency_now_us());
     }
+}
 
-    // Start streaming
-    int type = buf.type;
-    if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
-        perror("Start Capture");
-        return 1;
+// UDP socket on the fan-out's port for clock requests; -1 on failure.
+static int clock_socket(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket clock");
+        return -1;
     }
-
-    // Setup TCP server
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
-        return 1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind clock");
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    sockaddr_in serv_addr{};
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(8080);
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-
-    int opt = 1;
-    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    if (bind(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("bind");
-        return 1;
-    }
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n" << STREAM_USAGE
+              << "  -q frames            per-client send queue before frames are dropped (default 3)\n"
+              << "  -m split|gather|zerocopy  how frames are written to sockets (default gather)\n"
+              << "  -L ms                skip frames and lower JPEG quality to keep each viewer's backlog under ms\n"
+              << "  -M file              write backlog and adaptation metrics to file every second\n";
+}
 
-    listen(sockfd, 1);
-    std::cout << "Waiting for client on port 8080...\n";
-    int clientfd = accept(sockfd, nullptr, nullptr);
-    if (clientfd < 0) {
-        perror("accept");
-        return 1;
-    }
-    std::cout << "Client connected!\n";
-
-    // JPEG compression setup
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-
-    JSAMPROW row_pointer[1];
-    unsigned char* jpeg_buf = nullptr;
-    unsigned long jpeg_size = 0;
-
-    while (true) {
-        // Queue buffer for capture
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-            perror("VIDIOC_QBUF");
+int main(int argc, char** argv) {
+    StreamOptions options;
+    FanoutConfig fanout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, STREAM_OPTSTRING "q:m:L:M:")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'q': {
+            int frames = atoi(optarg);
+            ok = frames > 0;
+            fanout.client_queue = frames;
             break;
         }
-
-        // Dequeue buffer (wait for frame)
-        if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
-            perror("VIDIOC_DQBUF");
+        case 'm': ok = parse_tcp_send_mode(optarg, fanout.send_mode); break;
+        case 'L':
+            fanout.latency_ms = atoi(optarg);
+            ok = fanout.latency_ms >= 0;
             break;
+        case 'M': fanout.metrics_path = optarg; break;
+        default: ok = parse_stream_option(opt, optarg, options);
         }
+        if (!ok) { usage(argv[0]); return 1; }
+    }
 
-        // Convert YUYV to RGB24
-        unsigned char* yuyv = static_cast<unsigned char*>(buffer_info.start);
-        int width = fmt.fmt.pix.width;
-        int height = fmt.fmt.pix.height;
-        unsigned char* rgb = new unsigned char[width * height * 3];
-
-        for (int i = 0, j = 0; i < width * height * 2; i += 4, j += 6) {
-            int y0 = yuyv[i + 0] - 16;
-            int u  = yuyv[i + 1] - 128;
-            int y1 = yuyv[i + 2] - 16;
-            int v  = yuyv[i + 3] - 128;
-
-            auto clamp = [](int val) {
-                if (val < 0) return 0;
-                if (val > 255) return 255;
-                return val;
-            };
-
-            int r = clamp((298 * y0 + 409 * v + 128) >> 8);
-            int g = clamp((298 * y0 - 100 * u - 208 * v + 128) >> 8);
-            int b = clamp((298 * y0 + 516 * u + 128) >> 8);
-
-            rgb[j + 0] = r;
-            rgb[j + 1] = g;
-            rgb[j + 2] = b;
-
-            r = clamp((298 * y1 + 409 * v + 128) >> 8);
-            g = clamp((298 * y1 - 100 * u - 208 * v + 128) >> 8);
-            b = clamp((298 * y1 + 516 * u + 128) >> 8);
-
-            rgb[j + 3] = r;
-            rgb[j + 4] = g;
-            rgb[j + 5] = b;
-        }
-
-        // Compress RGB to JPEG in memory
-        jpeg_mem_dest(&cinfo, &jpeg_buf, &jpeg_size);
-
-        cinfo.image_width = width;
-        cinfo.image_height = height;
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_RGB;
-
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, 75, TRUE);
+    // Open camera (or a recorded clip) with an N-buffer capture ring
+    Capture cap;
+    if (!capture_open(cap, options.device, 640, 480, options.nbuffers, options.format, options.memory)) return 1;
 
-        jpeg_start_compress(&cinfo, TRUE);
+    if (options.abbreviated && options.pipeline.codec != VideoCodec::Jpeg) {
+        std::cerr << "-a only applies to JPEG; sending H.264 as is\n";
+        options.abbreviated = false;
+    }
 
-        while (cinfo.next_scanline < cinfo.image_height) {
-            row_pointer[0] = &rgb[cinfo.next_scanline * width * 3];
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
-        }
+    // With a latency target the fan-out also steers the encoder's quality;
+    // with tile deltas, H.264 or the frame gate it asks for keyframes. An
+    // H.264 P-frame, like a delta, needs every frame before it.
+    PipelineControl control;
+    bool h264 = options.pipeline.codec == VideoCodec::H264;
+    fanout.tile_deltas = (options.pipeline.tile_deltas || h264) && !cap.mjpeg;
+    fanout.frame_gate = options.pipeline.gate_threshold > 0 && !cap.mjpeg;
+    if ((fanout.latency_ms > 0 || fanout.tile_deltas || fanout.frame_gate) && !cap.mjpeg) {
+        control.quality = options.pipeline.quality;
+        control.fps = options.pipeline.fps;
+        options.pipeline.control = &control;
+        fanout.control = &control;
+        fanout.max_quality = options.pipeline.quality;
+        fanout.min_quality = std::min(fanout.min_quality, options.pipeline.quality);
+    }
 
-        jpeg_finish_compress(&cinfo);
+    fanout.timestamps = options.timestamps;
+    fanout.abbreviated = options.abbreviated;
 
-        // Send JPEG size and data over TCP
-        uint32_t size_net = htonl(jpeg_size);
-        if (send(clientfd, &size_net, sizeof(size_net), 0) <= 0) break;
-        if (send(clientfd, jpeg_buf, jpeg_size, 0) <= 0) break;
+    // Serve any number of viewers; each frame is encoded once for all of them
+    FanoutServer server;
+    if (!fanout_start(server, fanout, pipeline_frame_capacity(cap, options.pipeline))) return 1;
+    std::cout << "Serving clients on port " << fanout.port << " (" << tcp_send_mode_name(fanout.send_mode)
+              << " sends" << (h264 ? ", H.264" : "") << ")...\n";
 
-        // Cleanup
-        free(jpeg_buf);
-        jpeg_buf = nullptr;
-        jpeg_size = 0;
-        delete[] rgb;
+    // Frames carry their capture time; viewers on other hosts put it on
+    // their own clock by asking ours over UDP on the same port.
+    std::atomic<bool> stop_clock{false};
+    std::thread clock_thread;
+    int clock_fd = options.timestamps ? clock_socket(fanout.port) : -1;
+    if (clock_fd >= 0) clock_thread = std::thread(clock_serve, clock_fd, std::cref(stop_clock));
 
-        // Optional: small sleep or frame rate limit
-        usleep(13000);  // ~30fps
+    if (!cap.mjpeg && options.pipeline.input == JpegInput::Rgb) {
+        std::cout << "YUYV->RGB24 conversion: " << yuyv_to_rgb24_path() << "\n";
     }
 
+    // Capture, encode (or pass MJPEG through) on worker threads, publish here in frame order
+    bool ok = pipeline_run(cap, options.pipeline, [&](const PipelineFrame& frame) {
+        fanout_publish(server, frame);
+        return true;
+    });
+
     // Cleanup
-    jpeg_destroy_compress(&cinfo);
-    close(clientfd);
-    close(sockfd);
-    munmap(buffer_info.start, buffer_info.length);
-    close(fd);
+    fanout_stop(server);
+    if (clock_thread.joinable()) {
+        stop_clock = true;
+        clock_thread.join();
+    }
+    if (clock_fd >= 0) close(clock_fd);
+    capture_report(cap);
+    capture_close(cap);
 
-    return 0;
+    return ok ? 0 : 1;
 }
-
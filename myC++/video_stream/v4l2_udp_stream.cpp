@@ -1,8 +1,4 @@
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/videodev2.h>
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -10,55 +6,117 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
-#include <jpeglib.h>
+#include <cerrno>
+#include <thread>
+#include "capture.h"
+#include "jpeg_tables.h"
+#include "latency.h"
+#include "pacer.h"
+#include "pipeline.h"
+#include "stream_options.h"
+#include "rate_control.h"
+#include "udp_feedback.h"
+#include "udp_retransmit.h"
+#include "udp_send.h"
+#include "yuyv_rgb.h"
 
 #define PORT 8080
 #define DEST_IP "127.0.0.1" // destination ip to send to
 #define PACKET_SIZE 1400  // max UDP payload is ~1500 - IP/UDP headers
+#define RETRANSMIT_FRAMES 16  // frames kept for NACKs
+
+// Answers NACKs (when ring is set) and clock requests, feeds receiver reports
+// to rc (when set) and passes keyframe requests to control and resend_tables
+// (when set) until stop is set.
+static void feedback_serve(int fd, RetransmitRing* ring, RateControl* rc, PipelineControl* control,
+                           std::atomic<bool>* resend_tables, const std::atomic<bool>& stop) {
+    // Wake up now and then to notice stop.
+    timeval tv{ 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    unsigned char buf[UDP_HEADER_SIZE + UDP_NACK_MAX_RANGES * UDP_EXT_SIZE];
+    std::vector<std::vector<unsigned char>> packets;
+    while (!stop.load()) {
+        sockaddr_in from{};
+        socklen_t fromlen = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
+        uint64_t received_us = latency_now_us();
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvfrom feedback");
+            continue;
+        }
+        if (clock_answer(fd, buf, n, from, fromlen, received_us)) continue;
+
+        UdpReport report;
+        if (udp_read_report(buf, n, report)) {
+            if (rc) rate_control_on_report(*rc, report, monotonic_ns() / 1000000);
+            continue;
+        }
+        if (udp_is_keyframe_request(buf, n)) {
+            // Also sent by receivers missing the tables of an abbreviated frame
+            if (control) control->keyframe = true;
+            if (resend_tables) *resend_tables = true;
+            continue;
+        }
+        if (!ring) continue;
+
+        packets.clear();
+        retransmit_collect(*ring, buf, n, monotonic_ns() / 1000000, packets);
+        for (const auto& p : packets) {
+            if (sendto(fd, p.data(), p.size(), 0, (sockaddr*)&from, fromlen) < 0) perror("sendto retransmit");
+        }
+    }
+}
 
-struct buffer {
-    void* start;
-    size_t length;
-};
-
-int main() {
-    // Open camera
-    const char* device = "/dev/video0";
-    int fd = open(device, O_RDWR);
-    if (fd < 0) { perror("Cannot open device"); return 1; }
-
-    // Set format
-    v4l2_format fmt{};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = 640;
-    fmt.fmt.pix.height = 480;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.field = V4L2_FIELD_NONE;
-
-    if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) { perror("Setting Pixel Format"); return 1; }
-
-    // Request buffer
-    v4l2_requestbuffers req{};
-    req.count = 1;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) { perror("Requesting Buffer"); return 1; }
-
-    // Map buffer
-    v4l2_buffer buf{};
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.index = 0;
-    if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("Querying Buffer"); return 1; }
-
-    buffer buffer_info;
-    buffer_info.length = buf.length;
-    buffer_info.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-    if (buffer_info.start == MAP_FAILED) { perror("mmap"); return 1; }
-
-    // Start streaming
-    int type = buf.type;
-    if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) { perror("Start Capture"); return 1; }
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n" << STREAM_USAGE
+              << "  -m sendto|mmsg|gso   how chunks are sent (default gso, mmsg if unsupported)\n"
+              << "  -F percent           XOR parity packets per frame, as a share of its chunks (default 0)\n"
+              << "  -R ms                resend chunks the receiver NACKs, up to ms after the frame (default 0, off)\n"
+              << "  -A                   adapt quality, size and frame rate to the receiver's reports\n";
+}
+
+int main(int argc, char** argv) {
+    StreamOptions options;
+    UdpSendMode send_mode = UdpSendMode::Gso;
+    int fec_percent = 0;
+    int repair_ms = 0;
+    bool adaptive = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, STREAM_OPTSTRING "m:F:R:A")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'm': ok = parse_udp_send_mode(optarg, send_mode); break;
+        case 'F':
+            fec_percent = atoi(optarg);
+            ok = fec_percent >= 0 && fec_percent <= 100;
+            break;
+        case 'R':
+            repair_ms = atoi(optarg);
+            ok = repair_ms >= 0;
+            break;
+        case 'A': adaptive = true; break;
+        default: ok = parse_stream_option(opt, optarg, options);
+        }
+        if (!ok) { usage(argv[0]); return 1; }
+    }
+
+    // Receiver reports measure jitter against a steady frame rate, which
+    // gated frames do not keep; rate control would read it as congestion.
+    if (adaptive && options.pipeline.gate_threshold > 0) {
+        std::cerr << "-G does not work with -A; sending every frame\n";
+        options.pipeline.gate_threshold = 0;
+    }
+    bool h264 = options.pipeline.codec == VideoCodec::H264;
+    if (options.abbreviated && h264) {
+        std::cerr << "-a only applies to JPEG; sending H.264 as is\n";
+        options.abbreviated = false;
+    }
+
+    // Open camera (or a recorded clip) with an N-buffer capture ring
+    Capture cap;
+    if (!capture_open(cap, options.device, 640, 480, options.nbuffers, options.format, options.memory)) return 1;
 
     // UDP socket setup
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -69,92 +127,114 @@ int main() {
     client_addr.sin_port = htons(PORT);
     inet_pton(AF_INET, DEST_IP, &client_addr.sin_addr);
 
-    // JPEG compression setup
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-
-    JSAMPROW row_pointer[1];
-    unsigned char* jpeg_buf = nullptr;
-    unsigned long jpeg_size = 0;
+    if (!cap.mjpeg && options.pipeline.input == JpegInput::Rgb) {
+        std::cout << "YUYV->RGB24 conversion: " << yuyv_to_rgb24_path() << "\n";
+    }
+    size_t max_frame_size = pipeline_frame_capacity(cap, options.pipeline);
+
+    // Abbreviated session: frames lose their tables but gain a tag naming
+    // them; the tables go out in one datagram.
+    JpegTables tables;
+    std::vector<unsigned char> abbreviated;
+    uint16_t tables_sent = 0;
+    std::atomic<bool> resend_tables{false};
+    if (options.abbreviated) {
+        tables.tag = true;
+        tables.max_size = PACKET_SIZE - UDP_TABLES_HEADER_SIZE;
+        max_frame_size += JPEG_TABLES_TAG_SIZE;
+        abbreviated.resize(max_frame_size);
+    }
+    UdpSender sender;
+    if (!udp_sender_init(sender, sockfd, client_addr, send_mode, PACKET_SIZE, max_frame_size, fec_percent)) {
+        return 1;
+    }
+    std::cout << "Sending chunks with " << udp_send_mode_name(send_mode);
+    if (fec_percent > 0) std::cout << ", " << fec_percent << "% XOR parity";
+    if (repair_ms > 0) std::cout << ", retransmitting for " << repair_ms << " ms";
+    if (adaptive) std::cout << ", adaptive rate";
+    if (h264) std::cout << ", H.264";
+    if (options.pipeline.tile_deltas && !cap.mjpeg && !h264) std::cout << ", tile deltas";
+    if (options.pipeline.gate_threshold > 0 && !cap.mjpeg) std::cout << ", frame gate";
+    if (options.timestamps) std::cout << ", timestamps";
+    if (options.abbreviated) std::cout << ", abbreviated JPEG";
+    std::cout << "\n";
     uint32_t frame_id = 0;
 
-    while (true) {
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); break; }
-        if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) { perror("VIDIOC_DQBUF"); break; }
-
-        // Convert YUYV to RGB
-        unsigned char* yuyv = static_cast<unsigned char*>(buffer_info.start);
-        int width = fmt.fmt.pix.width;
-        int height = fmt.fmt.pix.height;
-        unsigned char* rgb = new unsigned char[width * height * 3];
-
-        for (int i = 0, j = 0; i < width * height * 2; i += 4, j += 6) {
-            int y0 = yuyv[i + 0] - 16;
-            int u  = yuyv[i + 1] - 128;
-            int y1 = yuyv[i + 2] - 16;
-            int v  = yuyv[i + 3] - 128;
-
-            auto clamp = [](int val) { return val < 0 ? 0 : (val > 255 ? 255 : val); };
-
-            rgb[j + 0] = clamp((298 * y0 + 409 * v + 128) >> 8);
-            rgb[j + 1] = clamp((298 * y0 - 100 * u - 208 * v + 128) >> 8);
-            rgb[j + 2] = clamp((298 * y0 + 516 * u + 128) >> 8);
-            rgb[j + 3] = clamp((298 * y1 + 409 * v + 128) >> 8);
-            rgb[j + 4] = clamp((298 * y1 - 100 * u - 208 * v + 128) >> 8);
-            rgb[j + 5] = clamp((298 * y1 + 516 * u + 128) >> 8);
-        }
+    RetransmitRing ring;
+    if (repair_ms > 0) retransmit_init(ring, sender, RETRANSMIT_FRAMES, max_frame_size, repair_ms);
+
+    PipelineControl control;
+    RateControl rc;
+    if (adaptive) {
+        rate_control_init(rc, control, options.pipeline.quality, options.pipeline.fps, cap.mjpeg, cap.width, cap.height);
+        options.pipeline.control = &control;
+    } else if (options.pipeline.tile_deltas || h264) {
+        // Only for keyframe requests
+        control.quality = options.pipeline.quality;
+        control.fps = options.pipeline.fps;
+        options.pipeline.control = &control;
+    }
 
-        // Compress to JPEG
-        jpeg_mem_dest(&cinfo, &jpeg_buf, &jpeg_size);
-        cinfo.image_width = width;
-        cinfo.image_height = height;
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_RGB;
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, 75, TRUE);
-        jpeg_start_compress(&cinfo, TRUE);
-
-        while (cinfo.next_scanline < cinfo.image_height) {
-            row_pointer[0] = &rgb[cinfo.next_scanline * width * 3];
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    // NACKs, receiver reports, keyframe and clock requests come back on the
+    // same socket and are handled on their own thread.
+    std::atomic<bool> stop_feedback{false};
+    std::thread feedback_thread;
+    if (repair_ms > 0 || adaptive || options.pipeline.tile_deltas || h264 || options.timestamps ||
+        options.abbreviated) {
+        feedback_thread = std::thread(feedback_serve, sockfd, repair_ms > 0 ? &ring : nullptr,
+                                      adaptive ? &rc : nullptr, options.pipeline.control,
+                                      options.abbreviated ? &resend_tables : nullptr, std::cref(stop_feedback));
+    }
+
+    // Capture, encode (or pass MJPEG through) on worker threads, send here in frame order
+    bool ok = pipeline_run(cap, options.pipeline, [&](const PipelineFrame& frame) {
+        const unsigned char* data = frame.jpeg;
+        size_t size = frame.jpeg_size;
+        uint16_t needs = 0;
+        if (options.abbreviated) {
+            size = jpeg_tables_abbreviate(tables, frame.jpeg, frame.jpeg_size, abbreviated.data(), needs);
+            data = abbreviated.data();
         }
-        jpeg_finish_compress(&cinfo);
-
-        // Send in chunks with header
-        size_t max_data = PACKET_SIZE - 8; // 4 bytes frame_id, 2 bytes total_parts, 2 bytes part_index
-        int total_parts = (jpeg_size + max_data - 1) / max_data;
-
-        for (int i = 0; i < total_parts; ++i) {
-            size_t chunk_size = (i < total_parts - 1) ? max_data : (jpeg_size - i * max_data);
-            char packet[PACKET_SIZE];
-
-            // Header: [frame_id (4)] [total_parts (2)] [part_index (2)]
-            uint32_t fid = htonl(frame_id);
-            uint16_t parts = htons(total_parts);
-            uint16_t index = htons(i);
-            memcpy(packet, &fid, 4);
-            memcpy(packet + 4, &parts, 2);
-            memcpy(packet + 6, &index, 2);
-            memcpy(packet + 8, jpeg_buf + i * max_data, chunk_size);
-
-            sendto(sockfd, packet, chunk_size + 8, 0, (sockaddr*)&client_addr, sizeof(client_addr));
+        if (repair_ms > 0) retransmit_store(ring, frame_id, data, size, monotonic_ns() / 1000000);
+        // Send errors (e.g. ENOBUFS) lose this frame only; keep streaming.
+        uint64_t bytes = sender.stats.bytes;
+        if (options.timestamps) {
+            udp_send_timestamp(sender, frame_id, size, capture_timestamp_ns(frame.capture) / 1000);
         }
-
-        frame_id++;
-        free(jpeg_buf);
-        jpeg_buf = nullptr;
-        jpeg_size = 0;
-        delete[] rgb;
-        usleep(10000); // ~30fps
-    }
+        // New tables, or a receiver asked for them
+        if (needs && (needs != tables_sent || resend_tables.exchange(false))) {
+            udp_send_tables(sender, frame_id, size, needs, tables.data.data(), tables.data.size());
+            tables_sent = needs;
+            tables.stats.sent++;
+            tables.stats.sent_bytes += tables.data.size();
+        }
+        udp_send_frame(sender, frame_id++, data, size);
+        if (adaptive) rate_control_on_sent(rc, sender.stats.bytes - bytes, monotonic_ns() / 1000000);
+        if (options.pipeline.report_every && sender.stats.frames % options.pipeline.report_every == 0) {
+            printf("udp: %lu frames, %lu packets (%lu parity) in %lu syscalls, %lu errors\n",
+                   (unsigned long)sender.stats.frames, (unsigned long)sender.stats.packets,
+                   (unsigned long)sender.stats.parity_packets, (unsigned long)sender.stats.syscalls,
+                   (unsigned long)sender.stats.errors);
+            if (repair_ms > 0) {
+                std::lock_guard<std::mutex> guard(ring.lock);
+                printf("udp: %lu NACKs for %lu chunks: %lu resent, %lu past the deadline, %lu no longer kept\n",
+                       (unsigned long)ring.stats.nacks, (unsigned long)ring.stats.requested,
+                       (unsigned long)ring.stats.resent, (unsigned long)ring.stats.too_late,
+                       (unsigned long)ring.stats.missing);
+            }
+            if (options.abbreviated) jpeg_tables_report(tables);
+        }
+        return true;
+    });
 
     // Cleanup
-    jpeg_destroy_compress(&cinfo);
-    munmap(buffer_info.start, buffer_info.length);
-    close(fd);
+    if (feedback_thread.joinable()) {
+        stop_feedback = true;
+        feedback_thread.join();
+    }
+    capture_report(cap);
+    capture_close(cap);
     close(sockfd);
-    return 0;
+    return ok ? 0 : 1;
 }
 
@@ -0,0 +1,67 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "capture.h"
+#include "jpeg_encoder.h"
+#include "uring_stream.h"
+
+#define PORT 8080
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  -d source            capture device, recorded clip or pattern[:WIDTHxHEIGHT]; repeat for more\n"
+              << "                       cameras, served on consecutive ports (default /dev/video0)\n"
+              << "  -p port              port of the first source (default 8080)\n"
+              << "  -n buffers           capture ring size (default 4)\n"
+              << "  -f auto|yuyv|mjpeg   capture format; MJPEG frames are sent as-is (default auto)\n"
+              << "  -b auto|mmap|userptr capture buffers: driver-mapped, or our pool (default auto)\n"
+              << "  -r fps               target frame rate, 0 for every captured frame (default 30)\n"
+              << "  -e rgb|yuv|yuv422    JPEG input path (default yuv)\n"
+              << "  -q quality           JPEG quality (default 75)\n"
+              << "  -R frames            report every this many frames, over all sources (default 300, 0: off)\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<const char*> devices;
+    int port = PORT;
+    int nbuffers = 4;
+    CaptureFormat format = CaptureFormat::Auto;
+    CaptureMemory memory = CaptureMemory::Auto;
+    UringStreamConfig config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:p:n:f:b:r:e:q:R:")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'd': devices.push_back(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': nbuffers = atoi(optarg); break;
+        case 'f': ok = parse_capture_format(optarg, format); break;
+        case 'b': ok = parse_capture_memory(optarg, memory); break;
+        case 'r': config.fps = atof(optarg); break;
+        case 'e': ok = parse_jpeg_input(optarg, config.input); break;
+        case 'q': config.quality = atoi(optarg); break;
+        case 'R': config.report_every = atoi(optarg); break;
+        default: ok = false;
+        }
+        if (!ok) { usage(argv[0]); return 1; }
+    }
+    if (devices.empty()) devices.push_back("/dev/video0");
+
+    // One thread and one io_uring for every camera and every viewer
+    UringStream stream;
+    if (!uring_stream_init(stream, config)) return 1;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (!uring_stream_add_camera(stream, devices[i], port + i, nbuffers, format, memory)) return 1;
+    }
+    std::cout << "Serving " << devices.size() << " source(s) from one io_uring thread...\n";
+
+    bool ok = uring_stream_run(stream);
+    uring_stream_report(stream);
+    uring_stream_close(stream);
+    return ok ? 0 : 1;
+}
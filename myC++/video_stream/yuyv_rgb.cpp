@@ -0,0 +1,236 @@
+#include "yuyv_rgb.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUYV_X86 1
+#include <immintrin.h>
+#endif
+
+static inline unsigned char clamp(int val) {
+    return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
+
+void yuyv_to_rgb24_scalar(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    for (size_t i = 0; i < pixels; i += 2, yuyv += 4, rgb += 6) {
+        int y0 = yuyv[0] - 16;
+        int u  = yuyv[1] - 128;
+        int y1 = yuyv[2] - 16;
+        int v  = yuyv[3] - 128;
+
+        rgb[0] = clamp((298 * y0 + 409 * v + 128) >> 8);
+        rgb[1] = clamp((298 * y0 - 100 * u - 208 * v + 128) >> 8);
+        rgb[2] = clamp((298 * y0 + 516 * u + 128) >> 8);
+        rgb[3] = clamp((298 * y1 + 409 * v + 128) >> 8);
+        rgb[4] = clamp((298 * y1 - 100 * u - 208 * v + 128) >> 8);
+        rgb[5] = clamp((298 * y1 + 516 * u + 128) >> 8);
+    }
+}
+
+#ifdef YUYV_X86
+
+// The SIMD paths work on 16-bit lanes holding one macropixel per 64 bits:
+// [y0 u y1 v]. shufflelo/hi turn that into (y,u), (y,v) and (v,v) pairs, one
+// pair per output pixel, and pmaddwd evaluates both terms of each pair into a
+// 32-bit sum, which is exactly the scalar expression before the shift.
+// packs/packus then reproduce the 0..255 clamp.
+
+// Two 16-bit coefficients packed into one 32-bit lane, low one first.
+static inline int pair16(int lo, int hi) {
+    return (int)(((uint32_t)(uint16_t)hi << 16) | (uint16_t)lo);
+}
+
+__attribute__((target("sse2")))
+static inline void yuv_madd_sse2(__m128i w, __m128i& r, __m128i& g, __m128i& b) {
+    const __m128i offset = _mm_set1_epi32(pair16(16, 128));
+    const __m128i round = _mm_set1_epi32(128);
+    w = _mm_sub_epi16(w, offset);
+
+    __m128i yu = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, _MM_SHUFFLE(1, 2, 1, 0)), _MM_SHUFFLE(1, 2, 1, 0));
+    __m128i yv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, _MM_SHUFFLE(3, 2, 3, 0)), _MM_SHUFFLE(3, 2, 3, 0));
+    __m128i vv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    r = _mm_madd_epi16(yv, _mm_set1_epi32(pair16(298, 409)));
+    g = _mm_add_epi32(_mm_madd_epi16(yu, _mm_set1_epi32(pair16(298, -100))),
+                      _mm_madd_epi16(vv, _mm_set1_epi32(pair16(-208, 0))));
+    b = _mm_madd_epi16(yu, _mm_set1_epi32(pair16(298, 516)));
+
+    r = _mm_srai_epi32(_mm_add_epi32(r, round), 8);
+    g = _mm_srai_epi32(_mm_add_epi32(g, round), 8);
+    b = _mm_srai_epi32(_mm_add_epi32(b, round), 8);
+}
+
+__attribute__((target("sse2")))
+void yuyv_to_rgb24_sse2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    // 8 pixels per iteration. Pixels are written as overlapping 4-byte
+    // stores, so the last one spills a byte and needs a pixel of slack.
+    for (; i + 9 <= pixels; i += 8) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(yuyv + i * 2));
+        __m128i r0, g0, b0, r1, g1, b1;
+        yuv_madd_sse2(_mm_unpacklo_epi8(in, zero), r0, g0, b0);
+        yuv_madd_sse2(_mm_unpackhi_epi8(in, zero), r1, g1, b1);
+
+        __m128i rg = _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(g0, g1));  // r0..r7 g0..g7
+        __m128i b8 = _mm_packus_epi16(_mm_packs_epi32(b0, b1), zero);
+        __m128i rgi = _mm_unpacklo_epi8(rg, _mm_srli_si128(rg, 8));                        // r0 g0 r1 g1 ...
+        __m128i bz = _mm_unpacklo_epi8(b8, zero);                                          // b0 0 b1 0 ...
+
+        __m128i px[2] = { _mm_unpacklo_epi16(rgi, bz), _mm_unpackhi_epi16(rgi, bz) };
+        unsigned char* out = rgb + i * 3;
+        for (int k = 0; k < 2; ++k) {
+            __m128i p = px[k];
+            for (int n = 0; n < 4; ++n) {
+                uint32_t word = _mm_cvtsi128_si32(p);
+                memcpy(out, &word, 4);
+                out += 3;
+                p = _mm_srli_si128(p, 4);
+            }
+        }
+    }
+
+    yuyv_to_rgb24_scalar(yuyv + i * 2, rgb + i * 3, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static inline void yuv_madd_avx2(__m256i w, __m256i& r, __m256i& g, __m256i& b) {
+    const __m256i offset = _mm256_set1_epi32(pair16(16, 128));
+    const __m256i round = _mm256_set1_epi32(128);
+    w = _mm256_sub_epi16(w, offset);
+
+    __m256i yu = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(1, 2, 1, 0)), _MM_SHUFFLE(1, 2, 1, 0));
+    __m256i yv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(3, 2, 3, 0)), _MM_SHUFFLE(3, 2, 3, 0));
+    __m256i vv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    r = _mm256_madd_epi16(yv, _mm256_set1_epi32(pair16(298, 409)));
+    g = _mm256_add_epi32(_mm256_madd_epi16(yu, _mm256_set1_epi32(pair16(298, -100))),
+                         _mm256_madd_epi16(vv, _mm256_set1_epi32(pair16(-208, 0))));
+    b = _mm256_madd_epi16(yu, _mm256_set1_epi32(pair16(298, 516)));
+
+    r = _mm256_srai_epi32(_mm256_add_epi32(r, round), 8);
+    g = _mm256_srai_epi32(_mm256_add_epi32(g, round), 8);
+    b = _mm256_srai_epi32(_mm256_add_epi32(b, round), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pack_avx2(__m256i lo, __m256i hi) {
+    // packs interleaves the 128-bit lanes; put the 16 pixels back in order.
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+__attribute__((target("avx2")))
+void yuyv_to_rgb24_avx2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgbx_to_rgb = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+
+    // 16 pixels per iteration. Each 16-byte store carries 12 bytes of RGB,
+    // so the last one spills 4 bytes and needs two pixels of slack.
+    for (; i + 18 <= pixels; i += 16) {
+        const unsigned char* src = yuyv + i * 2;
+        __m256i r0, g0, b0, r1, g1, b1;
+        yuv_madd_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)src)), r0, g0, b0);
+        yuv_madd_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + 16))), r1, g1, b1);
+
+        __m256i r16 = pack_avx2(r0, r1);
+        __m256i g16 = pack_avx2(g0, g1);
+        __m256i b16 = pack_avx2(b0, b1);
+
+        // Per lane (8 pixels each): r g interleaved, b zero-extended, then RGBX.
+        __m256i rg = _mm256_packus_epi16(r16, g16);
+        __m256i rgi = _mm256_unpacklo_epi8(rg, _mm256_srli_si256(rg, 8));
+        __m256i bz = _mm256_unpacklo_epi8(_mm256_packus_epi16(b16, zero), zero);
+        __m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rgi, bz), rgbx_to_rgb);  // px 0-3 | 8-11
+        __m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rgi, bz), rgbx_to_rgb);  // px 4-7 | 12-15
+
+        unsigned char* out = rgb + i * 3;
+        _mm_storeu_si128((__m128i*)(out + 0), _mm256_castsi256_si128(lo));
+        _mm_storeu_si128((__m128i*)(out + 12), _mm256_castsi256_si128(hi));
+        _mm_storeu_si128((__m128i*)(out + 24), _mm256_extracti128_si256(lo, 1));
+        _mm_storeu_si128((__m128i*)(out + 36), _mm256_extracti128_si256(hi, 1));
+    }
+
+    yuyv_to_rgb24_scalar(yuyv + i * 2, rgb + i * 3, pixels - i);
+}
+
+#else
+
+void yuyv_to_rgb24_sse2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    yuyv_to_rgb24_scalar(yuyv, rgb, pixels);
+}
+
+void yuyv_to_rgb24_avx2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    yuyv_to_rgb24_scalar(yuyv, rgb, pixels);
+}
+
+#endif
+
+bool yuyv_path_supported(const char* name) {
+    if (strcmp(name, "scalar") == 0) return true;
+#ifdef YUYV_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+struct ConvertPath {
+    const char* name;
+    yuyv_convert_fn fn;
+};
+
+static ConvertPath resolve_path() {
+    static const ConvertPath paths[] = {
+        { "avx2", yuyv_to_rgb24_avx2 },
+        { "sse2", yuyv_to_rgb24_sse2 },
+        { "scalar", yuyv_to_rgb24_scalar },
+    };
+
+    const char* forced = getenv("YUYV_CONVERT");
+    if (forced) {
+        for (const auto& p : paths) {
+            if (strcmp(forced, p.name) == 0 && yuyv_path_supported(p.name)) return p;
+        }
+    }
+    for (const auto& p : paths) {
+        if (yuyv_path_supported(p.name)) return p;
+    }
+    return paths[2];
+}
+
+static const ConvertPath& selected_path() {
+    static const ConvertPath path = resolve_path();
+    return path;
+}
+
+void yuyv_to_rgb24(const unsigned char* yuyv, unsigned char* rgb, size_t pixels) {
+    selected_path().fn(yuyv, rgb, pixels);
+}
+
+const char* yuyv_to_rgb24_path() {
+    return selected_path().name;
+}
+
+void yuyv_downscale_half(const unsigned char* src, int width, int height, unsigned char* dst) {
+    int out_w = width / 2 & ~1;
+    int out_h = height / 2;
+    size_t stride = (size_t)width * 2;
+    for (int y = 0; y < out_h; ++y) {
+        const unsigned char* r0 = src + 2 * y * stride;
+        const unsigned char* r1 = r0 + stride;
+        unsigned char* d = dst + (size_t)y * out_w * 2;
+        // Each output Y0 U Y1 V comes from two source macropixels over two rows.
+        for (int x = 0; x < out_w; x += 2, r0 += 8, r1 += 8, d += 4) {
+            d[0] = (r0[0] + r0[2] + r1[0] + r1[2] + 2) >> 2;
+            d[2] = (r0[4] + r0[6] + r1[4] + r1[6] + 2) >> 2;
+            d[1] = (r0[1] + r0[5] + r1[1] + r1[5] + 2) >> 2;
+            d[3] = (r0[3] + r0[7] + r1[3] + r1[7] + 2) >> 2;
+        }
+    }
+}
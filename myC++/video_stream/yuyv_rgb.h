@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+// YUYV (4:2:2, BT.601 studio range) to packed RGB24.
+//
+// Every path uses the same fixed-point arithmetic as the original scalar loop
+// ((298*y + 409*v + 128) >> 8 and friends, clamped to 0..255), so the output
+// is bit-identical whichever one runs. `pixels` must be even.
+
+typedef void (*yuyv_convert_fn)(const unsigned char* yuyv, unsigned char* rgb, size_t pixels);
+
+void yuyv_to_rgb24_scalar(const unsigned char* yuyv, unsigned char* rgb, size_t pixels);
+void yuyv_to_rgb24_sse2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels);
+void yuyv_to_rgb24_avx2(const unsigned char* yuyv, unsigned char* rgb, size_t pixels);
+
+// Picks the fastest path the CPU supports (cpuid) on first use. Setting
+// YUYV_CONVERT=scalar|sse2|avx2 in the environment forces a path.
+void yuyv_to_rgb24(const unsigned char* yuyv, unsigned char* rgb, size_t pixels);
+const char* yuyv_to_rgb24_path();
+
+// Whether a given path can run on this CPU ("scalar", "sse2" or "avx2").
+bool yuyv_path_supported(const char* name);
+
+// Halves a YUYV frame in both directions by averaging 2x2 blocks, for
+// sending a smaller picture. dst holds (width / 2 & ~1) x (height / 2) pixels.
+void yuyv_downscale_half(const unsigned char* src, int width, int height, unsigned char* dst);